@@ -13,13 +13,18 @@
  */
 
 #include <getopt.h>
+#include <stddef.h>
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include "include/ebtables_u.h"
 
 extern char* hooknames[NF_BR_NUMHOOKS];
@@ -47,20 +52,124 @@ static int get_sockfd()
 	return ret;
 }
 
-static struct ebt_replace *translate_user2kernel(struct ebt_u_replace *u_repl)
+/* Size of a rule in the kernel table, the lists of e should contain
+ * pointers to the kernel data */
+unsigned int ebt_entry_size(const struct ebt_u_entry *e)
+{
+	struct ebt_u_match_list *m_l;
+	struct ebt_u_watcher_list *w_l;
+	unsigned int size = sizeof(struct ebt_entry);
+
+	for (m_l = e->m_list; m_l; m_l = m_l->next)
+		size += m_l->m->match_size + sizeof(struct ebt_entry_match);
+	for (w_l = e->w_list; w_l; w_l = w_l->next)
+		size += w_l->w->watcher_size + sizeof(struct ebt_entry_watcher);
+	return size + e->t->target_size + sizeof(struct ebt_entry_target);
+}
+
+/* Translate the rules of a chain, p points behind the struct ebt_entries */
+static char *translate_chain(struct ebt_u_entries *entries, char *p,
+			     unsigned int *chain_offsets)
 {
-	struct ebt_replace *new;
 	struct ebt_u_entry *e;
 	struct ebt_u_match_list *m_l;
 	struct ebt_u_watcher_list *w_l;
+	char *base;
+
+	e = entries->entries->next;
+	while (e != entries->entries) {
+		struct ebt_entry *tmp = (struct ebt_entry *)p;
+
+		/* The buffer is reused, don't leave old data in the padding */
+		memset(tmp, 0, sizeof(struct ebt_entry));
+		tmp->bitmask = e->bitmask | EBT_ENTRY_OR_ENTRIES;
+		tmp->invflags = e->invflags;
+		tmp->ethproto = e->ethproto;
+		strcpy(tmp->in, e->in);
+		strcpy(tmp->out, e->out);
+		strcpy(tmp->logical_in, e->logical_in);
+		strcpy(tmp->logical_out, e->logical_out);
+		memcpy(tmp->sourcemac, e->sourcemac,
+		   sizeof(tmp->sourcemac));
+		memcpy(tmp->sourcemsk, e->sourcemsk,
+		   sizeof(tmp->sourcemsk));
+		memcpy(tmp->destmac, e->destmac, sizeof(tmp->destmac));
+		memcpy(tmp->destmsk, e->destmsk, sizeof(tmp->destmsk));
+
+		base = p;
+		p += sizeof(struct ebt_entry);
+		m_l = e->m_list;
+		while (m_l) {
+			memcpy(p, m_l->m, m_l->m->match_size +
+			   sizeof(struct ebt_entry_match));
+			p += m_l->m->match_size +
+			   sizeof(struct ebt_entry_match);
+			m_l = m_l->next;
+		}
+		tmp->watchers_offset = p - base;
+		w_l = e->w_list;
+		while (w_l) {
+			memcpy(p, w_l->w, w_l->w->watcher_size +
+			   sizeof(struct ebt_entry_watcher));
+			p += w_l->w->watcher_size +
+			   sizeof(struct ebt_entry_watcher);
+			w_l = w_l->next;
+		}
+		tmp->target_offset = p - base;
+		memcpy(p, e->t, e->t->target_size +
+		   sizeof(struct ebt_entry_target));
+		if (e->standard) {
+			struct ebt_standard_target *st =
+			   (struct ebt_standard_target *)p;
+			/* Translate the jump to a udc */
+			if (st->verdict >= 0)
+				st->verdict = chain_offsets
+				   [st->verdict + NF_BR_NUMHOOKS];
+		}
+		p += e->t->target_size +
+		   sizeof(struct ebt_entry_target);
+		tmp->next_offset = p - base;
+		e = e->next;
+	}
+	return p;
+}
+
+/* The rules of the chain were copied unchanged from the previous table,
+ * but the udc's may have moved */
+static void update_chain_jumps(struct ebt_u_entries *entries, char *p,
+			       unsigned int *chain_offsets)
+{
+	struct ebt_u_entry *e;
+	struct ebt_entry *tmp;
+	int verdict;
+
+	e = entries->entries->next;
+	while (e != entries->entries) {
+		tmp = (struct ebt_entry *)p;
+		if (e->standard) {
+			verdict = ((struct ebt_standard_target *)e->t)->verdict;
+			if (verdict >= 0)
+				((struct ebt_standard_target *)
+				   (p + tmp->target_offset))->verdict =
+				   chain_offsets[verdict + NF_BR_NUMHOOKS];
+		}
+		p += tmp->next_offset;
+		e = e->next;
+	}
+}
+
+/* The chains keep track of their size, so the table is put together in one
+ * pass. Chains that didn't change since the previous call are copied from the
+ * previous table. The entries are put in u_repl->blob, which stays valid until
+ * the next call */
+static void translate_user2kernel(struct ebt_u_replace *u_repl,
+				  struct ebt_replace *new)
+{
 	struct ebt_u_entries *entries;
-	char *p, *base;
-	int i, j;
+	char *p;
+	int i, moved = 0;
 	unsigned int entries_size = 0, *chain_offsets;
 
-	new = (struct ebt_replace *)malloc(sizeof(struct ebt_replace));
-	if (!new)
-		ebt_print_memory();
 	new->valid_hooks = u_repl->valid_hooks;
 	strcpy(new->name, u_repl->name);
 	new->nentries = u_repl->nentries;
@@ -74,170 +183,222 @@ static struct ebt_replace *translate_user2kernel(struct ebt_u_replace *u_repl)
 		if (!(entries = u_repl->chains[i]))
 			continue;
 		chain_offsets[i] = entries_size;
-		entries_size += sizeof(struct ebt_entries);
-		j = 0;
-		e = entries->entries->next;
-		while (e != entries->entries) {
-			j++;
-			entries_size += sizeof(struct ebt_entry);
-			m_l = e->m_list;
-			while (m_l) {
-				entries_size += m_l->m->match_size +
-				   sizeof(struct ebt_entry_match);
-				m_l = m_l->next;
-			}
-			w_l = e->w_list;
-			while (w_l) {
-				entries_size += w_l->w->watcher_size +
-				   sizeof(struct ebt_entry_watcher);
-				w_l = w_l->next;
-			}
-			entries_size += e->t->target_size +
-			   sizeof(struct ebt_entry_target);
-			e = e->next;
-		}
-		/* A little sanity check */
-		if (j != entries->nentries)
-			ebt_print_bug("Wrong nentries: %d != %d, hook = %s", j,
-			   entries->nentries, entries->name);
+		if (entries->blob_offset != entries_size)
+			moved = 1;
+		entries_size += entries->entries_size;
 	}
 
 	new->entries_size = entries_size;
-	p = (char *)malloc(entries_size);
-	if (!p)
-		ebt_print_memory();
+	if (u_repl->blob_spare_size < entries_size) {
+		free(u_repl->blob_spare);
+		u_repl->blob_spare_size = entries_size + entries_size / 4;
+		u_repl->blob_spare = (char *)malloc(u_repl->blob_spare_size);
+		if (!u_repl->blob_spare)
+			ebt_print_memory();
+	}
+	p = u_repl->blob_spare;
 
 	/* Put everything in one block */
 	new->entries = sparc_cast p;
 	for (i = 0; i < u_repl->num_chains; i++) {
 		struct ebt_entries *hlp;
+		char *start = p;
 
 		hlp = (struct ebt_entries *)p;
 		if (!(entries = u_repl->chains[i]))
 			continue;
 		if (i < NF_BR_NUMHOOKS)
 			new->hook_entry[i] = sparc_cast hlp;
+		memset(hlp, 0, sizeof(struct ebt_entries));
 		hlp->nentries = entries->nentries;
 		hlp->policy = entries->policy;
 		strcpy(hlp->name, entries->name);
 		hlp->counter_offset = entries->counter_offset;
 		hlp->distinguisher = 0; /* Make the kernel see the light */
 		p += sizeof(struct ebt_entries);
-		e = entries->entries->next;
-		while (e != entries->entries) {
-			struct ebt_entry *tmp = (struct ebt_entry *)p;
-
-			tmp->bitmask = e->bitmask | EBT_ENTRY_OR_ENTRIES;
-			tmp->invflags = e->invflags;
-			tmp->ethproto = e->ethproto;
-			strcpy(tmp->in, e->in);
-			strcpy(tmp->out, e->out);
-			strcpy(tmp->logical_in, e->logical_in);
-			strcpy(tmp->logical_out, e->logical_out);
-			memcpy(tmp->sourcemac, e->sourcemac,
-			   sizeof(tmp->sourcemac));
-			memcpy(tmp->sourcemsk, e->sourcemsk,
-			   sizeof(tmp->sourcemsk));
-			memcpy(tmp->destmac, e->destmac, sizeof(tmp->destmac));
-			memcpy(tmp->destmsk, e->destmsk, sizeof(tmp->destmsk));
-
-			base = p;
-			p += sizeof(struct ebt_entry);
-			m_l = e->m_list;
-			while (m_l) {
-				memcpy(p, m_l->m, m_l->m->match_size +
-				   sizeof(struct ebt_entry_match));
-				p += m_l->m->match_size +
-				   sizeof(struct ebt_entry_match);
-				m_l = m_l->next;
-			}
-			tmp->watchers_offset = p - base;
-			w_l = e->w_list;
-			while (w_l) {
-				memcpy(p, w_l->w, w_l->w->watcher_size +
-				   sizeof(struct ebt_entry_watcher));
-				p += w_l->w->watcher_size +
-				   sizeof(struct ebt_entry_watcher);
-				w_l = w_l->next;
-			}
-			tmp->target_offset = p - base;
-			memcpy(p, e->t, e->t->target_size +
-			   sizeof(struct ebt_entry_target));
-			if (!strcmp(e->t->u.name, EBT_STANDARD_TARGET)) {
-				struct ebt_standard_target *st =
-				   (struct ebt_standard_target *)p;
-				/* Translate the jump to a udc */
-				if (st->verdict >= 0)
-					st->verdict = chain_offsets
-					   [st->verdict + NF_BR_NUMHOOKS];
-			}
-			p += e->t->target_size +
-			   sizeof(struct ebt_entry_target);
-			tmp->next_offset = p - base;
-			e = e->next;
+		if (entries->dirty) {
+			p = translate_chain(entries, p, chain_offsets);
+			/* A little sanity check */
+			if (p - start != entries->entries_size)
+				ebt_print_bug("Wrong entries_size: %d != %d, "
+				   "chain = %s", (int)(p - start),
+				   entries->entries_size, entries->name);
+		} else {
+			memcpy(p, u_repl->blob + entries->blob_offset +
+			   sizeof(struct ebt_entries), entries->entries_size -
+			   sizeof(struct ebt_entries));
+			if (moved)
+				update_chain_jumps(entries, p, chain_offsets);
+			p = start + entries->entries_size;
 		}
+		entries->blob_offset = chain_offsets[i];
+		entries->dirty = 0;
 	}
 
 	/* Sanity check */
 	if (p - (char *)new->entries != new->entries_size)
 		ebt_print_bug("Entries_size bug");
 	free(chain_offsets);
-	return new;
+	p = u_repl->blob;
+	u_repl->blob = u_repl->blob_spare;
+	u_repl->blob_spare = p;
+	i = u_repl->blob_size;
+	u_repl->blob_size = u_repl->blob_spare_size;
+	u_repl->blob_spare_size = i;
+}
+
+/* Standard CRC-32 (the one of zlib), start with crc 0 */
+uint32_t ebt_crc32(uint32_t crc, const void *data, size_t len)
+{
+	static uint32_t table[256];
+	const unsigned char *p = (const unsigned char *)data;
+	uint32_t c;
+	int i, j;
+
+	if (!table[1]) {
+		for (i = 0; i < 256; i++) {
+			c = i;
+			for (j = 0; j < 8; j++)
+				c = c & 1 ? 0xedb88320U ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+	}
+	crc = ~crc;
+	while (len--)
+		crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+static uint32_t crc32_zero(size_t len)
+{
+	static const char zero[256];
+	uint32_t crc = 0;
+
+	for (; len > sizeof(zero); len -= sizeof(zero))
+		crc = ebt_crc32(crc, zero, sizeof(zero));
+	return ebt_crc32(crc, zero, len);
 }
 
-static void store_table_in_file(char *filename, struct ebt_replace *repl)
+/* See struct ebt_file_header */
+static void store_table_in_file(char *filename, struct ebt_replace *repl,
+				struct ebt_u_replace *u_repl)
 {
-	char *data;
+	struct ebt_file_header hdr;
+	struct ebt_file_chain *chains;
+	struct ebt_u_entries *entries;
+	struct iovec iov[3];
+	unsigned int i, n = 0;
 	int size;
 	int fd;
 
+	chains = (struct ebt_file_chain *)
+	   calloc(u_repl->num_chains, sizeof(struct ebt_file_chain));
+	if (!chains)
+		ebt_print_memory();
+	for (i = 0; i < u_repl->num_chains; i++) {
+		if (!(entries = u_repl->chains[i]))
+			continue;
+		strcpy(chains[n].name, entries->name);
+		chains[n].hook = i < NF_BR_NUMHOOKS ? i : -1;
+		chains[n].policy = entries->policy;
+		chains[n].offset = entries->blob_offset;
+		chains[n].size = entries->entries_size;
+		chains[n].nentries = entries->nentries;
+		chains[n].counter_offset = entries->counter_offset;
+		n++;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, EBT_FILE_MAGIC, sizeof(hdr.magic));
+	hdr.version = EBT_FILE_VERSION;
+	hdr.header_size = sizeof(hdr);
+	strcpy(hdr.name, repl->name);
+	hdr.valid_hooks = repl->valid_hooks;
+	hdr.nentries = repl->nentries;
+	hdr.num_chains = n;
+	hdr.entries_size = repl->entries_size;
+	hdr.chains_offset = sizeof(hdr);
+	hdr.entries_offset = hdr.chains_offset +
+	   n * sizeof(struct ebt_file_chain);
+	hdr.counters_offset = hdr.entries_offset + repl->entries_size;
+	hdr.crc = ebt_crc32(0, &hdr, sizeof(hdr));
+	hdr.crc = ebt_crc32(hdr.crc, chains, n * sizeof(struct ebt_file_chain));
+	hdr.crc = ebt_crc32(hdr.crc, (char *)repl->entries, repl->entries_size);
+	hdr.counters_crc = crc32_zero(repl->nentries *
+	   sizeof(struct ebt_counter));
+
 	/* Start from an empty file with the correct priviliges */
 	if ((fd = creat(filename, 0600)) == -1) {
 		ebt_print_error("Couldn't create file %s", filename);
-		return;
+		goto free_chains;
 	}
 
-	size = sizeof(struct ebt_replace) + repl->entries_size +
-	   repl->nentries * sizeof(struct ebt_counter);
-	data = (char *)malloc(size);
-	if (!data)
-		ebt_print_memory();
-	memcpy(data, repl, sizeof(struct ebt_replace));
-	memcpy(data + sizeof(struct ebt_replace), (char *)repl->entries,
-	   repl->entries_size);
-	/* Initialize counters to zero, deliver_counters() can update them */
-	memset(data + sizeof(struct ebt_replace) + repl->entries_size,
-	   0, repl->nentries * sizeof(struct ebt_counter));
-	if (write(fd, data, size) != size)
+	size = hdr.counters_offset;
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = chains;
+	iov[1].iov_len = n * sizeof(struct ebt_file_chain);
+	iov[2].iov_base = (char *)repl->entries;
+	iov[2].iov_len = repl->entries_size;
+	/* Initialize counters to zero by extending the file,
+	 * deliver_counters() can update them */
+	if (writev(fd, iov, 3) != size || ftruncate(fd, size +
+	    repl->nentries * sizeof(struct ebt_counter)))
 		ebt_print_error("Couldn't write everything to file %s",
 				filename);
 	close(fd);
-	free(data);
+free_chains:
+	free(chains);
+}
+
+/* Translate the table ahead of ebt_deliver_table(), ebtables-restore does
+ * this on a separate thread. Only *u_repl is touched, the table should not
+ * change anymore until it is delivered and ebt_check_rules() should have
+ * been called */
+void ebt_prepare_table(struct ebt_u_replace *u_repl)
+{
+	if (!u_repl->prepared) {
+		u_repl->prepared = (struct ebt_replace *)
+		   malloc(sizeof(struct ebt_replace));
+		if (!u_repl->prepared)
+			ebt_print_memory();
+	}
+	translate_user2kernel(u_repl, u_repl->prepared);
 }
 
 void ebt_deliver_table(struct ebt_u_replace *u_repl)
 {
 	socklen_t optlen;
-	struct ebt_replace *repl;
+	struct ebt_replace repl;
 
 	/* Translate the struct ebt_u_replace to a struct ebt_replace */
-	repl = translate_user2kernel(u_repl);
+	if (u_repl->prepared) {
+		repl = *u_repl->prepared;
+		free(u_repl->prepared);
+		u_repl->prepared = NULL;
+	} else {
+		/* Checks that were put off until the table is delivered */
+		ebt_check_rules(u_repl);
+		if (ebt_errormsg[0] != '\0')
+			return;
+		translate_user2kernel(u_repl, &repl);
+	}
 	if (u_repl->filename != NULL) {
-		store_table_in_file(u_repl->filename, repl);
-		goto free_repl;
+		store_table_in_file(u_repl->filename, &repl, u_repl);
+		return;
 	}
 	/* Give the data to the kernel */
-	optlen = sizeof(struct ebt_replace) + repl->entries_size;
+	optlen = sizeof(struct ebt_replace) + repl.entries_size;
 	if (get_sockfd())
-		goto free_repl;
-	if (!setsockopt(sockfd, IPPROTO_IP, EBT_SO_SET_ENTRIES, repl, optlen))
-		goto free_repl;
+		return;
+	if (!setsockopt(sockfd, IPPROTO_IP, EBT_SO_SET_ENTRIES, &repl, optlen))
+		return;
 	if (u_repl->command == 8) { /* The ebtables module may not
 	                             * yet be loaded with --atomic-commit */
 		ebtables_insmod("ebtables");
 		if (!setsockopt(sockfd, IPPROTO_IP, EBT_SO_SET_ENTRIES,
-		    repl, optlen))
-			goto free_repl;
+		    &repl, optlen))
+			return;
 	}
 
 	ebt_print_error("Unable to update the kernel. Two possible causes:\n"
@@ -247,139 +408,161 @@ void ebt_deliver_table(struct ebt_u_replace *u_repl)
 			"   used to support concurrent scripts that update the ebtables kernel tables.\n"
 			"2. The kernel doesn't support a certain ebtables extension, consider\n"
 			"   recompiling your kernel or insmod the extension.\n");
-free_repl:
-	if (repl) {
-		free(repl->entries);
-		free(repl);
-	}
 }
 
 static int store_counters_in_file(char *filename, struct ebt_u_replace *repl)
 {
 	int size = repl->nentries * sizeof(struct ebt_counter), ret = 0;
-	unsigned int entries_size;
-	struct ebt_replace hlp;
-	FILE *file;
+	struct ebt_file_header hdr;
+	int fd;
 
-	if (!(file = fopen(filename, "r+b"))) {
+	if ((fd = open(filename, O_RDWR)) == -1) {
 		ebt_print_error("Could not open file %s", filename);
 		return -1;
 	}
-	/* Find out entries_size and then set the file pointer to the
-	 * counters */
-	if (fseek(file, (char *)(&hlp.entries_size) - (char *)(&hlp), SEEK_SET)
-	   || fread(&entries_size, sizeof(char), sizeof(unsigned int), file) !=
-	   sizeof(unsigned int) ||
-	   fseek(file, entries_size + sizeof(struct ebt_replace), SEEK_SET)) {
+	/* The file was just written by store_table_in_file() */
+	if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    memcmp(hdr.magic, EBT_FILE_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.nentries != repl->nentries) {
 		ebt_print_error("File %s is corrupt", filename);
 		ret = -1;
 		goto close_file;
 	}
-	if (fwrite(repl->counters, sizeof(char), size, file) != size) {
+	if (pwrite(fd, repl->counters, size, hdr.counters_offset) != size) {
+		ebt_print_error("Could not write everything to file %s",
+				filename);
+		ret = -1;
+		goto close_file;
+	}
+	hdr.counters_crc = ebt_crc32(0, repl->counters, size);
+	if (pwrite(fd, &hdr.counters_crc, sizeof(hdr.counters_crc),
+	    offsetof(struct ebt_file_header, counters_crc)) !=
+	    sizeof(hdr.counters_crc)) {
 		ebt_print_error("Could not write everything to file %s",
 				filename);
 		ret = -1;
 	}
 close_file:
-	fclose(file);
-	return 0;
+	close(fd);
+	return ret;
+}
+
+/* The rule with number nr (counted over the whole table) */
+static struct ebt_u_entry *global_rule(struct ebt_u_replace *u_repl,
+				       unsigned int nr, int *chainnr)
+{
+	struct ebt_u_entries *entries;
+
+	for (*chainnr = 0; *chainnr < u_repl->num_chains; (*chainnr)++) {
+		if (!(entries = u_repl->chains[*chainnr]))
+			continue;
+		if (nr < entries->counter_offset + entries->nentries)
+			return ebt_rule_nr_to_entry(entries,
+			   nr - entries->counter_offset);
+	}
+	ebt_print_bug("Rule %u doesn't exist", nr);
+	return NULL;
 }
 
 /* Gets executed after ebt_deliver_table. Delivers the counters to the kernel
- * and resets the counterchanges to CNT_NORM */
+ * and resets the counterchanges to CNT_NORM.
+ * Only the counters of the rules that were touched (see ebt_u_replace.cnt_lo)
+ * are rebuilt, the others stay in u_repl->counters or are moved in it */
 void ebt_deliver_counters(struct ebt_u_replace *u_repl)
 {
-	struct ebt_counter *old, *new, *newcounters;
+	struct ebt_counter *old, *new, *saved = NULL;
 	socklen_t optlen;
 	struct ebt_replace repl;
-	struct ebt_cntchanges *cc = u_repl->cc->next, *cc2;
+	struct ebt_cntchanges *cc;
 	struct ebt_u_entries *entries = NULL;
 	struct ebt_u_entry *next = NULL;
-	int i, chainnr = -1;
+	unsigned int lo = u_repl->cnt_lo, hi = u_repl->cnt_hi, i, n_old;
+	int chainnr = 0;
 
-	if (u_repl->nentries == 0)
-		return;
+	if (lo > hi)
+		goto deliver;
+	/* Save the old counters of the changed rules, then move the
+	 * counters behind them to their new place */
+	n_old = hi - lo - u_repl->cnt_shift;
+	if (n_old) {
+		saved = (struct ebt_counter *)
+		   malloc(n_old * sizeof(struct ebt_counter));
+		if (!saved)
+			ebt_print_memory();
+		memcpy(saved, u_repl->counters + lo,
+		   n_old * sizeof(struct ebt_counter));
+	}
+	if (u_repl->cnt_shift > 0) {
+		new = (struct ebt_counter *)realloc(u_repl->counters,
+		   u_repl->nentries * sizeof(struct ebt_counter));
+		if (!new)
+			ebt_print_memory();
+		u_repl->counters = new;
+	}
+	if (u_repl->nentries > hi)
+		memmove(u_repl->counters + hi, u_repl->counters + lo + n_old,
+		   (u_repl->nentries - hi) * sizeof(struct ebt_counter));
 
-	newcounters = (struct ebt_counter *)
-	   malloc(u_repl->nentries * sizeof(struct ebt_counter));
-	if (!newcounters)
-		ebt_print_memory();
-	memset(newcounters, 0, u_repl->nentries * sizeof(struct ebt_counter));
-	old = u_repl->counters;
-	new = newcounters;
-	while (cc != u_repl->cc) {
-		if (!next || next == entries->entries) {
-			chainnr++;
-			while (chainnr < u_repl->num_chains && (!(entries = u_repl->chains[chainnr]) ||
-			       (next = entries->entries->next) == entries->entries))
-				chainnr++;
-			if (chainnr == u_repl->num_chains)
-				break;
-		}
-		if (next == NULL)
-			ebt_print_bug("next == NULL");
-		if (cc->type == CNT_NORM) {
+	if (lo < hi) {
+		next = global_rule(u_repl, lo, &chainnr);
+		entries = u_repl->chains[chainnr];
+	}
+	old = saved;
+	new = u_repl->counters + lo;
+	cc = u_repl->cc;
+	for (i = lo; i < hi; i++) {
+		/* Skip the old counters of deleted rules */
+		for (; cc != u_repl->cc + u_repl->num_cc && cc->pos == i; cc++)
+			old += cc->n;
+		if (next->cnt_type == CNT_NORM) {
 			/* 'Normal' rule, meaning we didn't do anything to it
 			 * So, we just copy */
 			*new = *old;
-			next->cnt = *new;
-			next->cnt_surplus.pcnt = next->cnt_surplus.bcnt = 0;
 			old++; /* We've used an old counter */
-			new++; /* We've set a new counter */
-			next = next->next;
-		} else if (cc->type == CNT_DEL) {
-			old++; /* Don't use this old counter */
-		} else {
-			if (cc->type == CNT_CHANGE) {
-				if (cc->change % 3 == 1)
-					new->pcnt = old->pcnt + next->cnt_surplus.pcnt;
-				else if (cc->change % 3 == 2)
-					new->pcnt = old->pcnt - next->cnt_surplus.pcnt;
-				else
-					new->pcnt = next->cnt.pcnt;
-				if (cc->change / 3 == 1)
-					new->bcnt = old->bcnt + next->cnt_surplus.bcnt;
-				else if (cc->change / 3 == 2)
-					new->bcnt = old->bcnt - next->cnt_surplus.bcnt;
-				else
-					new->bcnt = next->cnt.bcnt;
-			} else
-				*new = next->cnt;
-			next->cnt = *new;
-			next->cnt_surplus.pcnt = next->cnt_surplus.bcnt = 0;
-			if (cc->type == CNT_ADD)
-				new++;
-			else {
-				old++;
-				new++;
-			}
-			next = next->next;
+		} else if (next->cnt_type == CNT_CHANGE) {
+			if (next->cnt_change % 3 == 1)
+				new->pcnt = old->pcnt + next->cnt_surplus.pcnt;
+			else if (next->cnt_change % 3 == 2)
+				new->pcnt = old->pcnt - next->cnt_surplus.pcnt;
+			else
+				new->pcnt = next->cnt.pcnt;
+			if (next->cnt_change / 3 == 1)
+				new->bcnt = old->bcnt + next->cnt_surplus.bcnt;
+			else if (next->cnt_change / 3 == 2)
+				new->bcnt = old->bcnt - next->cnt_surplus.bcnt;
+			else
+				new->bcnt = next->cnt.bcnt;
+			old++;
+		} else
+			*new = next->cnt;
+		next->cnt = *new;
+		next->cnt_surplus.pcnt = next->cnt_surplus.bcnt = 0;
+		next->cnt_type = CNT_NORM;
+		next->cnt_change = 0;
+		new++; /* We've set a new counter */
+		next = next->next;
+		if (next == entries->entries && i + 1 < hi) {
+			do
+				entries = u_repl->chains[++chainnr];
+			while (!entries || !entries->nentries);
+			next = entries->entries->next;
 		}
-		cc = cc->next;
 	}
+	/* Deleted rules behind the last changed rule */
+	for (; cc != u_repl->cc + u_repl->num_cc; cc++)
+		old += cc->n;
+	if (old != saved + n_old)
+		ebt_print_bug("Wrong nr. of old counters");
+	u_repl->num_cc = 0;
+	free(saved);
+	u_repl->cnt_lo = UINT_MAX;
+	u_repl->cnt_hi = 0;
+	u_repl->cnt_shift = 0;
 
-	free(u_repl->counters);
-	u_repl->counters = newcounters;
+deliver:
 	u_repl->num_counters = u_repl->nentries;
-	/* Reset the counterchanges to CNT_NORM and delete the unused cc */
-	i = 0;
-	cc = u_repl->cc->next;
-	while (cc != u_repl->cc) {
-		if (cc->type == CNT_DEL) {
-			cc->prev->next = cc->next;
-			cc->next->prev = cc->prev;
-			cc2 = cc->next;
-			free(cc);
-			cc = cc2;
-		} else {
-			cc->type = CNT_NORM;
-			cc->change = 0;
-			i++;
-			cc = cc->next;
-		}
-	}
-	if (i != u_repl->nentries)
-		ebt_print_bug("i != u_repl->nentries");
+	if (u_repl->nentries == 0)
+		return;
 	if (u_repl->filename != NULL) {
 		store_counters_in_file(u_repl->filename, u_repl);
 		return;
@@ -398,24 +581,21 @@ void ebt_deliver_counters(struct ebt_u_replace *u_repl)
 }
 
 static int
-ebt_translate_match(struct ebt_entry_match *m, struct ebt_u_match_list ***l)
+ebt_translate_match(struct ebt_entry_match *m, struct ebt_u_match_list ***l,
+   struct ebt_u_replace *u_repl)
 {
 	struct ebt_u_match_list *new;
 	int ret = 0;
 
 	new = (struct ebt_u_match_list *)
-	   malloc(sizeof(struct ebt_u_match_list));
-	if (!new)
-		ebt_print_memory();
-	new->m = (struct ebt_entry_match *)
-	   malloc(m->match_size + sizeof(struct ebt_entry_match));
-	if (!new->m)
-		ebt_print_memory();
+	   ebt_arena_alloc(u_repl, sizeof(struct ebt_u_match_list));
+	new->m = (struct ebt_entry_match *)ebt_arena_alloc(u_repl,
+	   m->match_size + sizeof(struct ebt_entry_match));
 	memcpy(new->m, m, m->match_size + sizeof(struct ebt_entry_match));
 	new->next = NULL;
 	**l = new;
 	*l = &new->next;
-	if (ebt_find_match(new->m->u.name) == NULL) {
+	if ((new->match = ebt_find_match(new->m->u.name)) == NULL) {
 		ebt_print_error("Kernel match %s unsupported by userspace tool",
 				new->m->u.name);
 		ret = -1;
@@ -425,24 +605,20 @@ ebt_translate_match(struct ebt_entry_match *m, struct ebt_u_match_list ***l)
 
 static int
 ebt_translate_watcher(struct ebt_entry_watcher *w,
-   struct ebt_u_watcher_list ***l)
+   struct ebt_u_watcher_list ***l, struct ebt_u_replace *u_repl)
 {
 	struct ebt_u_watcher_list *new;
 	int ret = 0;
 
 	new = (struct ebt_u_watcher_list *)
-	   malloc(sizeof(struct ebt_u_watcher_list));
-	if (!new)
-		ebt_print_memory();
-	new->w = (struct ebt_entry_watcher *)
-	   malloc(w->watcher_size + sizeof(struct ebt_entry_watcher));
-	if (!new->w)
-		ebt_print_memory();
+	   ebt_arena_alloc(u_repl, sizeof(struct ebt_u_watcher_list));
+	new->w = (struct ebt_entry_watcher *)ebt_arena_alloc(u_repl,
+	   w->watcher_size + sizeof(struct ebt_entry_watcher));
 	memcpy(new->w, w, w->watcher_size + sizeof(struct ebt_entry_watcher));
 	new->next = NULL;
 	**l = new;
 	*l = &new->next;
-	if (ebt_find_watcher(new->w->u.name) == NULL) {
+	if ((new->watcher = ebt_find_watcher(new->w->u.name)) == NULL) {
 		ebt_print_error("Kernel watcher %s unsupported by userspace "
 				"tool", new->w->u.name);
 		ret = -1;
@@ -450,10 +626,29 @@ ebt_translate_watcher(struct ebt_entry_watcher *w,
 	return ret;
 }
 
+/* Returns the number of the udc that starts at kernel_start, the udc's lie in
+ * the kernel table in the order of their number */
+static int find_udc(struct ebt_u_replace *u_repl, char *kernel_start)
+{
+	int low = NF_BR_NUMHOOKS, high = u_repl->num_chains - 1, mid;
+
+	while (low <= high) {
+		mid = (low + high) / 2;
+		if (u_repl->chains[mid]->kernel_start == kernel_start)
+			return mid;
+		if (u_repl->chains[mid]->kernel_start < kernel_start)
+			low = mid + 1;
+		else
+			high = mid - 1;
+	}
+	ebt_print_bug("Can't find udc for jump");
+	return -1;
+}
+
 static int
 ebt_translate_entry(struct ebt_entry *e, int *hook, int *n, int *cnt,
    int *totalcnt, struct ebt_u_entry **u_e, struct ebt_u_replace *u_repl,
-   unsigned int valid_hooks, char *base, struct ebt_cntchanges **cc)
+   unsigned int valid_hooks, char *base)
 {
 	/* An entry */
 	if (e->bitmask & EBT_ENTRY_OR_ENTRIES) {
@@ -462,9 +657,8 @@ ebt_translate_entry(struct ebt_entry *e, int *hook, int *n, int *cnt,
 		struct ebt_u_watcher_list **w_l;
 		struct ebt_entry_target *t;
 
-		new = (struct ebt_u_entry *)malloc(sizeof(struct ebt_u_entry));
-		if (!new)
-			ebt_print_memory();
+		new = (struct ebt_u_entry *)
+		   ebt_arena_alloc(u_repl, sizeof(struct ebt_u_entry));
 		new->bitmask = e->bitmask;
 		/*
 		 * Plain userspace code doesn't know about
@@ -485,8 +679,8 @@ ebt_translate_entry(struct ebt_entry *e, int *hook, int *n, int *cnt,
 			ebt_print_bug("*totalcnt >= u_repl->nentries");
 		new->cnt = u_repl->counters[*totalcnt];
 		new->cnt_surplus.pcnt = new->cnt_surplus.bcnt = 0;
-		new->cc = *cc;
-		*cc = (*cc)->next;
+		new->cnt_type = CNT_NORM;
+		new->cnt_change = 0;
 		new->m_list = NULL;
 		new->w_list = NULL;
 		new->next = (*u_e)->next;
@@ -494,17 +688,17 @@ ebt_translate_entry(struct ebt_entry *e, int *hook, int *n, int *cnt,
 		(*u_e)->next = new;
 		new->prev = *u_e;
 		*u_e = new;
+		ebt_index_insert(u_repl->chains[*hook], new, *cnt);
+		u_repl->chains[*hook]->entries_size += e->next_offset;
 		m_l = &new->m_list;
-		EBT_MATCH_ITERATE(e, ebt_translate_match, &m_l);
+		EBT_MATCH_ITERATE(e, ebt_translate_match, &m_l, u_repl);
 		w_l = &new->w_list;
-		EBT_WATCHER_ITERATE(e, ebt_translate_watcher, &w_l);
+		EBT_WATCHER_ITERATE(e, ebt_translate_watcher, &w_l, u_repl);
 
 		t = (struct ebt_entry_target *)(((char *)e) + e->target_offset);
-		new->t = (struct ebt_entry_target *)
-		   malloc(t->target_size + sizeof(struct ebt_entry_target));
-		if (!new->t)
-			ebt_print_memory();
-		if (ebt_find_target(t->u.name) == NULL) {
+		new->t = (struct ebt_entry_target *)ebt_arena_alloc(u_repl,
+		   t->target_size + sizeof(struct ebt_entry_target));
+		if ((new->target = ebt_find_target(t->u.name)) == NULL) {
 			ebt_print_error("Kernel target %s unsupported by "
 					"userspace tool", t->u.name);
 			return -1;
@@ -513,20 +707,13 @@ ebt_translate_entry(struct ebt_entry *e, int *hook, int *n, int *cnt,
 		   sizeof(struct ebt_entry_target));
 		/* Deal with jumps to udc */
 		if (!strcmp(t->u.name, EBT_STANDARD_TARGET)) {
-			char *tmp = base;
 			int verdict = ((struct ebt_standard_target *)t)->verdict;
-			int i;
-
-			if (verdict >= 0) {
-				tmp += verdict;
-				for (i = NF_BR_NUMHOOKS; i < u_repl->num_chains; i++)
-					if (u_repl->chains[i]->kernel_start == tmp)
-						break;
-				if (i == u_repl->num_chains)
-					ebt_print_bug("Can't find udc for jump");
-				((struct ebt_standard_target *)new->t)->verdict = i-NF_BR_NUMHOOKS;
-			}
+
+			if (verdict >= 0)
+				((struct ebt_standard_target *)new->t)->verdict =
+				   find_udc(u_repl, base + verdict) - NF_BR_NUMHOOKS;
 		}
+		ebt_link_reference(u_repl, u_repl->chains[*hook], new);
 
 		(*cnt)++;
 		(*totalcnt)++;
@@ -561,101 +748,159 @@ ebt_translate_chains(struct ebt_entry *e, int *hook,
 		for (i = *hook + 1; i < NF_BR_NUMHOOKS; i++)
 			if (valid_hooks & (1 << i))
 				break;
-		new = (struct ebt_u_entries *)malloc(sizeof(struct ebt_u_entries));
-		if (!new)
-			ebt_print_memory();
+		new = (struct ebt_u_entries *)
+		   ebt_arena_alloc(u_repl, sizeof(struct ebt_u_entries));
 		if (i == u_repl->max_chains)
 			ebt_double_chains(u_repl);
 		u_repl->chains[i] = new;
-		if (i >= NF_BR_NUMHOOKS)
-			new->kernel_start = (char *)e;
+		new->kernel_start = (char *)e;
 		*hook = i;
 		new->nentries = entries->nentries;
 		new->policy = entries->policy;
-		new->entries = (struct ebt_u_entry *)malloc(sizeof(struct ebt_u_entry));
-		if (!new->entries)
-			ebt_print_memory();
+		new->entries = (struct ebt_u_entry *)
+		   ebt_arena_alloc(u_repl, sizeof(struct ebt_u_entry));
 		new->entries->next = new->entries->prev = new->entries;
+		new->index = NULL;
+		new->hash = NULL;
+		new->hash_size = 0;
+		new->entries_size = sizeof(struct ebt_entries);
+		new->dirty = 1;
+		new->refs = NULL;
+		new->jumps = NULL;
 		new->counter_offset = entries->counter_offset;
 		strcpy(new->name, entries->name);
 	}
 	return 0;
 }
 
+/* Check a file in the format of struct ebt_file_header and fill in repl,
+ * a truncated or damaged file is refused here instead of being committed */
+static int parse_file(char *filename, struct ebt_replace *repl, char *map,
+		      size_t size)
+{
+	struct ebt_file_header hdr;
+	uint32_t crc;
+
+	memcpy(&hdr, map, sizeof(hdr));
+	if (hdr.version != EBT_FILE_VERSION ||
+	    hdr.header_size != sizeof(hdr)) {
+		ebt_print_error("File %s has an unsupported version", filename);
+		return -1;
+	}
+	if (hdr.chains_offset != sizeof(hdr) || hdr.entries_offset !=
+	    hdr.chains_offset + (uint64_t)hdr.num_chains *
+	    sizeof(struct ebt_file_chain) || hdr.counters_offset !=
+	    hdr.entries_offset + hdr.entries_size ||
+	    hdr.counters_offset + (uint64_t)hdr.nentries *
+	    sizeof(struct ebt_counter) != size) {
+		ebt_print_error("File %s has wrong size", filename);
+		return -1;
+	}
+	crc = hdr.crc;
+	hdr.crc = hdr.counters_crc = 0;
+	hdr.crc = ebt_crc32(0, &hdr, sizeof(hdr));
+	hdr.crc = ebt_crc32(hdr.crc, map + hdr.chains_offset,
+	   hdr.counters_offset - hdr.chains_offset);
+	if (hdr.crc != crc || ((struct ebt_file_header *)map)->counters_crc !=
+	    ebt_crc32(0, map + hdr.counters_offset, size - hdr.counters_offset)) {
+		ebt_print_error("File %s is corrupt", filename);
+		return -1;
+	}
+	strcpy(repl->name, hdr.name);
+	repl->valid_hooks = hdr.valid_hooks;
+	repl->nentries = hdr.nentries;
+	repl->num_counters = hdr.nentries;
+	repl->entries_size = hdr.entries_size;
+	repl->entries = sparc_cast (map + hdr.entries_offset);
+	repl->counters = sparc_cast (struct ebt_counter *)
+	   (map + hdr.counters_offset);
+	return 0;
+}
+
+/* A file written by an older version: a struct ebt_replace, the entries and
+ * the counters */
+static int parse_old_file(char *filename, struct ebt_replace *repl, char *map,
+			  size_t size)
+{
+	if (size < sizeof(struct ebt_replace)) {
+		ebt_print_error("File %s is corrupt", filename);
+		return -1;
+	}
+	memcpy(repl, map, sizeof(struct ebt_replace));
+	if (sizeof(struct ebt_replace) + repl->nentries *
+	    sizeof(struct ebt_counter) + repl->entries_size != size) {
+		ebt_print_error("File %s has wrong size", filename);
+		return -1;
+	}
+	repl->entries = sparc_cast (map + sizeof(struct ebt_replace));
+	repl->counters = sparc_cast (struct ebt_counter *)
+	   (map + sizeof(struct ebt_replace) +
+	   repl->entries_size);
+	return 0;
+}
+
+/* The file is mmap'ed: the entries are not copied, repl->entries points into
+ * the mapping, which has to be given back with munmap() */
 static int retrieve_from_file(char *filename, struct ebt_replace *repl,
-   char command)
+   char command, char **map, size_t *map_size)
 {
-	FILE *file;
-	char *hlp = NULL, *entries;
+	struct stat st;
 	struct ebt_counter *counters;
-	int size, ret = 0;
+	char name[EBT_TABLE_MAXNAMELEN];
+	int fd, ret = -1;
 
-	if (!(file = fopen(filename, "r+b"))) {
+	if ((fd = open(filename, O_RDONLY)) == -1) {
 		ebt_print_error("Could not open file %s", filename);
 		return -1;
 	}
-	/* Make sure table name is right if command isn't -L or --atomic-commit */
-	if (command != 'L' && command != 8) {
-		hlp = (char *)malloc(strlen(repl->name) + 1);
-		if (!hlp)
-			ebt_print_memory();
-		strcpy(hlp, repl->name);
-	}
-	if (fread(repl, sizeof(char), sizeof(struct ebt_replace), file)
-	   != sizeof(struct ebt_replace)) {
+	if (fstat(fd, &st) || st.st_size < sizeof(struct ebt_file_header)) {
 		ebt_print_error("File %s is corrupt", filename);
-		ret = -1;
 		goto close_file;
 	}
-	if (command != 'L' && command != 8 && strcmp(hlp, repl->name)) {
+	/* Private, so the kernel can write the old counters in it */
+	*map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		    fd, 0);
+	if (*map == MAP_FAILED) {
+		ebt_print_error("Could not map file %s", filename);
+		goto close_file;
+	}
+	*map_size = st.st_size;
+	strcpy(name, repl->name);
+	if (!memcmp(*map, EBT_FILE_MAGIC, sizeof(EBT_FILE_MAGIC) - 1)) {
+		if (parse_file(filename, repl, *map, *map_size))
+			goto unmap_file;
+	} else if (parse_old_file(filename, repl, *map, *map_size))
+		goto unmap_file;
+	/* Make sure table name is right if command isn't -L or --atomic-commit */
+	if (command != 'L' && command != 8 && strcmp(name, repl->name)) {
 		ebt_print_error("File %s contains wrong table name or is "
 				"corrupt", filename);
-		ret = -1;
-		goto close_file;
-	} else if (!ebt_find_table(repl->name)) {
+		goto unmap_file;
+	}
+	if (!ebt_find_table(repl->name)) {
 		ebt_print_error("File %s contains invalid table name",
 				filename);
-		ret = -1;
-		goto close_file;
+		goto unmap_file;
 	}
 
-	size = sizeof(struct ebt_replace) +
-	   repl->nentries * sizeof(struct ebt_counter) + repl->entries_size;
-	fseek(file, 0, SEEK_END);
-	if (size != ftell(file)) {
-		ebt_print_error("File %s has wrong size", filename);
-		ret = -1;
-		goto close_file;
-	}
-	entries = (char *)malloc(repl->entries_size);
-	if (!entries)
-		ebt_print_memory();
-	repl->entries = sparc_cast entries;
+	/* The counters are replaced by ebt_deliver_counters() and the file
+	 * can be overwritten while it is mapped, so copy them */
 	if (repl->nentries) {
 		counters = (struct ebt_counter *)
 		   malloc(repl->nentries * sizeof(struct ebt_counter));
-		repl->counters = sparc_cast counters;
-		if (!repl->counters)
+		if (!counters)
 			ebt_print_memory();
+		memcpy(counters, (char *)repl->counters,
+		   repl->nentries * sizeof(struct ebt_counter));
+		repl->counters = sparc_cast counters;
 	} else
 		repl->counters = sparc_cast NULL;
-	/* Copy entries and counters */
-	if (fseek(file, sizeof(struct ebt_replace), SEEK_SET) ||
-	   fread((char *)repl->entries, sizeof(char), repl->entries_size, file)
-	   != repl->entries_size ||
-	   fseek(file, sizeof(struct ebt_replace) + repl->entries_size,
-		 SEEK_SET)
-	   || (repl->counters && fread((char *)repl->counters, sizeof(char),
-	   repl->nentries * sizeof(struct ebt_counter), file)
-	   != repl->nentries * sizeof(struct ebt_counter))) {
-		ebt_print_error("File %s is corrupt", filename);
-		free(entries);
-		repl->entries = NULL;
-		ret = -1;
-	}
+	ret = 0;
+	goto close_file;
+unmap_file:
+	munmap(*map, *map_size);
 close_file:
-	fclose(file);
-	free(hlp);
+	close(fd);
 	return ret;
 }
 
@@ -705,18 +950,41 @@ static int retrieve_from_kernel(struct ebt_replace *repl, char command,
 	return 0;
 }
 
-int ebt_get_table(struct ebt_u_replace *u_repl, int init)
+/* Translate the rules of the kernel table, the chains were already done by
+ * ebt_translate_chains() */
+static void translate_entries(struct ebt_u_replace *u_repl, char *entries,
+			      unsigned int entries_size)
 {
 	int i, j, k, hook;
-	struct ebt_replace repl;
 	struct ebt_u_entry *u_e = NULL;
-	struct ebt_cntchanges *new_cc = NULL, *cc;
 
+	i = 0; /* Holds the expected nr. of entries for the chain */
+	j = 0; /* Holds the up to now counted entries for the chain */
+	k = 0; /* Holds the total nr. of entries, should equal u_repl->nentries afterwards */
+	hook = -1;
+	EBT_ENTRY_ITERATE(entries, entries_size,
+	   ebt_translate_entry, &hook, &i, &j, &k, &u_e, u_repl,
+	   u_repl->valid_hooks, entries);
+	if (k != u_repl->nentries)
+		ebt_print_bug("Wrong total nentries");
+}
+
+/* init: see ebt_get_kernel_table() */
+int ebt_get_table(struct ebt_u_replace *u_repl, int init)
+{
+	int hook, view = init == 2;
+	struct ebt_replace repl;
+	char *map = NULL;
+	size_t map_size = 0;
+
+	if (view)
+		init = 0;
 	strcpy(repl.name, u_repl->name);
 	if (u_repl->filename != NULL) {
 		if (init)
 			ebt_print_bug("Getting initial table data from a file is impossible");
-		if (retrieve_from_file(u_repl->filename, &repl, u_repl->command))
+		if (retrieve_from_file(u_repl->filename, &repl, u_repl->command,
+		    &map, &map_size))
 			return -1;
 		/* -L with a wrong table name should be dealt with silently */
 		strcpy(u_repl->name, repl.name);
@@ -728,25 +996,10 @@ int ebt_get_table(struct ebt_u_replace *u_repl, int init)
 	u_repl->nentries = repl.nentries;
 	u_repl->num_counters = repl.num_counters;
 	u_repl->counters = repl.counters;
-	u_repl->cc = (struct ebt_cntchanges *)malloc(sizeof(struct ebt_cntchanges));
-	if (!u_repl->cc)
-		ebt_print_memory();
-	u_repl->cc->next = u_repl->cc->prev = u_repl->cc;
-	cc = u_repl->cc;
-	for (i = 0; i < repl.nentries; i++) {
-		new_cc = (struct ebt_cntchanges *)malloc(sizeof(struct ebt_cntchanges));
-		if (!new_cc)
-			ebt_print_memory();
-		new_cc->type = CNT_NORM;
-		new_cc->change = 0;
-		new_cc->prev = cc;
-		cc->next = new_cc;
-		cc = new_cc;
-	}
-	if (repl.nentries) {
-		new_cc->next = u_repl->cc;
-		u_repl->cc->prev = new_cc;
-	}
+	u_repl->num_cc = 0;
+	u_repl->cnt_lo = UINT_MAX;
+	u_repl->cnt_hi = 0;
+	u_repl->cnt_shift = 0;
 	u_repl->chains = (struct ebt_u_entries **)calloc(EBT_ORI_MAX_CHAINS, sizeof(void *));
 	u_repl->max_chains = EBT_ORI_MAX_CHAINS;
 	hook = -1;
@@ -757,16 +1010,162 @@ int ebt_get_table(struct ebt_u_replace *u_repl, int init)
 		u_repl->num_chains = hook + 1;
 	else
 		u_repl->num_chains = NF_BR_NUMHOOKS;
-	i = 0; /* Holds the expected nr. of entries for the chain */
-	j = 0; /* Holds the up to now counted entries for the chain */
-	k = 0; /* Holds the total nr. of entries, should equal u_repl->nentries afterwards */
-	cc = u_repl->cc->next;
-	hook = -1;
-	EBT_ENTRY_ITERATE((char *)repl.entries, repl.entries_size,
-	   ebt_translate_entry, &hook, &i, &j, &k, &u_e, u_repl,
-	   u_repl->valid_hooks, (char *)repl.entries, &cc);
-	if (k != u_repl->nentries)
-		ebt_print_bug("Wrong total nentries");
-	free(repl.entries);
+	ebt_free_view(u_repl);
+	if (view) {
+		/* The rules stay in the kernel format */
+		u_repl->view = (char *)repl.entries;
+		u_repl->map = map;
+		u_repl->map_size = map_size;
+		return 0;
+	}
+	translate_entries(u_repl, (char *)repl.entries, repl.entries_size);
+	if (map)
+		munmap(map, map_size);
+	else
+		free(repl.entries);
+	/* The rules were accepted by the kernel for the chains they're in */
+	ebt_check_for_loops(u_repl);
+	for (hook = 0; hook < u_repl->num_chains; hook++)
+		if (u_repl->chains[hook])
+			u_repl->chains[hook]->checked_hook_mask =
+			   u_repl->chains[hook]->hook_mask;
 	return 0;
 }
+
+/* Free the rules kept in kernel format by ebt_get_table() */
+void ebt_free_view(struct ebt_u_replace *u_repl)
+{
+	if (u_repl->map)
+		munmap(u_repl->map, u_repl->map_size);
+	else
+		free(u_repl->view);
+	u_repl->view = u_repl->map = NULL;
+	u_repl->map_size = 0;
+}
+
+static void view_grow(void **list, int *max, int size)
+{
+	void *new;
+
+	*max = *max ? 2 * *max : 8;
+	new = realloc(*list, *max * size);
+	if (!new)
+		ebt_print_memory();
+	*list = new;
+}
+
+/* Start going over the rules of a chain of a table that was retrieved with
+ * ebt_get_kernel_table(replace, 2) */
+void ebt_view_chain(struct ebt_u_replace *u_repl,
+		    struct ebt_u_entries *entries, struct ebt_u_view *view)
+{
+	view->replace = u_repl;
+	view->entries = entries;
+	view->pos = entries->kernel_start + sizeof(struct ebt_entries);
+	view->rule_nr = 0;
+}
+
+/* Returns the next rule of the chain or NULL, nothing is copied: the matches
+ * and watchers point into the kernel data. The rule is only valid until the
+ * next call. Also returns NULL if an extension is unknown to userspace. */
+struct ebt_u_entry *ebt_view_next_rule(struct ebt_u_view *view)
+{
+	struct ebt_entry *e = (struct ebt_entry *)view->pos;
+	struct ebt_u_entry *new = &view->entry;
+	struct ebt_entry_match *m;
+	struct ebt_entry_watcher *w;
+	struct ebt_entry_target *t;
+	struct ebt_u_replace *u_repl = view->replace;
+	int i, n;
+
+	if (view->rule_nr == view->entries->nentries)
+		return NULL;
+	new->bitmask = e->bitmask & ~EBT_ENTRY_OR_ENTRIES;
+	new->invflags = e->invflags;
+	new->ethproto = e->ethproto;
+	strcpy(new->in, e->in);
+	strcpy(new->out, e->out);
+	strcpy(new->logical_in, e->logical_in);
+	strcpy(new->logical_out, e->logical_out);
+	memcpy(new->sourcemac, e->sourcemac, sizeof(new->sourcemac));
+	memcpy(new->sourcemsk, e->sourcemsk, sizeof(new->sourcemsk));
+	memcpy(new->destmac, e->destmac, sizeof(new->destmac));
+	memcpy(new->destmsk, e->destmsk, sizeof(new->destmsk));
+	if (u_repl->counters)
+		new->cnt = u_repl->counters[view->entries->counter_offset +
+		   view->rule_nr];
+	else
+		new->cnt.pcnt = new->cnt.bcnt = 0;
+	new->replace = u_repl;
+
+	/* The list nodes are reused for every rule */
+	n = 0;
+	for (i = sizeof(struct ebt_entry); i < e->watchers_offset;
+	     i += m->match_size + sizeof(struct ebt_entry_match)) {
+		m = (struct ebt_entry_match *)((char *)e + i);
+		if (n == view->max_matches)
+			view_grow((void **)&view->matches, &view->max_matches,
+				  sizeof(struct ebt_u_match_list));
+		view->matches[n].m = m;
+		if (!(view->matches[n].match = ebt_find_match(m->u.name))) {
+			ebt_print_error("Kernel match %s unsupported by "
+					"userspace tool", m->u.name);
+			return NULL;
+		}
+		n++;
+	}
+	/* Only link the nodes now, view_grow() can move them */
+	for (i = 0; i < n; i++)
+		view->matches[i].next = i + 1 < n ?
+		   &view->matches[i + 1] : NULL;
+	new->m_list = n ? view->matches : NULL;
+	n = 0;
+	for (i = e->watchers_offset; i < e->target_offset;
+	     i += w->watcher_size + sizeof(struct ebt_entry_watcher)) {
+		w = (struct ebt_entry_watcher *)((char *)e + i);
+		if (n == view->max_watchers)
+			view_grow((void **)&view->watchers, &view->max_watchers,
+				  sizeof(struct ebt_u_watcher_list));
+		view->watchers[n].w = w;
+		if (!(view->watchers[n].watcher = ebt_find_watcher(w->u.name))) {
+			ebt_print_error("Kernel watcher %s unsupported by "
+					"userspace tool", w->u.name);
+			return NULL;
+		}
+		n++;
+	}
+	for (i = 0; i < n; i++)
+		view->watchers[i].next = i + 1 < n ?
+		   &view->watchers[i + 1] : NULL;
+	new->w_list = n ? view->watchers : NULL;
+
+	t = (struct ebt_entry_target *)((char *)e + e->target_offset);
+	new->t = t;
+	if ((new->target = ebt_find_target(t->u.name)) == NULL) {
+		ebt_print_error("Kernel target %s unsupported by "
+				"userspace tool", t->u.name);
+		return NULL;
+	}
+	/* Deal with jumps to udc */
+	if (!strcmp(t->u.name, EBT_STANDARD_TARGET) &&
+	    ((struct ebt_standard_target *)t)->verdict >= 0) {
+		memcpy(&view->jump, t, sizeof(view->jump));
+		view->jump.verdict = find_udc(u_repl,
+		   u_repl->view + view->jump.verdict) - NF_BR_NUMHOOKS;
+		new->t = (struct ebt_entry_target *)&view->jump;
+	}
+
+	view->pos += e->next_offset;
+	view->rule_nr++;
+	return new;
+}
+
+/* Free the memory of the view, not of the table */
+void ebt_view_free(struct ebt_u_view *view)
+{
+	free(view->matches);
+	free(view->watchers);
+	view->matches = NULL;
+	view->watchers = NULL;
+	view->max_matches = view->max_watchers = 0;
+}
@@ -22,11 +22,26 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "include/ebtables_u.h"
 
 static struct ebt_u_replace replace[3];
 void ebt_early_init_once();
 
+/* When the section of a table ends, the table is translated to the kernel
+ * format on its own thread while the next section is parsed. The tables
+ * are given to the kernel at the end, in the order they first appeared */
+static pthread_t worker[3];
+static int working[3];
+static int order[3], num_tables;
+/* --diff: print what would change instead of changing it */
+static int diff_only;
+/* --noflush: the commands change the tables as they are in the kernel */
+static int noflush;
+/* --keep-counters: the rules that are already in the kernel keep their
+ * counters, see patch_table() */
+static int keep_counters;
+
 #define OPT_KERNELDATA  0x800 /* Also defined in ebtables.c */
 
 static void copy_table_names()
@@ -38,37 +53,260 @@ static void copy_table_names()
 
 #define ebtrest_print_error(format, args...) do {fprintf(stderr, "ebtables-restore: "\
                                              "line %d: "format".\n", line, ##args); exit(-1);} while (0)
+
+static void *prepare_table(void *arg)
+{
+	ebt_prepare_table((struct ebt_u_replace *)arg);
+	return NULL;
+}
+
+static void start_worker(int table_nr)
+{
+	/* The final checks of the rules were left for the end of the
+	 * section, they can't run next to do_command() */
+	ebt_check_rules(&replace[table_nr]);
+	/* These compare against the kernel's table at the end */
+	if (diff_only || keep_counters)
+		return;
+	/* Without a thread the table is translated on delivery */
+	if (pthread_create(&worker[table_nr], NULL, prepare_table,
+	    &replace[table_nr]))
+		return;
+	working[table_nr] = 1;
+}
+
+static void wait_for_worker(int table_nr)
+{
+	if (!working[table_nr])
+		return;
+	pthread_join(worker[table_nr], NULL);
+	working[table_nr] = 0;
+}
+
+/* The input is read in big blocks, the lines are split and tokenized in
+ * place. A line can be as long as it wants to be. */
+#define RESTORE_BLOCK_SIZE (128 * 1024)
+static char *buf;
+static size_t buf_size, buf_start, buf_end;
+static int buf_eof;
+
+/* Returns the next line without its '\n', NULL at the end of the input */
+static char *next_line()
+{
+	char *line, *nl;
+	size_t scanned = 0;
+	ssize_t n;
+
+	while (1) {
+		line = buf + buf_start;
+		if (buf_end - buf_start > scanned &&
+		    (nl = memchr(line + scanned, '\n', buf_end - buf_start - scanned))) {
+			*nl = '\0';
+			buf_start = nl + 1 - buf;
+			return line;
+		}
+		scanned = buf_end - buf_start;
+		if (buf_eof) {
+			if (!scanned)
+				return NULL;
+			/* The last line has no '\n' */
+			buf[buf_end] = '\0';
+			buf_start = buf_end;
+			return line;
+		}
+		/* Keep the start of the current line and read more */
+		if (buf_start) {
+			memmove(buf, line, scanned);
+			buf_end = scanned;
+			buf_start = 0;
+		}
+		if (buf_size - buf_end < RESTORE_BLOCK_SIZE + 1) {
+			buf_size = buf_size ? 2 * buf_size : 2 * RESTORE_BLOCK_SIZE;
+			if (!(buf = realloc(buf, buf_size)))
+				ebt_print_memory();
+		}
+		do
+			n = read(STDIN_FILENO, buf + buf_end, buf_size - buf_end - 1);
+		while (n == -1 && errno == EINTR);
+		if (n == -1)
+			ebt_print_error("ebtables-restore: can't read the input: %s", strerror(errno));
+		if (n == 0)
+			buf_eof = 1;
+		else
+			buf_end += n;
+	}
+}
+
+/* Spaces separate the arguments, unless they are between "" */
+static int split_line(char *cmdline, char **argv, int line)
+{
+	int argc = 1;
+	char *p = cmdline;
+
+	while (1) {
+		p += strspn(p, " ");
+		if (*p == '\0')
+			return argc;
+		if (argc == EBTD_ARGC_MAX)
+			ebtrest_print_error("too many arguments");
+		if (*p != '\"') {
+			argv[argc++] = p;
+			p += strcspn(p, " \"");
+			if (*p == ' ')
+				*p++ = '\0';
+			if (*p != '\"')
+				continue;
+			/* A '"' right after an argument starts the next one */
+			*p = '\0';
+			if (argc == EBTD_ARGC_MAX)
+				ebtrest_print_error("too many arguments");
+		}
+		argv[argc++] = ++p;
+		if (!(p = strchr(p, '\"')))
+			ebtrest_print_error("wrong use of '\"'");
+		*p++ = '\0';
+		if (*p != ' ' && *p != '\0')
+			ebtrest_print_error("syntax error at \"");
+	}
+}
+
+/* Get the table as it is in the kernel and compare it with the restored
+ * table */
+static void diff_with_kernel(struct ebt_u_replace *current,
+			     struct ebt_u_replace *to, struct ebt_u_diff *diff)
+{
+	memset(current, 0, sizeof(*current));
+	strcpy(current->name, to->name);
+	ebt_get_kernel_table(current, 0);
+	ebt_diff_tables(current, to, diff);
+}
+
+/* Print the commands that turn the table in the kernel into the restored
+ * table, in the format of the input */
+static void print_diff(struct ebt_u_replace *to)
+{
+	struct ebt_u_replace current;
+	struct ebt_u_diff diff;
+	struct ebt_u_diff_op *op;
+	unsigned int i;
+
+	diff_with_kernel(&current, to, &diff);
+	ebt_out_printf("*%s\n", to->name);
+	for (i = 0; i < diff.num_ops; i++) {
+		op = diff.ops + i;
+		switch (op->type) {
+		case EBT_DIFF_NEW_CHAIN:
+			ebt_out_printf("-N %s -P %s\n", op->chain,
+			   ebt_standard_targets[-op->policy - 1]);
+			break;
+		case EBT_DIFF_POLICY:
+			ebt_out_printf("-P %s %s\n", op->chain,
+			   ebt_standard_targets[-op->policy - 1]);
+			break;
+		case EBT_DIFF_DELETE:
+			ebt_out_printf("-D %s %d", op->chain, op->rule_nr);
+			if (op->n > 1)
+				ebt_out_printf(":%d", op->rule_nr + op->n - 1);
+			ebt_out_char('\n');
+			break;
+		case EBT_DIFF_INSERT:
+			if (op->rule_nr)
+				ebt_out_printf("-I %s %d ", op->chain,
+				   op->rule_nr);
+			else
+				ebt_out_printf("-A %s ", op->chain);
+			ebt_print_rule(to, op->e);
+			ebt_out_unput(' ');
+			ebt_out_char('\n');
+			break;
+		case EBT_DIFF_DEL_CHAIN:
+			ebt_out_printf("-X %s\n", op->chain);
+			break;
+		}
+	}
+	ebt_free_diff(&diff);
+	ebt_cleanup_replace(&current);
+}
+
+/* Instead of replacing the table in the kernel by the restored one, only
+ * the differences are applied to the kernel's table. The rules that didn't
+ * change keep their counters, the new ones get the counters given with -c,
+ * if any. */
+static void patch_table(struct ebt_u_replace *to)
+{
+	struct ebt_u_replace current;
+	struct ebt_u_diff diff;
+
+	diff_with_kernel(&current, to, &diff);
+	ebt_patch_table(&current, &diff);
+	ebt_deliver_table(&current);
+	ebt_deliver_counters(&current);
+	ebt_free_diff(&diff);
+	ebt_cleanup_replace(&current);
+}
+
 int main(int argc_, char *argv_[])
 {
-	char *argv[EBTD_ARGC_MAX], cmdline[EBTD_CMDLINE_MAXLN];
-	int i, offset, quotemode = 0, argc, table_nr = -1, line = 0, whitespace;
+	char *argv[EBTD_ARGC_MAX], *cmdline;
+	int i, argc, table_nr = -1, line = 0;
 	char ebtables_str[] = "ebtables";
 
-	if (argc_ != 1)
-		ebtrest_print_error("options are not supported");
+	for (i = 1; i < argc_; i++) {
+		if (!strcmp(argv_[i], "--diff"))
+			diff_only = 1;
+		else if (!strcmp(argv_[i], "--noflush"))
+			noflush = 1;
+		else if (!strcmp(argv_[i], "--keep-counters"))
+			keep_counters = 1;
+		else {
+			fprintf(stderr, "ebtables-restore: unknown option '%s', "
+			   "usage: ebtables-restore [--noflush] "
+			   "[--keep-counters] [--diff]\n", argv_[i]);
+			exit(-1);
+		}
+	}
+	/* The counters of the kernel's rules are kept anyway */
+	if (noflush)
+		keep_counters = 0;
 	ebt_silent = 0;
 	copy_table_names();
 	ebt_early_init_once();
 	argv[0] = ebtables_str;
 
-	while (fgets(cmdline, EBTD_CMDLINE_MAXLN, stdin)) {
+	while ((cmdline = next_line())) {
 		line++;
-		if (*cmdline == '#' || *cmdline == '\n')
+		if (*cmdline == '#' || *cmdline == '\0')
 			continue;
-		*strchr(cmdline, '\n') = '\0';
 		if (*cmdline == '*') {
-			if (table_nr != -1) {
-				ebt_deliver_table(&replace[table_nr]);
-				ebt_deliver_counters(&replace[table_nr]);
-			}
+			if (table_nr != -1)
+				start_worker(table_nr);
 			for (i = 0; i < 3; i++)
 				if (!strcmp(replace[i].name, cmdline+1))
 					break;
 			if (i == 3)
 				ebtrest_print_error("table '%s' was not recognized", cmdline+1);
 			table_nr = i;
+			/* A table can only be restored once, a second section
+			 * starts over, unless with --noflush */
+			wait_for_worker(table_nr);
+			free(replace[table_nr].prepared);
+			replace[table_nr].prepared = NULL;
+			for (i = 0; i < num_tables; i++)
+				if (order[i] == table_nr)
+					break;
+			if (i == num_tables)
+				order[num_tables++] = table_nr;
+			else if (noflush)
+				continue;
+			else {
+				/* Drop what the first section built */
+				ebt_cleanup_replace(&replace[table_nr]);
+				free(replace[table_nr].chains);
+				replace[table_nr].chains = NULL;
+				strcpy(replace[table_nr].name, cmdline+1);
+			}
 			replace[table_nr].command = 11;
-			ebt_get_kernel_table(&replace[table_nr], 1);
+			ebt_get_kernel_table(&replace[table_nr], !noflush);
 			replace[table_nr].command = 0;
 			replace[table_nr].flags = OPT_KERNELDATA; /* Prevent do_command from initialising replace */
 			continue;
@@ -99,37 +337,30 @@ int main(int argc_, char *argv_[])
 				replace[table_nr].chains[chain_nr]->policy = policy;
 			continue;
 		}
-		argv[1] = cmdline;
-		offset = whitespace = 0;
-		argc = 2;
-		while (cmdline[offset] != '\0') {
-			if (cmdline[offset] == '\"') {
-				whitespace = 0;
-				quotemode ^= 1;
-				if (quotemode)
-					argv[argc++] = &cmdline[offset+1];
-				else if (cmdline[offset+1] != ' ' && cmdline[offset+1] != '\0')
-					ebtrest_print_error("syntax error at \"");
-				cmdline[offset] = '\0';
-			} else if (!quotemode && cmdline[offset] == ' ') {
-				whitespace = 1;
-				cmdline[offset] = '\0';
-			} else if (whitespace == 1) {
-				argv[argc++] = &cmdline[offset];
-				whitespace = 0;
-			}
-			offset++;
-		}
-		if (quotemode)
-			ebtrest_print_error("wrong use of '\"'");
+		if ((argc = split_line(cmdline, argv, line)) == 1)
+			continue;
 		optind = 0; /* Setting optind = 1 causes serious annoyances */
 		do_command(argc, argv, EXEC_STYLE_DAEMON, &replace[table_nr]);
 		ebt_reinit_extensions();
 	}
 
-	if (table_nr != -1) {
-		ebt_deliver_table(&replace[table_nr]);
-		ebt_deliver_counters(&replace[table_nr]);
+	if (table_nr != -1)
+		start_worker(table_nr);
+	if (diff_only) {
+		for (i = 0; i < num_tables; i++)
+			print_diff(&replace[order[i]]);
+		ebt_out_flush();
+		return 0;
+	}
+	for (i = 0; i < num_tables; i++)
+		wait_for_worker(order[i]);
+	for (i = 0; i < num_tables; i++) {
+		if (keep_counters) {
+			patch_table(&replace[order[i]]);
+			continue;
+		}
+		ebt_deliver_table(&replace[order[i]]);
+		ebt_deliver_counters(&replace[order[i]]);
 	}
 	return 0;
 }
@@ -0,0 +1,148 @@
+/*
+ * ebtables-save.c
+ *
+ * Writes the tables in the format read by ebtables-restore, replaces the
+ * perl script that parsed the output of 'ebtables -L'.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "include/ebtables_u.h"
+
+#define SAVE_VERSION "1.0"
+
+static void print_help()
+{
+	printf(
+"Usage: ebtables-save [-c] [-t table]...\n"
+"Writes the rules of the tables in the format of ebtables-restore.\n"
+"  -c       : also save the rule counters (or EBTABLES_SAVE_COUNTER=yes)\n"
+"  -t table : save this table, can be repeated; default: the tables of the\n"
+"             loaded ebtable_* modules\n");
+	exit(0);
+}
+
+static void save_table(const char *name, int counters)
+{
+	struct ebt_u_replace replace;
+	struct ebt_u_entries *entries;
+	struct ebt_u_entry *e;
+	struct ebt_u_view view;
+	int i, j;
+
+	memset(&replace, 0, sizeof(replace));
+	strncpy(replace.name, name, sizeof(replace.name) - 1);
+	replace.command = 'L';
+	/* The rules are printed straight from the kernel data */
+	if (ebt_get_kernel_table(&replace, 2))
+		exit(-1);
+
+	ebt_out_printf("*%s\n", replace.name);
+	for (i = 0; i < replace.num_chains; i++)
+		if ((entries = replace.chains[i]))
+			ebt_out_printf(":%s %s\n", entries->name,
+			   ebt_standard_targets[-entries->policy - 1]);
+	for (i = 0; i < replace.num_chains; i++) {
+		if (!(entries = replace.chains[i]))
+			continue;
+		memset(&view, 0, sizeof(view));
+		ebt_view_chain(&replace, entries, &view);
+		for (j = 0; j < entries->nentries; j++) {
+			if (!(e = ebt_view_next_rule(&view)))
+				exit(-1);
+			ebt_out_str("-A ");
+			ebt_out_str(entries->name);
+			ebt_out_char(' ');
+			ebt_print_rule(&replace, e);
+			/* Like the old script, no space at the end of the line */
+			ebt_out_unput(' ');
+			if (counters) {
+				ebt_out_str(" -c ");
+				ebt_out_unsigned(e->cnt.pcnt);
+				ebt_out_char(' ');
+				ebt_out_unsigned(e->cnt.bcnt);
+			}
+			ebt_out_char('\n');
+		}
+		ebt_view_free(&view);
+	}
+	ebt_out_char('\n');
+	ebt_cleanup_replace(&replace);
+}
+
+/* The tables of the loaded ebtable_* modules, like the old script did */
+static void save_loaded_tables(int counters)
+{
+	char line[256], *end;
+	FILE *modules;
+
+	if (!(modules = fopen("/proc/modules", "r")))
+		return;
+	while (fgets(line, sizeof(line), modules)) {
+		if (strncmp(line, "ebtable_", 8))
+			continue;
+		if ((end = strchr(line, ' ')))
+			*end = '\0';
+		save_table(line + 8, counters);
+	}
+	fclose(modules);
+}
+
+int main(int argc, char *argv[])
+{
+	char date[64], *env;
+	int i, counters = 0, tables = 0;
+	time_t now;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-c"))
+			counters = 1;
+		else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+			tables++;
+			i++;
+		}
+		else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help"))
+			print_help();
+		else {
+			fprintf(stderr, "ebtables-save: bad argument '%s', "
+			        "see ebtables-save -h\n", argv[i]);
+			return -1;
+		}
+	}
+	if ((env = getenv("EBTABLES_SAVE_COUNTER")) && !strcmp(env, "yes"))
+		counters = 1;
+
+	ebt_silent = 0;
+	now = time(NULL);
+	strftime(date, sizeof(date), "%a %b %e %H:%M:%S %Z %Y",
+	   localtime(&now));
+	ebt_out_printf("# Generated by ebtables-save v"SAVE_VERSION" on %s\n",
+	   date);
+
+	if (!tables)
+		save_loaded_tables(counters);
+	for (i = 1; i < argc; i++)
+		if (!strcmp(argv[i], "-t"))
+			save_table(argv[++i], counters);
+	ebt_out_flush();
+	if (ferror(stdout)) {
+		perror("ebtables-save");
+		return -1;
+	}
+	return 0;
+}
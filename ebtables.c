@@ -75,6 +75,7 @@ static struct option ebt_original_options[] =
 	{ "jump"           , required_argument, 0, 'j' },
 	{ "set-counters"   , required_argument, 0, 'c' },
 	{ "change-counters", required_argument, 0, 'C' },
+	{ "change-match"   , required_argument, 0, 14  },
 	{ "proto"          , required_argument, 0, 'p' },
 	{ "protocol"       , required_argument, 0, 'p' },
 	{ "db"             , required_argument, 0, 'b' },
@@ -146,22 +147,204 @@ static struct option *merge_options(struct option *oldopts,
 	return merge;
 }
 
+/* The extension that owns the option values in
+ * [(i + 1) * OPTION_OFFSET, (i + 2) * OPTION_OFFSET), so do_command()
+ * can hand an option straight to the right parse function */
+struct option_owner {
+	struct ebt_u_match *m;
+	struct ebt_u_watcher *w;
+	struct ebt_u_target *t;
+};
+static struct option_owner *option_owners;
+static int num_option_owners;
+
+static void set_option_owner(struct ebt_u_match *m, struct ebt_u_watcher *w,
+                             struct ebt_u_target *t)
+{
+	num_option_owners = global_option_offset / OPTION_OFFSET;
+	option_owners = realloc(option_owners,
+	   num_option_owners * sizeof(struct option_owner));
+	if (!option_owners)
+		ebt_print_memory();
+	option_owners[num_option_owners - 1].m = m;
+	option_owners[num_option_owners - 1].w = w;
+	option_owners[num_option_owners - 1].t = t;
+}
+
 static void merge_match(struct ebt_u_match *m)
 {
 	ebt_options = merge_options
 	   (ebt_options, m->extra_ops, &(m->option_offset));
+	set_option_owner(m, NULL, NULL);
 }
 
 static void merge_watcher(struct ebt_u_watcher *w)
 {
 	ebt_options = merge_options
 	   (ebt_options, w->extra_ops, &(w->option_offset));
+	set_option_owner(NULL, w, NULL);
 }
 
 static void merge_target(struct ebt_u_target *t)
 {
 	ebt_options = merge_options
 	   (ebt_options, t->extra_ops, &(t->option_offset));
+	set_option_owner(NULL, NULL, t);
+}
+
+/* getopt_long() compares a long option with every option name of every
+ * extension. We look the names up in a table without collisions instead,
+ * built once when all extensions are merged: the seed and the table size
+ * are tried until every name gets its own slot. */
+static const struct option **option_hash;
+static unsigned int option_hash_mask, option_hash_seed;
+
+static unsigned int hash_option_name(const char *name, size_t len,
+                                     unsigned int seed)
+{
+	unsigned int h = 2166136261U ^ seed;
+
+	while (len--) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619;
+	}
+	return h ^ (h >> 15);
+}
+
+static void build_option_hash()
+{
+	const struct option *o, **slot;
+	unsigned int n, size, seed;
+
+	for (n = 0; ebt_options[n].name; n++);
+	for (size = 16; size < 2 * n; size <<= 1);
+	for (;; size <<= 1) {
+		free(option_hash);
+		if (!(option_hash = malloc(size * sizeof(*option_hash))))
+			ebt_print_memory();
+		for (seed = 0; seed < 64; seed++) {
+			memset(option_hash, 0, size * sizeof(*option_hash));
+			for (o = ebt_options; o->name; o++) {
+				slot = &option_hash[hash_option_name(o->name,
+				   strlen(o->name), seed) & (size - 1)];
+				/* getopt_long() takes the first of two options
+				 * with the same name */
+				if (*slot && strcmp((*slot)->name, o->name))
+					break;
+				if (!*slot)
+					*slot = o;
+			}
+			if (!o->name) {
+				option_hash_mask = size - 1;
+				option_hash_seed = seed;
+				return;
+			}
+		}
+	}
+}
+
+static const struct option *find_long_option(const char *name, size_t len)
+{
+	const struct option *o, *found = NULL;
+
+	o = option_hash[hash_option_name(name, len, option_hash_seed) &
+	   option_hash_mask];
+	if (o && !strncmp(o->name, name, len) && o->name[len] == '\0')
+		return o;
+	/* Abbreviations are allowed as long as they are not ambiguous */
+	for (o = ebt_options; o->name; o++) {
+		if (strncmp(o->name, name, len))
+			continue;
+		if (!found)
+			found = o;
+		else if (found->has_arg != o->has_arg ||
+		         found->flag != o->flag || found->val != o->val)
+			return NULL;
+	}
+	return found;
+}
+
+/* Returns the next option like getopt_long() does for an option string
+ * starting with '-', i.e. without permuting argv. It uses the same global
+ * variables, the extensions depend on optind and optarg */
+static char *nextchar;
+static int get_option(int argc, char *argv[], const char *optstring)
+{
+	const struct option *o;
+	const char *opt;
+	char *name, *end;
+	int c;
+
+	optarg = NULL;
+	if (optind == 0) {
+		optind = 1;
+		nextchar = NULL;
+	}
+	if (nextchar && *nextchar)
+		goto short_option;
+	nextchar = NULL;
+	if (optind >= argc)
+		return -1;
+	if (!strcmp(argv[optind], "--")) {
+		optind++;
+		return -1;
+	}
+	if (argv[optind][0] != '-' || argv[optind][1] == '\0') {
+		optarg = argv[optind++];
+		return 1;
+	}
+	if (argv[optind][1] != '-') {
+		nextchar = argv[optind] + 1;
+		goto short_option;
+	}
+
+	name = argv[optind++] + 2;
+	for (end = name; *end && *end != '='; end++);
+	if (!(o = find_long_option(name, end - name))) {
+		optopt = 0;
+		return '?';
+	}
+	if (*end) {
+		if (o->has_arg == no_argument) {
+			optopt = o->val;
+			return '?';
+		}
+		optarg = end + 1;
+	} else if (o->has_arg == required_argument) {
+		if (optind >= argc) {
+			optopt = o->val;
+			return '?';
+		}
+		optarg = argv[optind++];
+	}
+	if (o->flag) {
+		*(o->flag) = o->val;
+		return 0;
+	}
+	return o->val;
+
+short_option:
+	c = *nextchar++;
+	if (*nextchar == '\0')
+		optind++;
+	if (c == ':' || !(opt = strchr(optstring + 1, c))) {
+		optopt = c;
+		return '?';
+	}
+	if (opt[1] != ':')
+		return c;
+	if (*nextchar != '\0') {
+		optarg = nextchar;
+		optind++;
+	} else if (opt[2] != ':') {
+		if (optind >= argc) {
+			optopt = c;
+			c = '?';
+		} else
+			optarg = argv[optind++];
+	}
+	nextchar = NULL;
+	return c;
 }
 
 /* Be backwards compatible, so don't use '+' in kernel */
@@ -172,7 +355,8 @@ static void print_iface(const char *iface)
 
 	if ((c = strchr(iface, IF_WILDCARD)))
 		*c = '+';
-	printf("%s ", iface);
+	ebt_out_str(iface);
+	ebt_out_char(' ');
 	if (c)
 		*c = IF_WILDCARD;
 }
@@ -184,27 +368,123 @@ static void print_iface(const char *iface)
 #define LIST_X    0x10
 #define LIST_MAC2 0x20
 
+/* Print the rule in the syntax of the command line, every option is
+ * followed by a space. Used for listing and by ebtables-save */
+void ebt_print_rule(struct ebt_u_replace *repl, struct ebt_u_entry *e)
+{
+	struct ebt_u_match_list *m_l;
+	struct ebt_u_watcher_list *w_l;
+
+	/* The standard target's print() uses this to find out
+	 * the name of a udc */
+	e->replace = repl;
+
+	/* Don't print anything about the protocol if no protocol was
+	 * specified, obviously this means any protocol will do. */
+	if (!(e->bitmask & EBT_NOPROTO)) {
+		ebt_out_str("-p ");
+		if (e->invflags & EBT_IPROTO)
+			ebt_out_str("! ");
+		if (e->bitmask & EBT_802_3)
+			ebt_out_str("Length ");
+		else {
+			struct ethertypeent *ent;
+
+			ent = getethertypebynumber(ntohs(e->ethproto));
+			if (!ent)
+				ebt_out_hex(ntohs(e->ethproto), 0);
+			else
+				ebt_out_str(ent->e_name);
+			ebt_out_char(' ');
+		}
+	}
+	if (e->bitmask & EBT_SOURCEMAC) {
+		ebt_out_str("-s ");
+		if (e->invflags & EBT_ISOURCE)
+			ebt_out_str("! ");
+		ebt_print_mac_and_mask(e->sourcemac, e->sourcemsk);
+		ebt_out_char(' ');
+	}
+	if (e->bitmask & EBT_DESTMAC) {
+		ebt_out_str("-d ");
+		if (e->invflags & EBT_IDEST)
+			ebt_out_str("! ");
+		ebt_print_mac_and_mask(e->destmac, e->destmsk);
+		ebt_out_char(' ');
+	}
+	if (e->in[0] != '\0') {
+		ebt_out_str("-i ");
+		if (e->invflags & EBT_IIN)
+			ebt_out_str("! ");
+		print_iface(e->in);
+	}
+	if (e->logical_in[0] != '\0') {
+		ebt_out_str("--logical-in ");
+		if (e->invflags & EBT_ILOGICALIN)
+			ebt_out_str("! ");
+		print_iface(e->logical_in);
+	}
+	if (e->logical_out[0] != '\0') {
+		ebt_out_str("--logical-out ");
+		if (e->invflags & EBT_ILOGICALOUT)
+			ebt_out_str("! ");
+		print_iface(e->logical_out);
+	}
+	if (e->out[0] != '\0') {
+		ebt_out_str("-o ");
+		if (e->invflags & EBT_IOUT)
+			ebt_out_str("! ");
+		print_iface(e->out);
+	}
+
+	m_l = e->m_list;
+	while (m_l) {
+		if (!m_l->match)
+			ebt_print_bug("Match not found");
+		m_l->match->print(e, m_l->m);
+		m_l = m_l->next;
+	}
+	w_l = e->w_list;
+	while (w_l) {
+		if (!w_l->watcher)
+			ebt_print_bug("Watcher not found");
+		w_l->watcher->print(e, w_l->w);
+		w_l = w_l->next;
+	}
+
+	ebt_out_str("-j ");
+	if (strcmp(e->t->u.name, EBT_STANDARD_TARGET)) {
+		ebt_out_str(e->t->u.name);
+		ebt_out_char(' ');
+	}
+	if (!e->target)
+		ebt_print_bug("Target '%s' not found", e->t->u.name);
+	e->target->print(e, e->t);
+}
+
 /* Helper function for list_rules() */
 static void list_em(struct ebt_u_entries *entries)
 {
 	int i, j, space = 0, digits;
 	struct ebt_u_entry *hlp;
-	struct ebt_u_match_list *m_l;
-	struct ebt_u_watcher_list *w_l;
-	struct ebt_u_match *m;
-	struct ebt_u_watcher *w;
-	struct ebt_u_target *t;
+	struct ebt_u_view view;
 
 	if (replace->flags & LIST_MAC2)
 		ebt_printstyle_mac = 2;
 	else
 		ebt_printstyle_mac = 0;
-	hlp = entries->entries->next;
+	/* Without a view, the rules were translated by ebt_get_table() */
+	if (replace->view) {
+		memset(&view, 0, sizeof(view));
+		ebt_view_chain(replace, entries, &view);
+		hlp = ebt_view_next_rule(&view);
+	} else
+		hlp = entries->entries->next;
 	if (replace->flags & LIST_X && entries->policy != EBT_ACCEPT) {
-		printf("ebtables -t %s -P %s %s\n", replace->name,
+		ebt_out_printf("ebtables -t %s -P %s %s\n", replace->name,
 		   entries->name, ebt_standard_targets[-entries->policy - 1]);
 	} else if (!(replace->flags & LIST_X)) {
-		printf("\nBridge chain: %s, entries: %d, policy: %s\n",
+		ebt_out_printf("\nBridge chain: %s, entries: %d, policy: %s\n",
 		   entries->name, entries->nentries,
 		   ebt_standard_targets[-entries->policy - 1]);
 	}
@@ -218,6 +498,9 @@ static void list_em(struct ebt_u_entries *entries)
 	}
 
 	for (i = 0; i < entries->nentries; i++) {
+		/* The view stops at a kernel extension we don't know */
+		if (!hlp)
+			break;
 		if (replace->flags & LIST_N) {
 			digits = 0;
 			/* A little work to get nice rule numbers. */
@@ -227,110 +510,35 @@ static void list_em(struct ebt_u_entries *entries)
 				j /= 10;
 			}
 			for (j = 0; j < space - digits; j++)
-				printf(" ");
-			printf("%d. ", i + 1);
+				ebt_out_char(' ');
+			ebt_out_unsigned(i + 1);
+			ebt_out_str(". ");
 		}
 		if (replace->flags & LIST_X)
-			printf("ebtables -t %s -A %s ",
+			ebt_out_printf("ebtables -t %s -A %s ",
 			   replace->name, entries->name);
 
-		/* The standard target's print() uses this to find out
-		 * the name of a udc */
-		hlp->replace = replace;
-
-		/* Don't print anything about the protocol if no protocol was
-		 * specified, obviously this means any protocol will do. */
-		if (!(hlp->bitmask & EBT_NOPROTO)) {
-			printf("-p ");
-			if (hlp->invflags & EBT_IPROTO)
-				printf("! ");
-			if (hlp->bitmask & EBT_802_3)
-				printf("Length ");
-			else {
-				struct ethertypeent *ent;
-
-				ent = getethertypebynumber(ntohs(hlp->ethproto));
-				if (!ent)
-					printf("0x%x ", ntohs(hlp->ethproto));
-				else
-					printf("%s ", ent->e_name);
-			}
-		}
-		if (hlp->bitmask & EBT_SOURCEMAC) {
-			printf("-s ");
-			if (hlp->invflags & EBT_ISOURCE)
-				printf("! ");
-			ebt_print_mac_and_mask(hlp->sourcemac, hlp->sourcemsk);
-			printf(" ");
-		}
-		if (hlp->bitmask & EBT_DESTMAC) {
-			printf("-d ");
-			if (hlp->invflags & EBT_IDEST)
-				printf("! ");
-			ebt_print_mac_and_mask(hlp->destmac, hlp->destmsk);
-			printf(" ");
-		}
-		if (hlp->in[0] != '\0') {
-			printf("-i ");
-			if (hlp->invflags & EBT_IIN)
-				printf("! ");
-			print_iface(hlp->in);
-		}
-		if (hlp->logical_in[0] != '\0') {
-			printf("--logical-in ");
-			if (hlp->invflags & EBT_ILOGICALIN)
-				printf("! ");
-			print_iface(hlp->logical_in);
-		}
-		if (hlp->logical_out[0] != '\0') {
-			printf("--logical-out ");
-			if (hlp->invflags & EBT_ILOGICALOUT)
-				printf("! ");
-			print_iface(hlp->logical_out);
-		}
-		if (hlp->out[0] != '\0') {
-			printf("-o ");
-			if (hlp->invflags & EBT_IOUT)
-				printf("! ");
-			print_iface(hlp->out);
-		}
-
-		m_l = hlp->m_list;
-		while (m_l) {
-			m = ebt_find_match(m_l->m->u.name);
-			if (!m)
-				ebt_print_bug("Match not found");
-			m->print(hlp, m_l->m);
-			m_l = m_l->next;
-		}
-		w_l = hlp->w_list;
-		while (w_l) {
-			w = ebt_find_watcher(w_l->w->u.name);
-			if (!w)
-				ebt_print_bug("Watcher not found");
-			w->print(hlp, w_l->w);
-			w_l = w_l->next;
-		}
-
-		printf("-j ");
-		if (strcmp(hlp->t->u.name, EBT_STANDARD_TARGET))
-			printf("%s ", hlp->t->u.name);
-		t = ebt_find_target(hlp->t->u.name);
-		if (!t)
-			ebt_print_bug("Target '%s' not found", hlp->t->u.name);
-		t->print(hlp, hlp->t);
+		ebt_print_rule(replace, hlp);
 		if (replace->flags & LIST_C) {
-			uint64_t pcnt = hlp->cnt.pcnt;
-			uint64_t bcnt = hlp->cnt.bcnt;
-
 			if (replace->flags & LIST_X)
-				printf("-c %"PRIu64" %"PRIu64, pcnt, bcnt);
+				ebt_out_str("-c ");
+			else
+				ebt_out_str(", pcnt = ");
+			ebt_out_unsigned(hlp->cnt.pcnt);
+			if (replace->flags & LIST_X)
+				ebt_out_char(' ');
 			else
-				printf(", pcnt = %"PRIu64" -- bcnt = %"PRIu64, pcnt, bcnt);
+				ebt_out_str(" -- bcnt = ");
+			ebt_out_unsigned(hlp->cnt.bcnt);
 		}
-		printf("\n");
-		hlp = hlp->next;
+		ebt_out_char('\n');
+		if (replace->view)
+			hlp = ebt_view_next_rule(&view);
+		else
+			hlp = hlp->next;
 	}
+	if (replace->view)
+		ebt_view_free(&view);
 }
 
 static void print_help()
@@ -352,6 +560,7 @@ static void print_help()
 "--delete -D chain rulenum     : delete rule at position rulenum from chain\n"
 "--change-counters -C chain\n"
 "          [rulenum] pcnt bcnt : change counters of existing rule\n"
+"--change-match chain rulenum  : change the matches of existing rule\n"
 "--insert -I chain rulenum     : insert rule at position rulenum in chain\n"
 "--list   -L [chain]           : list the rules in a chain or in all chains\n"
 "--flush  -F [chain]           : delete all rules in chain or in all chains\n"
@@ -405,22 +614,23 @@ static void list_rules()
 	int i;
 
 	if (!(replace->flags & LIST_X))
-		printf("Bridge table: %s\n", table->name);
+		ebt_out_printf("Bridge table: %s\n", table->name);
 	if (replace->selected_chain != -1)
 		list_em(ebt_to_chain(replace));
 	else {
 		/* Create new chains and rename standard chains when necessary */
 		if (replace->flags & LIST_X && replace->num_chains > NF_BR_NUMHOOKS) {
 			for (i = NF_BR_NUMHOOKS; i < replace->num_chains; i++)
-				printf("ebtables -t %s -N %s\n", replace->name, replace->chains[i]->name);
+				ebt_out_printf("ebtables -t %s -N %s\n", replace->name, replace->chains[i]->name);
 			for (i = 0; i < NF_BR_NUMHOOKS; i++)
 				if (replace->chains[i] && strcmp(replace->chains[i]->name, ebt_hooknames[i]))
-					printf("ebtables -t %s -E %s %s\n", replace->name, ebt_hooknames[i], replace->chains[i]->name);
+					ebt_out_printf("ebtables -t %s -E %s %s\n", replace->name, ebt_hooknames[i], replace->chains[i]->name);
 		}
 		for (i = 0; i < replace->num_chains; i++)
 			if (replace->chains[i])
 				list_em(replace->chains[i]);
 	}
+	ebt_out_flush();
 }
 
 static int parse_rule_range(const char *argv, int *rule_nr, int *rule_nr_end)
@@ -526,6 +736,7 @@ void ebt_early_init_once()
 	ebt_iterate_matches(merge_match);
 	ebt_iterate_watchers(merge_watcher);
 	ebt_iterate_targets(merge_target);
+	build_option_hash();
 }
 
 /* signal handler, installed when the option --concurrent is specified. */
@@ -551,9 +762,10 @@ int do_command(int argc, char *argv[], int exec_style,
 	struct ebt_u_match_list *m_l;
 	struct ebt_u_watcher_list *w_l;
 	struct ebt_u_entries *entries;
+	struct option_owner *owner;
 
-	opterr = 0;
 	ebt_modprobe = NULL;
+	nextchar = NULL;
 
 	replace = replace_;
 
@@ -586,14 +798,14 @@ int do_command(int argc, char *argv[], int exec_style,
 	 * '-t'  ,'-M' and --atomic (if specified) have to come
 	 * before '-A' and the like */
 
-	/* Getopt saves the day */
-	while ((c = getopt_long(argc, argv,
-	   "-A:D:C:I:N:E:X::L::Z::F::P:Vhi:o:j:c:p:s:d:t:M:", ebt_options, NULL)) != -1) {
+	while ((c = get_option(argc, argv,
+	   "-A:D:C:I:N:E:X::L::Z::F::P:Vhi:o:j:c:p:s:d:t:M:")) != -1) {
 		switch (c) {
 
 		case 'A': /* Add a rule */
 		case 'D': /* Delete a rule */
 		case 'C': /* Change counters */
+		case 14 : /* Change matches */
 		case 'P': /* Define policy */
 		case 'I': /* Insert a rule */
 		case 'N': /* Make a user defined chain */
@@ -674,6 +886,13 @@ int do_command(int argc, char *argv[], int exec_style,
 			} else if (c == 'C') {
 				if ((chcounter = parse_change_counters_rule(argc, argv, &rule_nr, &rule_nr_end, exec_style)) == -1)
 					return -1;
+			} else if (c == 14) {
+				if (optind >= argc || (argv[optind][0] == '-' && (argv[optind][1] < '0' || argv[optind][1] > '9')))
+					ebt_print_error2("No rule number specified");
+				rule_nr = strtol(argv[optind], &buffer, 10);
+				if (*buffer != '\0' || rule_nr == 0)
+					ebt_print_error2("Problem with the specified rule number '%s'", argv[optind]);
+				optind++;
 			} else if (c == 'I') {
 				if (optind >= argc || (argv[optind][0] == '-' && (argv[optind][1] < '0' || argv[optind][1] > '9')))
 					rule_nr = 1;
@@ -721,8 +940,12 @@ print_zero:
 				ebt_print_error2("-L not supported in daemon mode");
 #endif
 
+			/* Listing only needs a view of the table, unless
+			 * the counters are zeroed afterwards */
 			if (!(replace->flags & OPT_KERNELDATA))
-				ebt_get_kernel_table(replace, 0);
+				ebt_get_kernel_table(replace, c == 'L' &&
+				   exec_style == EXEC_STYLE_PRG &&
+				   !(replace->flags & OPT_ZERO) ? 2 : 0);
 			i = -1;
 			if (optind < argc && argv[optind][0] != '-') {
 				if ((i = ebt_get_chainnr(replace, argv[optind])) == -1)
@@ -1060,52 +1283,47 @@ big_iface_length:
 			optind--;
 			continue;
 		default:
-			/* Is it a target option? */
+			owner = NULL;
+			if (c >= OPTION_OFFSET && c / OPTION_OFFSET <= num_option_owners)
+				owner = &option_owners[c / OPTION_OFFSET - 1];
 			t = (struct ebt_u_target *)new_entry->t;
-			if ((t->parse(c - t->option_offset, argv, argc, new_entry, &t->flags, &t->t))) {
-				if (ebt_errormsg[0] != '\0')
-					return -1;
-				goto check_extension;
-			}
-
-			/* Is it a match_option? */
-			for (m = ebt_matches; m; m = m->next)
-				if (m->parse(c - m->option_offset, argv, argc, new_entry, &m->flags, &m->m))
-					break;
 
-			if (m != NULL) {
-				if (ebt_errormsg[0] != '\0')
-					return -1;
+			/* The extension is marked used before parsing, so
+			 * ebt_reinit_extensions() knows its data changed */
+			if (owner && owner->t && owner->t == t) {
+				if (!t->parse(c - t->option_offset, argv, argc, new_entry, &t->flags, &t->t))
+					goto unknown_option;
+			} else if (owner && owner->m) {
+				m = owner->m;
 				if (m->used == 0) {
 					ebt_add_match(new_entry, m);
 					m->used = 1;
 				}
-				goto check_extension;
-			}
-
-			/* Is it a watcher option? */
-			for (w = ebt_watchers; w; w = w->next)
-				if (w->parse(c - w->option_offset, argv, argc, new_entry, &w->flags, &w->w))
-					break;
-
-			if (w == NULL && c == '?')
-				ebt_print_error2("Unknown argument: '%s'", argv[optind - 1], (char)optopt, (char)c);
-			else if (w == NULL) {
-				if (!strcmp(t->name, "standard"))
+				if (!m->parse(c - m->option_offset, argv, argc, new_entry, &m->flags, &m->m))
+					goto unknown_option;
+			} else if (owner && owner->w) {
+				w = owner->w;
+				if (w->used == 0) {
+					ebt_add_watcher(new_entry, w);
+					w->used = 1;
+				}
+				if (!w->parse(c - w->option_offset, argv, argc, new_entry, &w->flags, &w->w))
+					goto unknown_option;
+			} else {
+unknown_option:
+				if (c == '?')
+					ebt_print_error2("Unknown argument: '%s'", argv[optind - 1], (char)optopt, (char)c);
+				else if (!strcmp(t->name, "standard"))
 					ebt_print_error2("Unknown argument: don't forget the -t option");
 				else
 					ebt_print_error2("Target-specific option does not correspond with specified target");
 			}
 			if (ebt_errormsg[0] != '\0')
 				return -1;
-			if (w->used == 0) {
-				ebt_add_watcher(new_entry, w);
-				w->used = 1;
-			}
-check_extension:
 			if (replace->command != 'A' && replace->command != 'I' &&
-			    replace->command != 'D' && replace->command != 'C')
-				ebt_print_error2("Extensions only for -A, -I, -D and -C");
+			    replace->command != 'D' && replace->command != 'C' &&
+			    replace->command != 14)
+				ebt_print_error2("Extensions only for -A, -I, -D, -C and --change-match");
 		}
 		ebt_invert = 0;
 	}
@@ -1126,10 +1344,14 @@ check_extension:
 	/* Do the final checks */
 	if (replace->command == 'A' || replace->command == 'I' ||
 	   replace->command == 'D' || replace->command == 'C') {
-		/* This will put the hook_mask right for the chains */
-		ebt_check_for_loops(replace);
-		if (ebt_errormsg[0] != '\0')
-			return -1;
+		/* This will put the hook_mask right for the chains, in
+		 * daemon mode the loops are checked on delivery (the
+		 * hook_mask then still is the one of the last check) */
+		if (exec_style == EXEC_STYLE_PRG) {
+			ebt_check_for_loops(replace);
+			if (ebt_errormsg[0] != '\0')
+				return -1;
+		}
 		entries = ebt_to_chain(replace);
 		m_l = new_entry->m_list;
 		w_l = new_entry->w_list;
@@ -1179,46 +1401,21 @@ check_extension:
 		ebt_add_rule(replace, new_entry, rule_nr);
 		if (ebt_errormsg[0] != '\0')
 			return -1;
+		/* Don't reuse the added rule, the chain owns it now */
+		new_entry = NULL;
 		/* Makes undoing the add easier (jumps to delete_the_rule) */
 		if (rule_nr <= 0)
 			rule_nr--;
 		rule_nr_end = rule_nr;
 
-		/* a jump to a udc requires checking for loops */
-		if (!strcmp(new_entry->t->u.name, EBT_STANDARD_TARGET) &&
-		((struct ebt_standard_target *)(new_entry->t))->verdict >= 0) {
-			/* FIXME: this can be done faster */
-			ebt_check_for_loops(replace);
+		/* A jump to a udc can change the hook_mask of chains, their
+		 * rules are checked again. The new rule itself was checked
+		 * above. In daemon mode this waits until the delivery. */
+		if (exec_style == EXEC_STYLE_PRG) {
+			ebt_check_rules(replace);
 			if (ebt_errormsg[0] != '\0')
 				goto delete_the_rule;
 		}
-
-		/* Do the final_check(), for all entries.
-		 * This is needed when adding a rule that has a chain target */
-		i = -1;
-		while (++i != replace->num_chains) {
-			struct ebt_u_entry *e;
-
-			entries = replace->chains[i];
-			if (!entries) {
-				if (i < NF_BR_NUMHOOKS)
-					continue;
-				else
-					ebt_print_bug("whoops\n");
-			}
-			e = entries->entries->next;
-			while (e != entries->entries) {
-				/* Userspace extensions use host endian */
-				e->ethproto = ntohs(e->ethproto);
-				ebt_do_final_checks(replace, e, entries);
-				if (ebt_errormsg[0] != '\0')
-					goto delete_the_rule;
-				e->ethproto = htons(e->ethproto);
-				e = e->next;
-			}
-		}
-		/* Don't reuse the added rule */
-		new_entry = NULL;
 	} else if (replace->command == 'D') {
 delete_the_rule:
 		ebt_delete_rule(replace, new_entry, rule_nr, rule_nr_end);
@@ -1228,6 +1425,12 @@ delete_the_rule:
 		ebt_change_counters(replace, new_entry, rule_nr, rule_nr_end, &(new_entry->cnt_surplus), chcounter);
 		if (ebt_errormsg[0] != '\0')
 			return -1;
+	} else if (replace->command == 14) {
+		if (new_entry->w_list)
+			ebt_print_error2("Only match options are allowed with --change-match");
+		ebt_change_match(replace, new_entry, rule_nr);
+		if (ebt_errormsg[0] != '\0')
+			return -1;
 	}
 	/* Commands -N, -E, -X, --atomic-commit, --atomic-commit, --atomic-save,
 	 * --init-table fall through */
@@ -45,7 +45,6 @@ like iptables. There are no incompatibility issues.
 %{__install} -m0755 *.so %{buildroot}%{_libdir}/ebtables/
 export __iets=`printf %{_sbindir} | sed 's/\\//\\\\\\//g'`
 export __iets2=`printf %{_mysysconfdir} | sed 's/\\//\\\\\\//g'`
-sed -i "s/__EXEC_PATH__/$__iets/g" ebtables-save
 %{__install} -m 0755 -o root -g root ebtables-save %{buildroot}%{_sbindir}/ebtables-save
 sed -i "s/__EXEC_PATH__/$__iets/g" ebtables.sysv; sed -i "s/__SYSCONFIG__/$__iets2/g" ebtables.sysv
 %{__install} -m 0755 -o root -g root ebtables.sysv %{buildroot}%{_initrddir}/ebtables
@@ -25,16 +25,53 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <stdint.h>
+#include <arpa/inet.h>
 #include "include/ebtables_u.h"
 
+#define OPT_ZERO	0x100 /* Also defined in ebtables.c */
 #define OPT_KERNELDATA	0x800 /* Also defined in ebtables.c */
 
+/*
+ * The three tables stay in memory between commands. Clients connect to
+ * the UNIX socket EBTD_SOCKET and are served one after the other.
+ *
+ * Every message on the socket starts with its length, a 32 bit number in
+ * network byte order, followed by that many bytes. A command message holds
+ * the arguments of the command (argv[0] included), each argument ends with
+ * '\0'. Every command gets a reply message: empty if the command succeeded,
+ * otherwise the error message. The replies are sent in the order of the
+ * commands, so a client doesn't have to wait for a reply before sending its
+ * next command.
+ *
+ * Commands sent between "begin" and "commit" form a transaction: after a
+ * failing command the other commands are skipped and "commit" throws away
+ * all changes that weren't committed yet. Otherwise "commit" gives the
+ * tables that were opened from the kernel and were changed to the kernel,
+ * the other tables aren't touched. Tables opened with fopen can be written
+ * with fcommit.
+ */
+
 static struct ebt_u_replace replace[3];
 #define OPEN_METHOD_FILE 1
 #define OPEN_METHOD_KERNEL 2
 static int open_method[3];
+/* the file given to fopen, for a rollback */
+static char *open_file[3];
+/* the table was changed since it was opened or committed */
+static int changed[3];
+static int in_transaction, transaction_failed;
+
+struct buffer
+{
+	char *data;
+	uint32_t len, size;
+};
+
 void ebt_early_init_once();
 
 static void sigpipe_handler(int sig)
@@ -47,14 +84,413 @@ static void copy_table_names()
 	strcpy(replace[2].name, "broute");
 }
 
+static int find_table(const char *name)
+{
+	int i;
+
+	for (i = 0; i < 3; i++)
+		if (!strcmp(replace[i].name, name))
+			return i;
+	ebt_print_error("ebtablesd: table '%s' was not recognized", name);
+	return -1;
+}
+
+/* Get the table from the kernel, or from a file if filename != NULL */
+static int open_table(int i, const char *filename)
+{
+	struct ebt_u_replace tmp;
+
+	if (replace[i].flags & OPT_KERNELDATA) {
+		ebt_print_error("ebtablesd: table %s needs to be freed before "
+		                "it can be opened", replace[i].name);
+		return -1;
+	}
+	if (!filename) {
+		if (ebt_get_kernel_table(&replace[i], 0))
+			return -1;
+		replace[i].flags |= OPT_KERNELDATA;
+		open_method[i] = OPEN_METHOD_KERNEL;
+		changed[i] = 0;
+		return 0;
+	}
+
+	memset(&tmp, 0, sizeof(tmp));
+	tmp.filename = (char *)malloc(strlen(filename) + 1);
+	if (!tmp.filename) {
+		ebt_print_error("Out of memory");
+		return -1;
+	}
+	strcpy(tmp.filename, filename);
+	strcpy(tmp.name, "filter");
+	tmp.command = 'L'; /* Make sure retrieve_from_file()
+	                    * doesn't complain about wrong
+	                    * table name */
+
+	ebt_get_kernel_table(&tmp, 0);
+	free(tmp.filename);
+	tmp.filename = NULL;
+	if (ebt_errormsg[0] != '\0')
+		return -1;
+
+	if (strcmp(tmp.name, replace[i].name)) {
+		ebt_print_error("ebtablesd: opened file with "
+		                "wrong table name '%s'", tmp.name);
+		ebt_cleanup_replace(&tmp);
+		return -1;
+	}
+	replace[i] = tmp;
+	replace[i].command = '\0';
+	replace[i].flags |= OPT_KERNELDATA;
+	open_method[i] = OPEN_METHOD_FILE;
+	if (open_file[i] != filename) {
+		free(open_file[i]);
+		open_file[i] = strdup(filename);
+	}
+	changed[i] = 0;
+	return 0;
+}
+
+static void free_table(int i)
+{
+	ebt_cleanup_replace(&replace[i]);
+	copy_table_names();
+	replace[i].flags &= ~OPT_KERNELDATA;
+	changed[i] = 0;
+}
+
+/* Give the table to the kernel, or write it to a file if filename != NULL */
+static void commit_table(int i, const char *filename)
+{
+	if (filename) {
+		replace[i].filename = (char *)malloc(strlen(filename) + 1);
+		if (!replace[i].filename) {
+			ebt_print_error("Out of memory");
+			return;
+		}
+		strcpy(replace[i].filename, filename);
+	} else if (open_method[i] == OPEN_METHOD_FILE)
+		/* The counters from the kernel are useless if we
+		 * didn't start from a kernel table */
+		replace[i].num_counters = 0;
+	ebt_deliver_table(&replace[i]);
+	if (ebt_errormsg[0] == '\0' && open_method[i] == OPEN_METHOD_KERNEL)
+		ebt_deliver_counters(&replace[i]);
+	if (filename) {
+		free(replace[i].filename);
+		replace[i].filename = NULL;
+	} else if (ebt_errormsg[0] == '\0')
+		changed[i] = 0;
+}
+
+/* Throw away the changes that weren't committed */
+static void rollback()
+{
+	char errormsg[ERRORMSG_MAXLEN];
+	int i;
+
+	strcpy(errormsg, ebt_errormsg);
+	for (i = 0; i < 3; i++) {
+		if (!changed[i] || !(replace[i].flags & OPT_KERNELDATA))
+			continue;
+		free_table(i);
+		ebt_errormsg[0] = '\0';
+		open_table(i, open_method[i] == OPEN_METHOD_FILE ?
+		           open_file[i] : NULL);
+	}
+	strcpy(ebt_errormsg, errormsg);
+}
+
+/* Returns 1 for the quit command */
+static int execute(int argc, char **argv)
+{
+	int i, table_nr = 0;
+
+	if (argc == 1) {
+		ebt_print_error("ebtablesd: no arguments");
+		return 0;
+	}
+	if (!strcmp(argv[1], "begin")) {
+		if (argc != 2) {
+			ebt_print_error("ebtablesd: command begin does "
+			                "not take any arguments");
+		} else if (in_transaction) {
+			ebt_print_error("ebtablesd: already in a transaction");
+		} else {
+			in_transaction = 1;
+			transaction_failed = 0;
+		}
+		return 0;
+	} else if (!strcmp(argv[1], "commit") && argc == 2) {
+		if (!in_transaction) {
+			ebt_print_error("ebtablesd: command commit needs "
+			                "exactly one argument outside a "
+			                "transaction");
+			return 0;
+		}
+		in_transaction = 0;
+		if (transaction_failed) {
+			rollback();
+			ebt_print_error("ebtablesd: a command of the "
+			                "transaction failed, nothing was "
+			                "committed");
+			return 0;
+		}
+		/* Only the tables that were changed */
+		for (i = 0; i < 3 && ebt_errormsg[0] == '\0'; i++)
+			if (changed[i] && open_method[i] == OPEN_METHOD_KERNEL)
+				commit_table(i, NULL);
+		return 0;
+	} else if (!strcmp(argv[1], "rollback")) {
+		if (argc != 2) {
+			ebt_print_error("ebtablesd: command rollback does "
+			                "not take any arguments");
+		} else {
+			in_transaction = 0;
+			rollback();
+		}
+		return 0;
+	} else if (!strcmp(argv[1], "quit")) {
+		if (argc != 2) {
+			ebt_print_error("ebtablesd: command quit does "
+			                "not take any arguments");
+			return 0;
+		}
+		return 1;
+	}
+	if (in_transaction && transaction_failed) {
+		ebt_print_error("ebtablesd: skipped, an earlier command of "
+		                "the transaction failed");
+		return 0;
+	}
+
+	/* Parse the options */
+	if (!strcmp(argv[1], "-t")) {
+		if (argc < 3) {
+			ebt_print_error("ebtablesd: -t but no table");
+			return 0;
+		}
+		if ((table_nr = find_table(argv[2])) == -1)
+			return 0;
+	} else if (!strcmp(argv[1], "free")) {
+		if (argc != 3) {
+			ebt_print_error("ebtablesd: command free "
+			                "needs exactly one argument");
+			return 0;
+		}
+		if ((i = find_table(argv[2])) == -1)
+			return 0;
+		if (!(replace[i].flags & OPT_KERNELDATA)) {
+			ebt_print_error("ebtablesd: table %s has not "
+			                "been opened", argv[2]);
+			return 0;
+		}
+		free_table(i);
+		return 0;
+	} else if (!strcmp(argv[1], "open")) {
+		if (argc != 3) {
+			ebt_print_error("ebtablesd: command open "
+			                "needs exactly one argument");
+			return 0;
+		}
+		if ((i = find_table(argv[2])) != -1)
+			open_table(i, NULL);
+		return 0;
+	} else if (!strcmp(argv[1], "fopen")) {
+		if (argc != 4) {
+			ebt_print_error("ebtablesd: command fopen "
+			                "needs exactly two arguments");
+			return 0;
+		}
+		if ((i = find_table(argv[2])) != -1)
+			open_table(i, argv[3]);
+		return 0;
+	} else if (!strcmp(argv[1], "commit") ||
+	           !strcmp(argv[1], "fcommit")) {
+		if (argc != (argv[1][0] == 'f' ? 4 : 3)) {
+			ebt_print_error("ebtablesd: command %s needs "
+			                "exactly %s", argv[1], argv[1][0] ==
+			                'f' ? "two arguments" : "one argument");
+			return 0;
+		}
+		if ((i = find_table(argv[2])) == -1)
+			return 0;
+		if (!(replace[i].flags & OPT_KERNELDATA)) {
+			ebt_print_error("ebtablesd: table %s has not "
+			                "been opened", argv[2]);
+			return 0;
+		}
+		commit_table(i, argc == 4 ? argv[3] : NULL);
+		return 0;
+	}
+	/* The tables are opened when they are first used */
+	if (!(replace[table_nr].flags & OPT_KERNELDATA) &&
+	    open_table(table_nr, NULL))
+		return 0;
+	optind = 0; /* Setting optind = 1 causes serious annoyances */
+	do_command(argc, argv, EXEC_STYLE_DAEMON, &replace[table_nr]);
+	ebt_reinit_extensions();
+	if (replace[table_nr].command != 'L' ||
+	    replace[table_nr].flags & OPT_ZERO)
+		changed[table_nr] = 1;
+	return 0;
+}
+
+static int write_all(int fd, const char *buf, int len)
+{
+	int n;
+
+	while (len > 0) {
+		if ((n = write(fd, buf, len)) <= 0) {
+			if (n < 0 && errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* Make room for len more bytes in the buffer */
+static int grow_buffer(struct buffer *b, unsigned int len)
+{
+	unsigned int size = b->size ? b->size : 65536;
+	char *data;
+
+	while (size - b->len < len)
+		size *= 2;
+	if (size == b->size)
+		return 0;
+	if (!(data = (char *)realloc(b->data, size)))
+		return -1;
+	b->data = data;
+	b->size = size;
+	return 0;
+}
+
+/* Queue the reply for the command that was just executed */
+static int reply_status(struct buffer *out)
+{
+	uint32_t len = strlen(ebt_errormsg);
+
+	if (len) {
+#ifndef SILENT_DAEMON
+		printf("%s.\n", ebt_errormsg);
+#endif
+		if (in_transaction)
+			transaction_failed = 1;
+	}
+	if (grow_buffer(out, sizeof(len) + len))
+		return -1;
+	len = htonl(len);
+	memcpy(out->data + out->len, &len, sizeof(len));
+	out->len += sizeof(len);
+	len = ntohl(len);
+	memcpy(out->data + out->len, ebt_errormsg, len);
+	out->len += len;
+	ebt_errormsg[0] = '\0';
+	return 0;
+}
+
+/* Split a command message in its arguments, every argument ends with '\0' */
+static int split_message(char *msg, uint32_t len, char ***argv, int *argv_size)
+{
+	char **new_argv;
+	int argc = 0;
+	uint32_t i;
+
+	if (len == 0 || msg[len - 1] != '\0') {
+		ebt_print_error("ebtablesd: malformed command");
+		return -1;
+	}
+	for (i = 0; i < len; i += strlen(msg + i) + 1) {
+		/* Leave room for the terminating NULL */
+		if (argc + 1 >= *argv_size) {
+			new_argv = (char **)realloc(*argv, 2 * (*argv_size + 16) *
+			                            sizeof(char *));
+			if (!new_argv) {
+				ebt_print_error("Out of memory");
+				return -1;
+			}
+			*argv = new_argv;
+			*argv_size = 2 * (*argv_size + 16);
+		}
+		(*argv)[argc++] = msg + i;
+	}
+	(*argv)[argc] = NULL;
+	return argc;
+}
+
+/* Execute the commands of one client, returns 1 for the quit command.
+ * All commands that arrived together are executed before their replies
+ * are sent back in one go. */
+static int serve(int fd)
+{
+	struct buffer in = {NULL, 0, 0}, out = {NULL, 0, 0};
+	char **argv = NULL;
+	int argc, argv_size = 0, n, quit = 0;
+	uint32_t pos, len;
+
+	while (!quit) {
+		if (grow_buffer(&in, 1))
+			break;
+		n = read(fd, in.data + in.len, in.size - in.len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		in.len += n;
+		pos = 0;
+		while (!quit && in.len - pos >= sizeof(len)) {
+			memcpy(&len, in.data + pos, sizeof(len));
+			len = ntohl(len);
+			if (len > EBTD_MSG_MAXLEN) {
+				ebt_print_error("ebtablesd: the maximum command "
+				                "length is %d", EBTD_MSG_MAXLEN);
+				reply_status(&out);
+				quit = -1;
+				break;
+			}
+			if (in.len - pos - sizeof(len) < len) {
+				/* Wait for the rest of the message */
+				if (grow_buffer(&in, sizeof(len) + len - (in.len - pos)))
+					quit = -1;
+				break;
+			}
+			pos += sizeof(len);
+			if ((argc = split_message(in.data + pos, len, &argv,
+			    &argv_size)) != -1)
+				quit = execute(argc, argv);
+			pos += len;
+			if (reply_status(&out))
+				quit = -1;
+		}
+		in.len -= pos;
+		memmove(in.data, in.data + pos, in.len);
+		if (write_all(fd, out.data, out.len))
+			break;
+		out.len = 0;
+	}
+	free(in.data);
+	free(out.data);
+	free(argv);
+	/* A transaction can't outlive its client */
+	if (in_transaction) {
+		in_transaction = 0;
+		rollback();
+		ebt_errormsg[0] = '\0';
+	}
+	return quit == 1;
+}
+
 int main(int argc_, char *argv_[])
 {
-	char *argv[EBTD_ARGC_MAX], *args[4], name[] = "mkdir",
-	     mkdir_option[] = "-p", mkdir_dir[] = EBTD_PIPE_DIR,
-	     cmdline[EBTD_CMDLINE_MAXLN];
-	int readfd, base = 0, offset = 0, n = 0, ret = 0, quotemode = 0;
+	char *args[4], name[] = "mkdir", mkdir_option[] = "-p",
+	     mkdir_dir[] = EBTD_PIPE_DIR;
+	struct sockaddr_un addr;
+	int listenfd, fd, ret = 0;
 
-	/* Make sure the pipe directory exists */
+	/* Make sure the socket directory exists */
 	args[0] = name;
 	args[1] = mkdir_option;
 	args[2] = mkdir_dir;
@@ -72,14 +508,18 @@ int main(int argc_, char *argv_[])
 		wait(NULL);
 	}
 
-	if (mkfifo(EBTD_PIPE, 0600) < 0 && errno != EEXIST) {
-		printf("Error creating FIFO " EBTD_PIPE "\n");
-		ret = -1;
-		goto do_exit;
+	if ((listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		perror("socket");
+		return -1;
 	}
-
-	if ((readfd = open(EBTD_PIPE, O_RDONLY | O_NONBLOCK, 0)) == -1) {
-		perror("open");
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, EBTD_SOCKET, sizeof(addr.sun_path) - 1);
+	unlink(EBTD_SOCKET);
+	umask(077);
+	if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+	    listen(listenfd, 16) == -1) {
+		printf("Error creating socket " EBTD_SOCKET "\n");
 		ret = -1;
 		goto do_exit;
 	}
@@ -96,279 +536,23 @@ int main(int argc_, char *argv_[])
 	ebt_early_init_once();
 
 	while (1) {
-		int n2, i, argc, table_nr, ntot;
-
-		/* base == 0 */
-		ntot = read(readfd, cmdline+offset, EBTD_CMDLINE_MAXLN-offset-1);
-		if (ntot <= 0)
-			continue;
-		ntot += offset;
-continue_read:
-		/* Put '\0' between arguments. */
-		for (; offset < ntot; n++, offset++) {
-			if (cmdline[offset] == '\"') {
-				quotemode ^= 1;
-				cmdline[offset] = '\0';
-			} else if (!quotemode && cmdline[offset] == ' ') {
-				cmdline[offset] = '\0';
-			} else if (cmdline[offset] == '\n') {
-				if (quotemode)
-					ebt_print_error("ebtablesd: wrong number of \" delimiters");
-				cmdline[offset] = '\0';
-				break;
-			}
-		}
-		if (n == 0) {
-			if (offset == ntot) {
-				/* The ntot bytes were parsed and ended with '\n' */
-				base = 0;
-				offset = 0;
-				continue;
-			}
-			offset++;
-			base = offset;
-			n = 0;
-			goto continue_read;
-		}
-		if (offset == ntot) { /* The ntot bytes were parsed but no complete rule is yet specified */
-			if (base == 0) {
-				ebt_print_error("ebtablesd: the maximum command line length is %d", EBTD_CMDLINE_MAXLN-1);
-				goto write_msg;
-			}
-			memmove(cmdline, cmdline+base+offset, ntot-offset);
-			offset -= base;
-			offset++;
-			base = 0;
-			continue;
-		}
-
-		table_nr = 0;
-		n2 = 0;
-		argc = 0;
-		while (n2 < n && argc < EBTD_ARGC_MAX) {
-			if (*(cmdline + base + n2) == '\0') {
-				n2++;
+		if ((fd = accept(listenfd, NULL, NULL)) == -1) {
+			if (errno == EINTR)
 				continue;
-			}
-			argv[argc++] = cmdline + base + n2;
-			n2 += strlen(cmdline + base + n2) + 1;
-		}
-		offset++; /* Move past the '\n' */
-		base = offset;
-
-		if (argc > EBTD_ARGC_MAX) {
-			ebt_print_error("ebtablesd: maximum %d arguments "
-			                "allowed", EBTD_ARGC_MAX - 1);
-			goto write_msg;
-		}
-		if (argc == 1) {
-			ebt_print_error("ebtablesd: no arguments");
-			goto write_msg;
-		}
-
-		/* Parse the options */
-		if (!strcmp(argv[1], "-t")) {
-			if (argc < 3) {
-				ebt_print_error("ebtablesd: -t but no table");
-				goto write_msg;
-			}
-			for (i = 0; i < 3; i++)
-				if (!strcmp(replace[i].name, argv[2]))
-					break;
-			if (i == 3) {
-				ebt_print_error("ebtablesd: table '%s' was "
-				                "not recognized", argv[2]);
-				goto write_msg;
-			}
-			table_nr = i;
-		} else if (!strcmp(argv[1], "free")) {
-			if (argc != 3) {
-				ebt_print_error("ebtablesd: command free "
-				                "needs exactly one argument");
-				goto write_msg;
-			}
-			for (i = 0; i < 3; i++)
-				if (!strcmp(replace[i].name, argv[2]))
-					break;
-			if (i == 3) {
-				ebt_print_error("ebtablesd: table '%s' was "
-				                "not recognized", argv[2]);
-				goto write_msg;
-			}
-			if (!(replace[i].flags & OPT_KERNELDATA)) {
-				ebt_print_error("ebtablesd: table %s has not "
-				                "been opened");
-				goto write_msg;
-			}
-			ebt_cleanup_replace(&replace[i]);
-			copy_table_names();
-			replace[i].flags &= ~OPT_KERNELDATA;
-			goto write_msg;
-		} else if (!strcmp(argv[1], "open")) {
-			if (argc != 3) {
-				ebt_print_error("ebtablesd: command open "
-				                "needs exactly one argument");
-				goto write_msg;
-			}
-
-			for (i = 0; i < 3; i++)
-				if (!strcmp(replace[i].name, argv[2]))
-					break;
-			if (i == 3) {
-				ebt_print_error("ebtablesd: table '%s' was "
-				                "not recognized", argv[2]);
-				goto write_msg;
-			}
-			if (replace[i].flags & OPT_KERNELDATA) {
-				ebt_print_error("ebtablesd: table %s needs to "
-				                "be freed before it can be "
-				                "opened");
-				goto write_msg;
-			}
-			if (!ebt_get_kernel_table(&replace[i], 0)) {
-				replace[i].flags |= OPT_KERNELDATA;
-				open_method[i] = OPEN_METHOD_KERNEL;
-			}
-			goto write_msg;
-		} else if (!strcmp(argv[1], "fopen")) {
-			struct ebt_u_replace tmp;
-
-			memset(&tmp, 0, sizeof(tmp));
-			if (argc != 4) {
-				ebt_print_error("ebtablesd: command fopen "
-				                "needs exactly two arguments");
-				goto write_msg;
-			}
-
-			for (i = 0; i < 3; i++)
-				if (!strcmp(replace[i].name, argv[2]))
-					break;
-			if (i == 3) {
-				ebt_print_error("ebtablesd: table '%s' was "
-				                "not recognized", argv[2]);
-				goto write_msg;
-			}
-			if (replace[i].flags & OPT_KERNELDATA) {
-				ebt_print_error("ebtablesd: table %s needs to "
-				                "be freed before it can be "
-				                "opened");
-				goto write_msg;
-			}
-			tmp.filename = (char *)malloc(strlen(argv[3]) + 1);
-			if (!tmp.filename) {
-				ebt_print_error("Out of memory");
-				goto write_msg;
-			}
-			strcpy(tmp.filename, argv[3]);
-			strcpy(tmp.name, "filter");
-			tmp.command = 'L'; /* Make sure retrieve_from_file()
-			                    * doesn't complain about wrong
-			                    * table name */
-
-			ebt_get_kernel_table(&tmp, 0);
-			free(tmp.filename);
-			tmp.filename = NULL;
-			if (ebt_errormsg[0] != '\0')
-				goto write_msg;
-
-			if (strcmp(tmp.name, argv[2])) {
-				ebt_print_error("ebtablesd: opened file with "
-				                "wrong table name '%s'", tmp.name);
-				ebt_cleanup_replace(&tmp);
-				goto write_msg;
-			}
-			replace[i] = tmp;
-			replace[i].command = '\0';
-			replace[i].flags |= OPT_KERNELDATA;
-			open_method[i] = OPEN_METHOD_FILE;
-			goto write_msg;
-		} else if (!strcmp(argv[1], "commit")) {
-			if (argc != 3) {
-				ebt_print_error("ebtablesd: command commit "
-				                "needs exactly one argument");
-				goto write_msg;
-			}
-
-			for (i = 0; i < 3; i++)
-				if (!strcmp(replace[i].name, argv[2]))
-					break;
-			if (i == 3) {
-				ebt_print_error("ebtablesd: table '%s' was "
-				                "not recognized", argv[2]);
-				goto write_msg;
-			}
-			if (!(replace[i].flags & OPT_KERNELDATA)) {
-				ebt_print_error("ebtablesd: table %s has not "
-				                "been opened");
-				goto write_msg;
-			}
-			/* The counters from the kernel are useless if we 
-			 * didn't start from a kernel table */
-			if (open_method[i] == OPEN_METHOD_FILE)
-				replace[i].num_counters = 0;
-			ebt_deliver_table(&replace[i]);
-			if (ebt_errormsg[0] == '\0' && open_method[i] == OPEN_METHOD_KERNEL)
-				ebt_deliver_counters(&replace[i]);
-			goto write_msg;
-		} else if (!strcmp(argv[1], "fcommit")) {
-			if (argc != 4) {
-				ebt_print_error("ebtablesd: command commit "
-				                "needs exactly two argument");
-				goto write_msg;
-			}
-
-			for (i = 0; i < 3; i++)
-				if (!strcmp(replace[i].name, argv[2]))
-					break;
-			if (i == 3) {
-				ebt_print_error("ebtablesd: table '%s' was "
-				                "not recognized", argv[2]);
-				goto write_msg;
-			}
-			if (!(replace[i].flags & OPT_KERNELDATA)) {
-				ebt_print_error("ebtablesd: table %s has not "
-				                "been opened");
-				goto write_msg;
-			}
-			replace[i].filename = (char *)malloc(strlen(argv[3]) + 1);
-			if (!replace[i].filename) {
-				ebt_print_error("Out of memory");
-				goto write_msg;
-			}
-			strcpy(replace[i].filename, argv[3]);
-			ebt_deliver_table(&replace[i]);
-			if (ebt_errormsg[0] == '\0' && open_method[i] == OPEN_METHOD_KERNEL)
-				ebt_deliver_counters(&replace[i]);
-			free(replace[i].filename);
-			replace[i].filename = NULL;
-			goto write_msg;
-		}else if (!strcmp(argv[1], "quit")) {
-			if (argc != 2) {
-				ebt_print_error("ebtablesd: command quit does "
-				                "not take any arguments");
-				goto write_msg;
-			}
+			perror("accept");
+			ret = -1;
 			break;
 		}
-		if (!(replace[table_nr].flags & OPT_KERNELDATA)) {
-			ebt_print_error("ebtablesd: table %s has not been "
-			                "opened", replace[table_nr].name);
-			goto write_msg;
+		ret = serve(fd);
+		close(fd);
+		if (ret) {
+			ret = 0;
+			break;
 		}
-		optind = 0; /* Setting optind = 1 causes serious annoyances */
-		do_command(argc, argv, EXEC_STYLE_DAEMON, &replace[table_nr]);
-		ebt_reinit_extensions();
-write_msg:
-#ifndef SILENT_DAEMON
-		if (ebt_errormsg[0] != '\0')
-			printf("%s.\n", ebt_errormsg);
-#endif
-		ebt_errormsg[0]= '\0';
-		n = 0;
-		goto continue_read;
 	}
 do_exit:
-	unlink(EBTD_PIPE);
-	
-	return 0;
+	close(listenfd);
+	unlink(EBTD_SOCKET);
+
+	return ret;
 }
@@ -4,8 +4,13 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <arpa/inet.h>
 
 static void print_help()
 {
@@ -16,42 +21,263 @@ static void print_help()
 "ebtablesu fopen table file   : copy the table from the specified file\n"
 "ebtablesu free table         : remove the table from memory\n"
 "ebtablesu commit table       : commit the table to the kernel\n"
-"ebtablesu fcommit table file : commit the table to the specified file\n\n"
+"ebtablesu fcommit table file : commit the table to the specified file\n"
+"ebtablesu begin              : start a transaction\n"
+"ebtablesu commit             : end the transaction, commit the changed tables\n"
+"ebtablesu rollback           : forget the changes that weren't committed\n"
+"ebtablesu -                  : read commands from stdin, one per line,\n"
+"                               use \"\" around arguments with spaces\n\n"
 "ebtablesu <ebtables options> : the ebtables specifications\n"
-"                               use spaces only to separate options and commands\n"
 "For the ebtables options, see\n# ebtables -h\nor\n# man ebtables\n"
 	);
 }
-int main(int argc, char *argv[])
+
+static int connect_daemon()
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, EBTD_SOCKET, sizeof(addr.sun_path) - 1);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 ||
+	    connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		fprintf(stderr, "Could not connect to the socket, perhaps "
+		        "ebtablesd is not running or you don't have write "
+		        "permission (try running as root).\n");
+		exit(-1);
+	}
+	return fd;
+}
+
+struct buffer
 {
-	char *arguments, *pos;
-	int i, writefd, len = 0;
-
-	if (argc > EBTD_ARGC_MAX) {
-		fprintf(stderr, "ebtablesd accepts at most %d arguments, %d "
-		        "arguments were specified. If you need this many "
-		        "arguments, recompile this tool with a higher value for"
-		        " EBTD_ARGC_MAX.\n", EBTD_ARGC_MAX - 1, argc - 1);
+	char *data;
+	uint32_t len, size;
+};
+
+/* Make room for len more bytes in the buffer */
+static void grow_buffer(struct buffer *b, uint32_t len)
+{
+	uint32_t size = b->size ? b->size : 65536;
+
+	while (size - b->len < len)
+		size *= 2;
+	if (size == b->size)
+		return;
+	if (!(b->data = (char *)realloc(b->data, size))) {
+		fprintf(stderr, "ebtablesu: out of memory.\n");
+		exit(-1);
+	}
+	b->size = size;
+}
+
+/* Start a command message, its length is filled in by end_message() */
+static uint32_t start_message(struct buffer *out)
+{
+	grow_buffer(out, sizeof(uint32_t));
+	out->len += sizeof(uint32_t);
+	return out->len - sizeof(uint32_t);
+}
+
+static void end_message(struct buffer *out, uint32_t start)
+{
+	uint32_t len = htonl(out->len - start - sizeof(len));
+
+	memcpy(out->data + start, &len, sizeof(len));
+}
+
+static void add_argument(struct buffer *out, const char *arg, int len)
+{
+	grow_buffer(out, len + 1);
+	memcpy(out->data + out->len, arg, len);
+	out->data[out->len + len] = '\0';
+	out->len += len + 1;
+}
+
+/* Turn a line from stdin into a command message. Spaces separate the
+ * arguments, unless they are between "". Returns -1 if the line is bad. */
+static int add_line(struct buffer *out, const char *line, int len, int line_nr)
+{
+	uint32_t start = start_message(out);
+	int i, arg = 0, quotemode = 0;
+
+	add_argument(out, "ebtablesu", 9);
+	for (i = 0; i <= len; i++) {
+		if (i < len && line[i] == '\"')
+			quotemode ^= 1;
+		else if (i < len && (quotemode || (line[i] != ' ' &&
+		         line[i] != '\t' && line[i] != '\r')))
+			continue;
+		if (i > arg)
+			add_argument(out, line + arg, i - arg);
+		arg = i + 1;
+	}
+	if (quotemode) {
+		fprintf(stderr, "line %d: wrong number of \" delimiters.\n",
+		        line_nr);
+		out->len = start;
 		return -1;
-	} else if (argc == 1) {
+	}
+	end_message(out, start);
+	return 0;
+}
+
+/* The line numbers of the commands that are waiting for a reply */
+static int *pending;
+static int pending_size, pending_head, pending_tail;
+
+static void add_pending(int line_nr)
+{
+	if (pending_tail == pending_size) {
+		if (pending_head) {
+			memmove(pending, pending + pending_head, (pending_tail -
+			        pending_head) * sizeof(int));
+			pending_tail -= pending_head;
+			pending_head = 0;
+		} else {
+			pending_size = 2 * pending_size + 64;
+			if (!(pending = (int *)realloc(pending, pending_size *
+			                               sizeof(int)))) {
+				fprintf(stderr, "ebtablesu: out of memory.\n");
+				exit(-1);
+			}
+		}
+	}
+	pending[pending_tail++] = line_nr;
+}
+
+/* Handle the complete replies in the buffer, returns -1 if a command
+ * failed */
+static int handle_replies(struct buffer *in)
+{
+	uint32_t pos = 0, len;
+	int line_nr, ret = 0;
+
+	while (in->len - pos >= sizeof(len)) {
+		memcpy(&len, in->data + pos, sizeof(len));
+		len = ntohl(len);
+		if (in->len - pos - sizeof(len) < len)
+			break;
+		if (pending_head == pending_tail) {
+			fprintf(stderr, "Unexpected reply from ebtablesd.\n");
+			exit(-1);
+		}
+		line_nr = pending[pending_head++];
+		pos += sizeof(len);
+		if (len) {
+			if (line_nr)
+				fprintf(stderr, "line %d: ", line_nr);
+			fprintf(stderr, "%.*s\n", (int)len, in->data + pos);
+			ret = -1;
+		}
+		pos += len;
+	}
+	in->len -= pos;
+	memmove(in->data, in->data + pos, in->len);
+	return ret;
+}
+
+/* Send the queued commands and read their replies. With from_stdin set,
+ * the commands are read from stdin, one per line, and sent while the
+ * replies of the previous commands are coming in. */
+static int run(int fd, struct buffer *out, int from_stdin)
+{
+	struct buffer in = {NULL, 0, 0}, lines = {NULL, 0, 0};
+	struct pollfd fds[2];
+	char *line, *end;
+	int n, eof, line_nr = 0, ret = 0;
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	while (from_stdin || out->len || pending_head != pending_tail) {
+		fds[0].fd = fd;
+		fds[0].events = POLLIN | (out->len ? POLLOUT : 0);
+		/* Don't read ahead too far if ebtablesd is slow */
+		fds[1].fd = 0;
+		fds[1].events = POLLIN;
+		fds[1].revents = 0;
+		if (poll(fds, from_stdin && out->len < 65536 ? 2 : 1, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			exit(-1);
+		}
+		if (fds[0].revents & POLLOUT) {
+			if ((n = write(fd, out->data, out->len)) == -1 &&
+			    errno != EAGAIN && errno != EINTR) {
+				perror("write");
+				exit(-1);
+			}
+			if (n > 0) {
+				out->len -= n;
+				memmove(out->data, out->data + n, out->len);
+			}
+		}
+		if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+			grow_buffer(&in, 4096);
+			n = read(fd, in.data + in.len, in.size - in.len);
+			if (n == 0 || (n == -1 && errno != EAGAIN &&
+			    errno != EINTR)) {
+				fprintf(stderr, "ebtablesd closed the "
+				        "connection.\n");
+				exit(-1);
+			}
+			if (n > 0) {
+				in.len += n;
+				if (handle_replies(&in))
+					ret = -1;
+			}
+		}
+		if (!from_stdin || out->len >= 65536 ||
+		    !(fds[1].revents & (POLLIN | POLLHUP)))
+			continue;
+		grow_buffer(&lines, 4096);
+		n = read(0, lines.data + lines.len, lines.size - lines.len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("read");
+			exit(-1);
+		}
+		lines.len += n;
+		/* The last line doesn't need a '\n' */
+		eof = n == 0;
+		if (eof && lines.len && lines.data[lines.len - 1] != '\n') {
+			grow_buffer(&lines, 1);
+			lines.data[lines.len++] = '\n';
+		}
+		line = lines.data;
+		while ((end = memchr(line, '\n', lines.data + lines.len - line))) {
+			line_nr++;
+			n = strspn(line, " \t\r");
+			if (line + n != end && line[n] != '#') {
+				if (add_line(out, line, end - line, line_nr))
+					ret = -1;
+				else
+					add_pending(line_nr);
+			}
+			line = end + 1;
+		}
+		lines.len -= line - lines.data;
+		memmove(lines.data, line, lines.len);
+		if (eof)
+			from_stdin = 0;
+	}
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	struct buffer out = {NULL, 0, 0};
+	uint32_t start;
+	int i, fd;
+
+	if (argc == 1) {
 		fprintf(stderr, "At least one argument is needed.\n");
 		print_help();
 		exit(0);
 	}
 
-	for (i = 0; i < argc; i++)
-		len += strlen(argv[i]);
-	/* Don't forget '\0' */
-	len += argc;
-	if (len > EBTD_CMDLINE_MAXLN) {
-		fprintf(stderr, "ebtablesd has a maximum command line argument "
-		       "length of %d, an argument length of %d was received. "
-		       "If a smaller length is unfeasible, recompile this tool "
-		       "with a higher value for EBTD_CMDLINE_MAXLN.\n",
-		       EBTD_CMDLINE_MAXLN, len);
-		return -1;
-	}
-
 	if (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")) {
 		if (argc != 2) {
 			fprintf(stderr, "%s does not accept options.\n", argv[1]);
@@ -61,29 +287,15 @@ int main(int argc, char *argv[])
 		exit(0);
 	}
 
-	if (!(arguments = (char *)malloc(len))) {
-		fprintf(stderr, "ebtablesu: out of memory.\n");
-		return -1;
-	}
-
-	if ((writefd = open(EBTD_PIPE, O_WRONLY, 0)) == -1) {
-		fprintf(stderr, "Could not open the pipe, perhaps ebtablesd is "
-		        "not running or you don't have write permission (try "
-		        "running as root).\n");
-		return -1;
-	}
-
-	pos = arguments;
-	for (i = 0; i < argc; i++) {
-		strcpy(pos, argv[i]);
-		pos += strlen(argv[i]);
-		*(pos++) = ' ';
-	}
+	fd = connect_daemon();
+	if (argc == 2 && !strcmp(argv[1], "-"))
+		return run(fd, &out, 1);
 
-	*(pos-1) = '\n';
-	if (write(writefd, arguments, len) == -1) {
-		perror("write");
-		return -1;
-	}
-	return 0;
+	/* The arguments go as they are, no quoting needed */
+	start = start_message(&out);
+	for (i = 0; i < argc; i++)
+		add_argument(&out, argv[i], strlen(argv[i]));
+	end_message(&out, start);
+	add_pending(0);
+	return run(fd, &out, 0);
 }
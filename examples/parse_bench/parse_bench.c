@@ -0,0 +1,354 @@
+
+/*
+ * Times the address scanners of useful_functions.c (ebt_scan_mac,
+ * ebt_scan_ip, ebt_scan_ip_mask, ebt_scan_ip6, ebt_scan_ip6_mask)
+ * against the code they replaced: ether_aton for MAC addresses,
+ * per-octet strtol and inet_pton for IPv4, inet_pton for IPv6, each with
+ * masks and prefixes where the option allows them.
+ *
+ * usage:
+ *   parse_bench [number_of_addresses [rounds]]
+ *
+ * compile with make parse_bench, run from the top directory with
+ *   LD_LIBRARY_PATH=. examples/parse_bench/parse_bench
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/ether.h>
+#include "../../include/ebtables_u.h"
+
+#define ADDR_SIZE 64
+
+/* The generated addresses, one per ADDR_SIZE bytes */
+static char *addrs;
+static int naddrs, rounds;
+/* Keeps the compiler from dropping the parsing */
+static volatile unsigned int sink;
+
+/* What ebt_parse_ip_address() used before ebt_scan_ip() */
+static int old_undot_ip(char *ip, unsigned char *ip2)
+{
+	char *p, *q, *end;
+	long int onebyte;
+	int i;
+	char buf[20];
+
+	strncpy(buf, ip, sizeof(buf) - 1);
+	buf[sizeof(buf) - 1] = '\0';
+
+	p = buf;
+	for (i = 0; i < 3; i++) {
+		if ((q = strchr(p, '.')) == NULL)
+			return -1;
+		*q = '\0';
+		onebyte = strtol(p, &end, 10);
+		if (*end != '\0' || onebyte > 255 || onebyte < 0)
+			return -1;
+		ip2[i] = (unsigned char)onebyte;
+		p = q + 1;
+	}
+
+	onebyte = strtol(p, &end, 10);
+	if (*end != '\0' || onebyte > 255 || onebyte < 0)
+		return -1;
+	ip2[3] = (unsigned char)onebyte;
+
+	return 0;
+}
+
+/* The old ip_mask() */
+static int old_ip_mask(char *mask, unsigned char *mask2)
+{
+	char *end;
+	long int bits;
+	uint32_t mask22;
+
+	if (old_undot_ip(mask, mask2)) {
+		bits = strtol(mask, &end, 10);
+		if (*end != '\0' || bits > 32 || bits < 0)
+			return -1;
+		mask22 = bits ? htonl(0xFFFFFFFF << (32 - bits)) : 0xFFFFFFFF;
+		memcpy(mask2, &mask22, 4);
+	}
+	return 0;
+}
+
+/* The old ebt_parse_ip_address(), it writes into its argument */
+static int old_ip_and_mask(char *address, uint32_t *addr, uint32_t *msk)
+{
+	char buf[ADDR_SIZE], *p;
+
+	strcpy(buf, address);
+	if ((p = strrchr(buf, '/')) != NULL) {
+		*p = '\0';
+		if (old_ip_mask(p + 1, (unsigned char *)msk))
+			return -1;
+	} else
+		*msk = 0xFFFFFFFF;
+	if (old_undot_ip(buf, (unsigned char *)addr))
+		return -1;
+	*addr &= *msk;
+	return 0;
+}
+
+/* The same with inet_pton() for the address */
+static int pton_ip_and_mask(char *address, uint32_t *addr, uint32_t *msk)
+{
+	char buf[ADDR_SIZE], *p;
+
+	strcpy(buf, address);
+	if ((p = strrchr(buf, '/')) != NULL) {
+		*p = '\0';
+		if (old_ip_mask(p + 1, (unsigned char *)msk))
+			return -1;
+	} else
+		*msk = 0xFFFFFFFF;
+	if (inet_pton(AF_INET, buf, addr) != 1)
+		return -1;
+	*addr &= *msk;
+	return 0;
+}
+
+static int new_ip_and_mask(char *address, uint32_t *addr, uint32_t *msk)
+{
+	const char *p = address, *end = address + strlen(address);
+
+	if (ebt_scan_ip(&p, end, addr))
+		return -1;
+	if (p == end)
+		*msk = 0xFFFFFFFF;
+	else if (*p++ != '/' || ebt_scan_ip_mask(&p, end, msk) || p != end)
+		return -1;
+	*addr &= *msk;
+	return 0;
+}
+
+/* The old parse_ip6_mask() and ebt_parse_ip6_address() */
+static int old_ip6_and_mask(char *address, struct in6_addr *addr,
+			    struct in6_addr *msk)
+{
+	char buf[ADDR_SIZE], *p, *end;
+	unsigned long bits;
+	int i;
+
+	strcpy(buf, address);
+	if ((p = strrchr(buf, '/')) != NULL) {
+		*p = '\0';
+		if (inet_pton(AF_INET6, p + 1, msk) != 1) {
+			/* string_to_number() came down to this */
+			bits = strtoul(p + 1, &end, 0);
+			if (*end != '\0' || end == p + 1 || bits > 128)
+				return -1;
+			memset(msk, 0, sizeof(*msk));
+			memset(msk, 0xff, bits / 8);
+			if (bits & 7)
+				msk->s6_addr[bits / 8] = 0xff << (8 - (bits & 7));
+		}
+	} else
+		memset(msk, 0xff, sizeof(*msk));
+	if (inet_pton(AF_INET6, buf, addr) != 1)
+		return -1;
+	for (i = 0; i < 16; i++)
+		addr->s6_addr[i] &= msk->s6_addr[i];
+	return 0;
+}
+
+static int new_ip6_and_mask(char *address, struct in6_addr *addr,
+			    struct in6_addr *msk)
+{
+	const char *p = address, *end = address + strlen(address);
+	int i;
+
+	if (ebt_scan_ip6(&p, end, addr))
+		return -1;
+	if (p == end)
+		memset(msk, 0xff, sizeof(*msk));
+	else if (*p++ != '/' || ebt_scan_ip6_mask(&p, end, msk) || p != end)
+		return -1;
+	for (i = 0; i < 16; i++)
+		addr->s6_addr[i] &= msk->s6_addr[i];
+	return 0;
+}
+
+static int old_mac(char *address, unsigned char *mac)
+{
+	struct ether_addr *a;
+
+	if (!(a = ether_aton(address)))
+		return -1;
+	memcpy(mac, a, ETH_ALEN);
+	return 0;
+}
+
+static int new_mac(char *address, unsigned char *mac)
+{
+	return ebt_get_mac(address, mac);
+}
+
+/* All parsers are wrapped to this, out gets the bytes of the result */
+typedef int (*parse_fn)(char *address, unsigned char *out);
+
+static int old_ip(char *a, unsigned char *o)
+{
+	return old_ip_and_mask(a, (uint32_t *)o, (uint32_t *)(o + 4));
+}
+static int pton_ip(char *a, unsigned char *o)
+{
+	return pton_ip_and_mask(a, (uint32_t *)o, (uint32_t *)(o + 4));
+}
+static int new_ip(char *a, unsigned char *o)
+{
+	return new_ip_and_mask(a, (uint32_t *)o, (uint32_t *)(o + 4));
+}
+static int old_ip6(char *a, unsigned char *o)
+{
+	return old_ip6_and_mask(a, (struct in6_addr *)o,
+				(struct in6_addr *)(o + 16));
+}
+static int new_ip6(char *a, unsigned char *o)
+{
+	return new_ip6_and_mask(a, (struct in6_addr *)o,
+				(struct in6_addr *)(o + 16));
+}
+
+/* Generators for the address list */
+static void gen_mac(char *buf)
+{
+	sprintf(buf, "%x:%x:%x:%x:%x:%x", rand() & 0xff, rand() & 0xff,
+		rand() & 0xff, rand() & 0xff, rand() & 0xff, rand() & 0xff);
+}
+
+static void gen_ip(char *buf)
+{
+	buf += sprintf(buf, "%d.%d.%d.%d", rand() & 0xff, rand() & 0xff,
+		       rand() & 0xff, rand() & 0xff);
+	switch (rand() % 3) {
+	case 0:
+		break;
+	case 1:
+		sprintf(buf, "/%d", rand() % 33);
+		break;
+	default:
+		sprintf(buf, "/255.255.%d.0", 256 - (1 << (rand() % 9)));
+	}
+}
+
+static void gen_ip6(char *buf)
+{
+	struct in6_addr a;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		/* Some zero runs, so "::" shows up */
+		a.s6_addr[i] = rand() % 3 ? rand() & 0xff : 0;
+	inet_ntop(AF_INET6, &a, buf, ADDR_SIZE);
+	if (rand() % 2)
+		sprintf(buf + strlen(buf), "/%d", rand() % 129);
+}
+
+static double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Parses the whole list rounds times, returns the number of failures */
+static int run(const char *name, parse_fn parse)
+{
+	unsigned char out[32];
+	double start, secs;
+	int i, r, bad = 0;
+
+	start = now();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < naddrs; i++) {
+			if (parse(addrs + i * ADDR_SIZE, out))
+				bad++;
+			sink += out[0] + out[5];
+		}
+	secs = now() - start;
+	printf("  %-28s %12.0f addresses/s\n", name,
+	       (double)naddrs * rounds / secs);
+	return bad / rounds;
+}
+
+/* Both parsers must agree on every address before their speed means much */
+static void compare(parse_fn ref, parse_fn parse, int size)
+{
+	unsigned char o1[32], o2[32];
+	int i, diff = 0;
+
+	for (i = 0; i < naddrs; i++) {
+		memset(o1, 0, sizeof(o1));
+		memset(o2, 0, sizeof(o2));
+		if (ref(addrs + i * ADDR_SIZE, o1) !=
+		    parse(addrs + i * ADDR_SIZE, o2) ||
+		    memcmp(o1, o2, size))
+			diff++;
+	}
+	if (diff)
+		printf("  %d addresses parsed differently\n", diff);
+}
+
+static void bench(const char *what, void (*gen)(char *buf), parse_fn ref,
+		  const char *ref_name, parse_fn ref2, const char *ref2_name,
+		  parse_fn parse, const char *name, int size)
+{
+	int i;
+
+	for (i = 0; i < naddrs; i++)
+		gen(addrs + i * ADDR_SIZE);
+	printf("%s:\n", what);
+	compare(ref, parse, size);
+	run(ref_name, ref);
+	if (ref2)
+		run(ref2_name, ref2);
+	run(name, parse);
+}
+
+int main(int argc, char *argv[])
+{
+	naddrs = argc > 1 ? atoi(argv[1]) : 1000000;
+	rounds = argc > 2 ? atoi(argv[2]) : 5;
+	if (naddrs <= 0 || rounds <= 0) {
+		fprintf(stderr, "usage: %s [number_of_addresses [rounds]]\n",
+			argv[0]);
+		return 1;
+	}
+	if (!(addrs = malloc((size_t)naddrs * ADDR_SIZE))) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	srand(1);
+	printf("%d addresses, %d rounds\n", naddrs, rounds);
+
+	bench("MAC addresses", gen_mac, old_mac, "ether_aton", NULL, NULL,
+	      new_mac, "ebt_scan_mac", ETH_ALEN);
+	bench("IPv4 addresses with masks", gen_ip, old_ip, "strtol per octet",
+	      pton_ip, "inet_pton", new_ip, "ebt_scan_ip(_mask)", 8);
+	bench("IPv6 addresses with prefixes", gen_ip6, old_ip6,
+	      "inet_pton", NULL, NULL, new_ip6, "ebt_scan_ip6(_mask)", 32);
+
+	free(addrs);
+	return 0;
+}
@@ -94,16 +94,18 @@ static void print(const struct ebt_u_entry *entry,
 	struct ebt_802_3_info *info = (struct ebt_802_3_info *)match->data;
 
 	if (info->bitmask & EBT_802_3_SAP) {
-		printf("--802_3-sap ");
+		ebt_out_str("--802_3-sap ");
 		if (info->invflags & EBT_802_3_SAP)
-			printf("! ");
-		printf("0x%.2x ", info->sap);
+			ebt_out_str("! ");
+		ebt_out_hex(info->sap, 2);
+		ebt_out_char(' ');
 	}
 	if (info->bitmask & EBT_802_3_TYPE) {
-		printf("--802_3-type ");
+		ebt_out_str("--802_3-type ");
 		if (info->invflags & EBT_802_3_TYPE)
-			printf("! ");
-		printf("0x%.4x ", ntohs(info->type));
+			ebt_out_str("! ");
+		ebt_out_hex(ntohs(info->type), 4);
+		ebt_out_char(' ');
 	}
 }
 
@@ -128,6 +130,19 @@ static int compare(const struct ebt_entry_match *m1,
 	return 1;
 }
 
+static unsigned int hash(const struct ebt_entry_match *m)
+{
+	struct ebt_802_3_info *info = (struct ebt_802_3_info *)m->data;
+	unsigned int h = EBT_HASH_INIT;
+
+	h = ebt_hash_field(h, info->bitmask);
+	if (info->bitmask & EBT_802_3_SAP)
+		h = ebt_hash_field(h, info->sap);
+	if (info->bitmask & EBT_802_3_TYPE)
+		h = ebt_hash_field(h, info->type);
+	return h;
+}
+
 static struct ebt_u_match _802_3_match = 
 {
 	.name		= "802_3",
@@ -138,6 +153,7 @@ static struct ebt_u_match _802_3_match =
 	.final_check	= final_check,
 	.print		= print,
 	.compare	= compare,
+	.hash		= hash,
 	.extra_ops	= opts,
 };
 
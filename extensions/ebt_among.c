@@ -25,12 +25,20 @@
 #define AMONG_SRC '2'
 #define AMONG_DST_F '3'
 #define AMONG_SRC_F '4'
+#define AMONG_DST_ADD '5'
+#define AMONG_SRC_ADD '6'
+#define AMONG_DST_DEL '7'
+#define AMONG_SRC_DEL '8'
 
 static struct option opts[] = {
 	{"among-dst", required_argument, 0, AMONG_DST},
 	{"among-src", required_argument, 0, AMONG_SRC},
 	{"among-dst-file", required_argument, 0, AMONG_DST_F},
 	{"among-src-file", required_argument, 0, AMONG_SRC_F},
+	{"among-dst-add", required_argument, 0, AMONG_DST_ADD},
+	{"among-src-add", required_argument, 0, AMONG_SRC_ADD},
+	{"among-dst-del", required_argument, 0, AMONG_DST_DEL},
+	{"among-src-del", required_argument, 0, AMONG_SRC_DEL},
 	{0}
 };
 
@@ -62,13 +70,23 @@ static void print_help()
 "list has form:\n"
 " xx:xx:xx:xx:xx:xx[=ip.ip.ip.ip],yy:yy:yy:yy:yy:yy[=ip.ip.ip.ip]"
 ",...,zz:zz:zz:zz:zz:zz[=ip.ip.ip.ip][,]\n"
-"Things in brackets are optional.\n"
+"Things in brackets are optional. In a file, the entries can also be\n"
+"put on separate lines.\n"
+"With --change-match, the lists of an existing rule can be changed:\n"
+"--among-dst-add  list          : add the entries to the dst list\n"
+"--among-src-add  list          : add the entries to the src list\n"
+"--among-dst-del  list          : remove the entries from the dst list\n"
+"--among-src-del  list          : remove the entries from the src list\n"
+"--among-dst and --among-src replace the list.\n"
 "If you want to allow two (or more) IP addresses to one MAC address, you\n"
 "can specify two (or more) pairs with the same MAC, e.g.\n"
 " 00:00:00:fa:eb:fe=153.19.120.250,00:00:00:fa:eb:fe=192.168.0.1\n"
 	);
 }
 static int old_size;
+/* Where parse() put the lists of --among-{dst,src}-{add,del}, in the order
+ * of the options above */
+static int change_ofs[4];
 
 static void init(struct ebt_entry_match *match)
 {
@@ -77,6 +95,7 @@ static void init(struct ebt_entry_match *match)
 
 	memset(amonginfo, 0, sizeof(struct ebt_among_info));
 	old_size = sizeof(struct ebt_among_info);
+	memset(change_ofs, 0, sizeof(change_ofs));
 }
 
 static struct ebt_mac_wormhash *new_wormhash(int n)
@@ -94,216 +113,134 @@ static struct ebt_mac_wormhash *new_wormhash(int n)
 	return result;
 }
 
-static void copy_wormhash(struct ebt_mac_wormhash *d,
-			  const struct ebt_mac_wormhash *s)
+/* Entries are separated by commas, newlines or other white space */
+static int is_separator(char c)
 {
-	int dpoolsize = d->poolsize;
-	int dsize, ssize, amount;
-
-	dsize = ebt_mac_wormhash_size(d);
-	ssize = ebt_mac_wormhash_size(s);
-	amount = dsize < ssize ? dsize : ssize;
-	memcpy(d, s, amount);
-	d->poolsize = dpoolsize;
+	return c == ',' || c == ' ' || c == '\n' || c == '\t' || c == '\r';
 }
 
-/* Returns:
- * -1 when '\0' reached
- * -2 when `n' bytes read and no delimiter found
- *  0 when no less than `n' bytes read and delimiter found
- * if `destbuf' is not NULL, it is filled by read bytes and ended with '\0'
- * *pp is set on the first byte not copied to `destbuf'
- */
-static int read_until(const char **pp, const char *delimiters,
-		      char *destbuf, int n)
+static void parse_error(const char *what, const char *anchor, const char *end)
 {
-	int count = 0;
-	int ret = 0;
-	char c;
+	int n = end - anchor < 20 ? end - anchor : 20;
 
-	while (1) {
-		c = **pp;
-		if (!c) {
-			ret = -1;
-			break;
-		}
-		if (strchr(delimiters, c)) {
-			ret = 0;
-			break;
-		}
-		if (count == n) {
-			ret = -2;
-			break;
-		}
-		if (destbuf)
-			destbuf[count++] = c;
-		(*pp)++;
-	}
-	if (destbuf)
-		destbuf[count] = 0;
-	return ret;
+	ebt_print_error("%s parse error: %.*s", what, n, anchor);
 }
 
-static int fcmp(const void *va, const void *vb) {
-	const struct ebt_mac_wormhash_tuple *a = va;
-	const struct ebt_mac_wormhash_tuple *b = vb;
-	int ca = ((const unsigned char*)a->cmp)[7];
-	int cb = ((const unsigned char*)b->cmp)[7];
-
-	return ca - cb;
+/* Parses xx:xx:xx:xx:xx:xx[=ip.ip.ip.ip] at *pp into tuple and puts *pp
+ * behind it, returns -1 on error. The list doesn't have to be '\0'
+ * terminated (a mapped file), so the scanning stops at end. */
+static int parse_tuple(const char **pp, const char *end,
+		       struct ebt_mac_wormhash_tuple *tuple)
+{
+	const char *pc = *pp, *anchor = pc;
+
+	tuple->cmp[0] = 0;
+	if (ebt_scan_mac(&pc, end, ((unsigned char *)tuple->cmp) + 2))
+		goto mac_error;
+	tuple->ip = 0;
+	if (pc != end && *pc == '=') {
+		anchor = ++pc;
+		if (ebt_scan_ip(&pc, end, &tuple->ip) ||
+		    (pc != end && !is_separator(*pc)))
+			goto ip_error;
+		if (!tuple->ip) {
+			ebt_print_error("Illegal IP 0.0.0.0");
+			return -1;
+		}
+	} else if (pc != end && !is_separator(*pc))
+		goto mac_error;
+	*pp = pc;
+	return 0;
+mac_error:
+	parse_error("MAC", anchor, end);
+	return -1;
+ip_error:
+	parse_error("IP", anchor, end);
+	return -1;
 }
 
-static void index_table(struct ebt_mac_wormhash *wh)
+static unsigned int hash_tuple(const struct ebt_mac_wormhash_tuple *t)
 {
-	int ipool, itable;
-	int c;
+	unsigned int h = t->cmp[0] * 0x9e3779b1U;
 
-	for (itable = 0; itable <= 256; itable++) {
-		wh->table[itable] = wh->poolsize;
-	}
-	ipool = 0;
-	itable = 0;
-	while (1) {
-		wh->table[itable] = ipool;
-		c = ((const unsigned char*)wh->pool[ipool].cmp)[7];
-		if (itable <= c) {
-			itable++;
-		} else {
-			ipool++;
-		}
-		if (ipool > wh->poolsize)
-			break;
-	}
+	h = (h ^ t->cmp[1]) * 0x9e3779b1U;
+	h = (h ^ t->ip) * 0x9e3779b1U;
+	return h ^ (h >> 16);
 }
 
-static struct ebt_mac_wormhash *create_wormhash(const char *arg)
-{
-	const char *pc = arg;
-	const char *anchor;
-	char *endptr;
-	struct ebt_mac_wormhash *workcopy, *result, *h;
-	unsigned char mac[6];
-	unsigned char ip[4];
-	int nmacs = 0;
-	int i;
-	char token[4];
+/* The hash value of an entry is the last byte of its MAC */
+#define WH_KEY(t) (((const unsigned char *)(t)->cmp)[7])
 
-	if (!(workcopy = new_wormhash(1024))) {
+/* Builds the wormhash from the list arg of len bytes. Duplicate entries are
+ * left out, the entries are put in the pool in the order of their hash value
+ * with a counting sort, entries with the same hash value keep the order of
+ * the list. */
+static struct ebt_mac_wormhash *create_wormhash(const char *arg, size_t len)
+{
+	const char *pc = arg, *end = arg + len;
+	struct ebt_mac_wormhash_tuple *tuples;
+	struct ebt_mac_wormhash *result;
+	unsigned int *seen, mask, h, n = 0, nmacs = 0, i, j;
+	int pos[256];
+
+	/* An entry takes at least 12 bytes, counting the separator */
+	tuples = (struct ebt_mac_wormhash_tuple *)
+	   malloc(((len + 1) / 12 + 1) * sizeof(struct ebt_mac_wormhash_tuple));
+	if (!tuples)
 		ebt_print_memory();
-	}
 	while (1) {
-		/* remember current position, we'll need it on error */
-		anchor = pc;
-
-		/* collect MAC; all its bytes are followed by ':' (colon),
-		 * except for the last one which can be followed by 
-		 * ',' (comma), '=' or '\0' */
-		for (i = 0; i < 5; i++) {
-			if (read_until(&pc, ":", token, 2) < 0
-			    || token[0] == 0) {
-				ebt_print_error("MAC parse error: %.20s", anchor);
-				free(workcopy);
-				return NULL;
-			}
-			mac[i] = strtol(token, &endptr, 16);
-			if (*endptr) {
-				ebt_print_error("MAC parse error: %.20s", anchor);
-				free(workcopy);
-				return NULL;
-			}
+		while (pc != end && is_separator(*pc))
 			pc++;
-		}
-		if (read_until(&pc, "=,", token, 2) == -2 || token[0] == 0) {
-			ebt_print_error("MAC parse error: %.20s", anchor);
-			return NULL;
-		}
-		mac[i] = strtol(token, &endptr, 16);
-		if (*endptr) {
-			ebt_print_error("MAC parse error: %.20s", anchor);
-			return NULL;
-		}
-		if (*pc == '=') {
-			/* an IP follows the MAC; collect similarly to MAC */
-			pc++;
-			anchor = pc;
-			for (i = 0; i < 3; i++) {
-				if (read_until(&pc, ".", token, 3) < 0 || token[0] == 0) {
-					ebt_print_error("IP parse error: %.20s", anchor);
-					return NULL;
-				}
-				ip[i] = strtol(token, &endptr, 10);
-				if (*endptr) {
-					ebt_print_error("IP parse error: %.20s", anchor);
-					return NULL;
-				}
-				pc++;
-			}
-			if (read_until(&pc, ",", token, 3) == -2 || token[0] == 0) {
-				ebt_print_error("IP parse error: %.20s", anchor);
-				return NULL;
-			}
-			ip[3] = strtol(token, &endptr, 10);
-			if (*endptr) {
-				ebt_print_error("IP parse error: %.20s", anchor);
-				return NULL;
-			}
-			if (ip[0] == 0 && ip[1] == 0 && ip[2] == 0 && ip[3] == 0) {
-				ebt_print_error("Illegal IP 0.0.0.0");
-				return NULL;
-			}
-		} else {
-			/* no IP, we set it to 0.0.0.0 */
-			memset(ip, 0, 4);
-		}
-
-		/* we have collected MAC and IP, so we add an entry */
-		memcpy(((char *) workcopy->pool[nmacs].cmp) + 2, mac, 6);
-		memcpy(&(workcopy->pool[nmacs].ip), ip, 4);
-		nmacs++;
-
-		/* re-allocate memory if needed */
-		if (*pc && nmacs >= workcopy->poolsize) {
-			if (!(h = new_wormhash(nmacs * 2))) {
-				ebt_print_memory();
-			}
-			copy_wormhash(h, workcopy);
-			free(workcopy);
-			workcopy = h;
-		}
-
-		/* check if end of string was reached */
-		if (!*pc) {
+		if (pc == end)
 			break;
-		}
-
-		/* now `pc' points to comma if we are here; */
-		/* increment this to the next char */
-		/* but first assert :-> */
-		if (*pc != ',') {
-			ebt_print_error("Something went wrong; no comma...\n");
+		if (parse_tuple(&pc, end, &tuples[n])) {
+			free(tuples);
 			return NULL;
 		}
-		pc++;
-
-		/* again check if end of string was reached; */
-		/* we allow an ending comma */
-		if (!*pc) {
-			break;
-		}
+		n++;
 	}
-	if (!(result = new_wormhash(nmacs))) {
+	if (!n) {
+		parse_error("MAC", arg, end);
+		free(tuples);
+		return NULL;
+	}
+
+	/* Leave out the duplicates, seen holds indexes + 1 in tuples */
+	for (mask = 1; mask < 2 * n; mask <<= 1);
+	seen = (unsigned int *)calloc(mask--, sizeof(unsigned int));
+	if (!seen)
 		ebt_print_memory();
+	memset(pos, 0, sizeof(pos));
+	for (i = 0; i < n; i++) {
+		for (h = hash_tuple(&tuples[i]) & mask; (j = seen[h]);
+		     h = (h + 1) & mask)
+			if (!memcmp(&tuples[j - 1], &tuples[i],
+			    sizeof(struct ebt_mac_wormhash_tuple)))
+				break;
+		if (j)
+			continue;
+		tuples[nmacs] = tuples[i];
+		seen[h] = ++nmacs;
+		pos[WH_KEY(&tuples[i])]++;
+	}
+	free(seen);
+
+	result = new_wormhash(nmacs);
+	for (i = 0, j = 0; i < 256; i++) {
+		result->table[i] = j;
+		j += pos[i];
+		pos[i] = result->table[i];
 	}
-	copy_wormhash(result, workcopy);
-	free(workcopy);
-	qsort(&result->pool, result->poolsize,
-			sizeof(struct ebt_mac_wormhash_tuple), fcmp);
-	index_table(result);
+	result->table[256] = nmacs;
+	for (i = 0; i < nmacs; i++)
+		result->pool[pos[WH_KEY(&tuples[i])]++] = tuples[i];
+	free(tuples);
 	return result;
 }
 
 #define OPT_DST 0x01
 #define OPT_SRC 0x02
+#define OPT_CHANGE 0x04 /* 4 bits, one for each of the change_ofs */
 static int parse(int c, char **argv, int argc,
 		 const struct ebt_u_entry *entry, unsigned int *flags,
 		 struct ebt_entry_match **match)
@@ -313,10 +250,23 @@ static int parse(int c, char **argv, int argc,
 	struct ebt_mac_wormhash *wh;
 	struct ebt_entry_match *h;
 	int new_size;
-	long flen = 0;
+	size_t flen;
+	const char *list;
 	int fd = -1;
 
 	switch (c) {
+	case AMONG_DST_ADD:
+	case AMONG_SRC_ADD:
+	case AMONG_DST_DEL:
+	case AMONG_SRC_DEL:
+		ebt_check_option2(flags, OPT_CHANGE << (c - AMONG_DST_ADD));
+		if (ebt_check_inverse2(optarg))
+			ebt_print_error2("Unexpected '!' after --among-%s-%s",
+			   (c - AMONG_DST_ADD) % 2 ? "src" : "dst",
+			   c < AMONG_DST_DEL ? "add" : "del");
+		list = optarg;
+		flen = strlen(optarg);
+		goto create;
 	case AMONG_DST_F:
 	case AMONG_SRC_F:
 	case AMONG_DST:
@@ -336,25 +286,29 @@ static int parse(int c, char **argv, int argc,
 			struct stat stats;
 
 			if ((fd = open(optarg, O_RDONLY)) == -1)
-				ebt_print_error("Couldn't open file '%s'", optarg);
+				ebt_print_error2("Couldn't open file '%s'", optarg);
 			fstat(fd, &stats);
 			flen = stats.st_size;
 			/* use mmap because the file will probably be big */
-			optarg = mmap(0, flen, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
-			if (optarg == MAP_FAILED)
-				ebt_print_error("Couldn't map file to memory");
-			if (optarg[flen-1] != '\n')
-				ebt_print_error("File should end with a newline");
-			if (strchr(optarg, '\n') != optarg+flen-1)
-				ebt_print_error("File should only contain one line");
-			optarg[flen-1] = '\0';
-			if (ebt_errormsg[0] != '\0') {
-				munmap(argv, flen);
+			list = "";
+			if (flen)
+				list = mmap(0, flen, PROT_READ, MAP_PRIVATE,
+					    fd, 0);
+			if (list == MAP_FAILED) {
 				close(fd);
-				exit(-1);
+				ebt_print_error2("Couldn't map file to memory");
 			}
+		} else {
+			list = optarg;
+			flen = strlen(optarg);
+		}
+create:
+		wh = create_wormhash(list, flen);
+		if (fd != -1) {
+			if (flen)
+				munmap((void *)list, flen);
+			close(fd);
 		}
-		wh = create_wormhash(optarg);
 		if (ebt_errormsg[0] != '\0')
 			break;
 
@@ -367,7 +321,9 @@ static int parse(int c, char **argv, int argc,
 		       ebt_mac_wormhash_size(wh));
 		h->match_size = EBT_ALIGN(new_size);
 		info = (struct ebt_among_info *) h->data;
-		if (c == AMONG_DST || c == AMONG_DST_F) {
+		if (c >= AMONG_DST_ADD) {
+			change_ofs[c - AMONG_DST_ADD] = old_size;
+		} else if (c == AMONG_DST || c == AMONG_DST_F) {
 			info->wh_dst_ofs = old_size;
 		} else {
 			info->wh_src_ofs = old_size;
@@ -376,10 +332,6 @@ static int parse(int c, char **argv, int argc,
 		free(*match);
 		*match = h;
 		free(wh);
-		if (c == AMONG_DST_F || c == AMONG_SRC_F) {
-			munmap(argv, flen);
-			close(fd);
-		}
 		break;
 	default:
 		return 0;
@@ -392,6 +344,9 @@ static void final_check(const struct ebt_u_entry *entry,
 			const char *name, unsigned int hookmask,
 			unsigned int time)
 {
+	if (change_ofs[0] || change_ofs[1] || change_ofs[2] || change_ofs[3])
+		ebt_print_error("--among-{dst,src}-{add,del} can only be "
+				"used with --change-match");
 }
 
 #ifdef DEBUG
@@ -413,7 +368,6 @@ static void wormhash_debug(const struct ebt_mac_wormhash *wh)
 static void wormhash_printout(const struct ebt_mac_wormhash *wh)
 {
 	int i;
-	unsigned char *ip;
 
 	for (i = 0; i < wh->poolsize; i++) {
 		const struct ebt_mac_wormhash_tuple *p;
@@ -421,12 +375,12 @@ static void wormhash_printout(const struct ebt_mac_wormhash *wh)
 		p = (const struct ebt_mac_wormhash_tuple *)(&wh->pool[i]);
 		ebt_print_mac(((const unsigned char *) &p->cmp[0]) + 2);
 		if (p->ip) {
-			ip = (unsigned char *) &p->ip;
-			printf("=%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+			ebt_out_char('=');
+			ebt_out_ip(p->ip);
 		}
-		printf(",");
+		ebt_out_char(',');
 	}
-	printf(" ");
+	ebt_out_char(' ');
 }
 
 static void print(const struct ebt_u_entry *entry,
@@ -435,16 +389,16 @@ static void print(const struct ebt_u_entry *entry,
 	struct ebt_among_info *info = (struct ebt_among_info *)match->data;
 
 	if (info->wh_dst_ofs) {
-		printf("--among-dst ");
-		if (info->bitmask && EBT_AMONG_DST_NEG) {
-			printf("! ");
+		ebt_out_str("--among-dst ");
+		if (info->bitmask & EBT_AMONG_DST_NEG) {
+			ebt_out_str("! ");
 		}
 		wormhash_printout(ebt_among_wh_dst(info));
 	}
 	if (info->wh_src_ofs) {
-		printf("--among-src ");
-		if (info->bitmask && EBT_AMONG_SRC_NEG) {
-			printf("! ");
+		ebt_out_str("--among-src ");
+		if (info->bitmask & EBT_AMONG_SRC_NEG) {
+			ebt_out_str("! ");
 		}
 		wormhash_printout(ebt_among_wh_src(info));
 	}
@@ -479,6 +433,135 @@ static int compare(const struct ebt_entry_match *m1,
 	return 1;
 }
 
+/* Returns 1 if tuple t is in bucket b of wh */
+static int in_bucket(const struct ebt_mac_wormhash *wh, int b,
+		     const struct ebt_mac_wormhash_tuple *t)
+{
+	int i;
+
+	for (i = wh->table[b]; i < wh->table[b + 1]; i++)
+		if (!memcmp(&wh->pool[i], t,
+		    sizeof(struct ebt_mac_wormhash_tuple)))
+			return 1;
+	return 0;
+}
+
+/* Returns a copy of old (which can be NULL) without the entries of del and
+ * with the entries of add. Only the buckets are copied, the entries of
+ * old keep their order. */
+static struct ebt_mac_wormhash *update_wormhash(
+   const struct ebt_mac_wormhash *old, const struct ebt_mac_wormhash *add,
+   const struct ebt_mac_wormhash *del, const char *dir)
+{
+	struct ebt_mac_wormhash *result;
+	const struct ebt_mac_wormhash_tuple *t;
+	const unsigned char *ip;
+	int b, i, j, n = 0, start;
+	char ipstr[20];
+
+	result = new_wormhash((old ? old->poolsize : 0) +
+			      (add ? add->poolsize : 0));
+	for (b = 0; b < 256; b++) {
+		result->table[b] = start = n;
+		for (i = del ? del->table[b] : 0;
+		     del && i < del->table[b + 1]; i++) {
+			t = &del->pool[i];
+			if (old && in_bucket(old, b, t))
+				continue;
+			ip = (const unsigned char *)&t->ip;
+			ipstr[0] = '\0';
+			if (t->ip)
+				sprintf(ipstr, "=%u.%u.%u.%u", ip[0], ip[1],
+					ip[2], ip[3]);
+			ebt_print_error("%s%s is not in the among-%s list",
+			   ether_ntoa((const struct ether_addr *)
+			   (((const char *)t->cmp) + 2)), ipstr, dir);
+			free(result);
+			return NULL;
+		}
+		for (i = old ? old->table[b] : 0;
+		     old && i < old->table[b + 1]; i++)
+			if (!del || !in_bucket(del, b, &old->pool[i]))
+				result->pool[n++] = old->pool[i];
+		for (i = add ? add->table[b] : 0;
+		     add && i < add->table[b + 1]; i++) {
+			for (j = start; j < n; j++)
+				if (!memcmp(&result->pool[j], &add->pool[i],
+				    sizeof(struct ebt_mac_wormhash_tuple)))
+					break;
+			if (j == n)
+				result->pool[n++] = add->pool[i];
+		}
+	}
+	result->table[256] = result->poolsize = n;
+	if (!n) {
+		ebt_print_error("The among-%s list can't become empty", dir);
+		free(result);
+		return NULL;
+	}
+	return result;
+}
+
+/* See ebt_u_match.change */
+static struct ebt_entry_match *change(const struct ebt_entry_match *m,
+				      const struct ebt_entry_match *chg)
+{
+	struct ebt_among_info *info = (struct ebt_among_info *)m->data;
+	struct ebt_among_info *cinfo = (struct ebt_among_info *)chg->data;
+	struct ebt_mac_wormhash *wh[2], *old, *add, *del;
+	struct ebt_entry_match *result;
+	struct ebt_among_info *rinfo;
+	int i, size, ofs, neg, bitmask = info->bitmask;
+
+	for (i = 0; i < 2; i++) {
+		neg = i ? EBT_AMONG_SRC_NEG : EBT_AMONG_DST_NEG;
+		old = i ? ebt_among_wh_src(info) : ebt_among_wh_dst(info);
+		/* --among-dst or --among-src replaces the list */
+		if ((ofs = i ? cinfo->wh_src_ofs : cinfo->wh_dst_ofs)) {
+			old = (struct ebt_mac_wormhash *)((char *)cinfo + ofs);
+			bitmask = (bitmask & ~neg) | (cinfo->bitmask & neg);
+		}
+		add = change_ofs[i] ? (struct ebt_mac_wormhash *)
+		   ((char *)cinfo + change_ofs[i]) : NULL;
+		del = change_ofs[i + 2] ? (struct ebt_mac_wormhash *)
+		   ((char *)cinfo + change_ofs[i + 2]) : NULL;
+		wh[i] = NULL;
+		if (old || add || del) {
+			wh[i] = update_wormhash(old, add, del,
+						i ? "src" : "dst");
+			if (!wh[i]) {
+				if (i)
+					free(wh[0]);
+				return NULL;
+			}
+		}
+	}
+
+	size = sizeof(struct ebt_among_info) + ebt_mac_wormhash_size(wh[0]) +
+	       ebt_mac_wormhash_size(wh[1]);
+	result = malloc(sizeof(struct ebt_entry_match) + EBT_ALIGN(size));
+	if (!result)
+		ebt_print_memory();
+	memset(result, 0, sizeof(struct ebt_entry_match) + EBT_ALIGN(size));
+	strcpy(result->u.name, m->u.name);
+	result->match_size = EBT_ALIGN(size);
+	rinfo = (struct ebt_among_info *)result->data;
+	rinfo->bitmask = bitmask;
+	ofs = sizeof(struct ebt_among_info);
+	if (wh[0]) {
+		rinfo->wh_dst_ofs = ofs;
+		memcpy((char *)rinfo + ofs, wh[0], ebt_mac_wormhash_size(wh[0]));
+		ofs += ebt_mac_wormhash_size(wh[0]);
+	}
+	if (wh[1]) {
+		rinfo->wh_src_ofs = ofs;
+		memcpy((char *)rinfo + ofs, wh[1], ebt_mac_wormhash_size(wh[1]));
+	}
+	free(wh[0]);
+	free(wh[1]);
+	return result;
+}
+
 static struct ebt_u_match among_match = {
 	.name 		= "among",
 	.size 		= sizeof(struct ebt_among_info),
@@ -488,6 +571,7 @@ static struct ebt_u_match among_match = {
 	.final_check 	= final_check,
 	.print 		= print,
 	.compare 	= compare,
+	.change 	= change,
 	.extra_ops 	= opts,
 };
 
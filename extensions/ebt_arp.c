@@ -231,72 +231,70 @@ static void print(const struct ebt_u_entry *entry,
    const struct ebt_entry_match *match)
 {
 	struct ebt_arp_info *arpinfo = (struct ebt_arp_info *)match->data;
-	int i;
 
 	if (arpinfo->bitmask & EBT_ARP_OPCODE) {
 		int opcode = ntohs(arpinfo->opcode);
-		printf("--arp-op ");
+		ebt_out_str("--arp-op ");
 		if (arpinfo->invflags & EBT_ARP_OPCODE)
-			printf("! ");
+			ebt_out_str("! ");
 		if (opcode > 0 && opcode <= NUMOPCODES)
-			printf("%s ", opcodes[opcode - 1]);
+			ebt_out_str(opcodes[opcode - 1]);
 		else
-			printf("%d ", opcode);
+			ebt_out_unsigned(opcode);
+		ebt_out_char(' ');
 	}
 	if (arpinfo->bitmask & EBT_ARP_HTYPE) {
-		printf("--arp-htype ");
+		ebt_out_str("--arp-htype ");
 		if (arpinfo->invflags & EBT_ARP_HTYPE)
-			printf("! ");
-		printf("%d ", ntohs(arpinfo->htype));
+			ebt_out_str("! ");
+		ebt_out_unsigned(ntohs(arpinfo->htype));
+		ebt_out_char(' ');
 	}
 	if (arpinfo->bitmask & EBT_ARP_PTYPE) {
 		struct ethertypeent *ent;
 
-		printf("--arp-ptype ");
+		ebt_out_str("--arp-ptype ");
 		if (arpinfo->invflags & EBT_ARP_PTYPE)
-			printf("! ");
+			ebt_out_str("! ");
 		ent = getethertypebynumber(ntohs(arpinfo->ptype));
 		if (!ent)
-			printf("0x%x ", ntohs(arpinfo->ptype));
+			ebt_out_hex(ntohs(arpinfo->ptype), 0);
 		else
-			printf("%s ", ent->e_name);
+			ebt_out_str(ent->e_name);
+		ebt_out_char(' ');
 	}
 	if (arpinfo->bitmask & EBT_ARP_SRC_IP) {
-		printf("--arp-ip-src ");
+		ebt_out_str("--arp-ip-src ");
 		if (arpinfo->invflags & EBT_ARP_SRC_IP)
-			printf("! ");
-		for (i = 0; i < 4; i++)
-			printf("%d%s", ((unsigned char *)&arpinfo->saddr)[i],
-			   (i == 3) ? "" : ".");
-		printf("%s ", ebt_mask_to_dotted(arpinfo->smsk));
+			ebt_out_str("! ");
+		ebt_out_ip_and_mask(arpinfo->saddr, arpinfo->smsk);
+		ebt_out_char(' ');
 	}
 	if (arpinfo->bitmask & EBT_ARP_DST_IP) {
-		printf("--arp-ip-dst ");
+		ebt_out_str("--arp-ip-dst ");
 		if (arpinfo->invflags & EBT_ARP_DST_IP)
-			printf("! ");
-		for (i = 0; i < 4; i++)
-			printf("%d%s", ((unsigned char *)&arpinfo->daddr)[i],
-			   (i == 3) ? "" : ".");
-		printf("%s ", ebt_mask_to_dotted(arpinfo->dmsk));
+			ebt_out_str("! ");
+		ebt_out_ip_and_mask(arpinfo->daddr, arpinfo->dmsk);
+		ebt_out_char(' ');
 	}
 	if (arpinfo->bitmask & EBT_ARP_SRC_MAC) {
-		printf("--arp-mac-src ");
+		ebt_out_str("--arp-mac-src ");
 		if (arpinfo->invflags & EBT_ARP_SRC_MAC)
-			printf("! ");
+			ebt_out_str("! ");
 		ebt_print_mac_and_mask(arpinfo->smaddr, arpinfo->smmsk);
-		printf(" ");
+		ebt_out_char(' ');
 	}
 	if (arpinfo->bitmask & EBT_ARP_DST_MAC) {
-		printf("--arp-mac-dst ");
+		ebt_out_str("--arp-mac-dst ");
 		if (arpinfo->invflags & EBT_ARP_DST_MAC)
-			printf("! ");
+			ebt_out_str("! ");
 		ebt_print_mac_and_mask(arpinfo->dmaddr, arpinfo->dmmsk);
-		printf(" ");
+		ebt_out_char(' ');
 	}
 	if (arpinfo->bitmask & EBT_ARP_GRAT) {
 		if (arpinfo->invflags & EBT_ARP_GRAT)
-			printf("! ");
-		printf("--arp-gratuitous ");
+			ebt_out_str("! ");
+		ebt_out_str("--arp-gratuitous ");
 	}
 }
 
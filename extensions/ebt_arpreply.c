@@ -53,14 +53,12 @@ static int parse(int c, char **argv, int argc,
 {
 	struct ebt_arpreply_info *replyinfo =
 	   (struct ebt_arpreply_info *)(*target)->data;
-	struct ether_addr *addr;
 
 	switch (c) {
 	case REPLY_MAC:
 		ebt_check_option2(flags, OPT_REPLY_MAC);
-		if (!(addr = ether_aton(optarg)))
+		if (ebt_get_mac(optarg, replyinfo->mac))
 			ebt_print_error2("Problem with specified --arpreply-mac mac");
-		memcpy(replyinfo->mac, addr, ETH_ALEN);
 		mac_supplied = 1;
 		break;
 	case REPLY_TARGET:
@@ -101,11 +99,14 @@ static void print(const struct ebt_u_entry *entry,
 	struct ebt_arpreply_info *replyinfo =
 	   (struct ebt_arpreply_info *)target->data;
 
-	printf("--arpreply-mac ");
+	ebt_out_str("--arpreply-mac ");
 	ebt_print_mac(replyinfo->mac);
+	ebt_out_char(' ');
 	if (replyinfo->target == EBT_DROP)
 		return;
-	printf(" --arpreply-target %s", TARGET_NAME(replyinfo->target));
+	ebt_out_str("--arpreply-target ");
+	ebt_out_str(TARGET_NAME(replyinfo->target));
+	ebt_out_char(' ');
 }
 
 static int compare(const struct ebt_entry_target *t1,
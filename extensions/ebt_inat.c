@@ -302,17 +302,17 @@ static void print_list(const struct ebt_inat_info *info)
 	int i;
 	for (i = 0; i < 256; i++) {
 		if (info->a[i].enabled) {
-			printf("%d=", i);
+			ebt_out_printf("%d=", i);
 			if (info->a[i].target == EBT_DROP) {
-				printf("_");
+				ebt_out_char('_');
 			}
 			else {
 				if (info->a[i].target == EBT_ACCEPT) {
-					printf("+");
+					ebt_out_char('+');
 				}
 				print_mac(info->a[i].mac);
 			}
-			printf(",");
+			ebt_out_char(',');
 		}
 	}
 }
@@ -324,10 +324,10 @@ static void print_s(const struct ebt_u_entry *entry,
 
 	unsigned char sub[4];
 	*(uint32_t*)sub = info->ip_subnet;
-	printf("--isnat-sub %u.%u.%u.0/24", sub[0], sub[1], sub[2]);
-	printf(" --isnat-list ");
+	ebt_out_printf("--isnat-sub %u.%u.%u.0/24", sub[0], sub[1], sub[2]);
+	ebt_out_str(" --isnat-list ");
 	print_list(info);
-	printf(" --isnat-default-target %s", TARGET_NAME(info->target));
+	ebt_out_printf(" --isnat-default-target %s ", TARGET_NAME(info->target));
 }
 
 static void print_d(const struct ebt_u_entry *entry,
@@ -337,10 +337,10 @@ static void print_d(const struct ebt_u_entry *entry,
 
 	unsigned char sub[4];
 	*(uint32_t*)sub = info->ip_subnet;
-	printf("--idnat-sub %u.%u.%u.0/24", sub[0], sub[1], sub[2]);
-	printf(" --idnat-list ");
+	ebt_out_printf("--idnat-sub %u.%u.%u.0/24", sub[0], sub[1], sub[2]);
+	ebt_out_str(" --idnat-list ");
 	print_list(info);
-	printf(" --idnat-default-target %s", TARGET_NAME(info->target));
+	ebt_out_printf(" --idnat-default-target %s ", TARGET_NAME(info->target));
 }
 
 static int compare(const struct ebt_entry_target *t1,
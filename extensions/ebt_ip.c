@@ -90,10 +90,12 @@ parse_port_range(const char *protocol, const char *portstring, uint16_t *ports)
 
 static void print_port_range(uint16_t *ports)
 {
-	if (ports[0] == ports[1])
-		printf("%d ", ports[0]);
-	else
-		printf("%d:%d ", ports[0], ports[1]);
+	ebt_out_unsigned(ports[0]);
+	if (ports[0] != ports[1]) {
+		ebt_out_char(':');
+		ebt_out_unsigned(ports[1]);
+	}
+	ebt_out_char(' ');
 }
 
 static void print_help()
@@ -229,55 +231,50 @@ static void print(const struct ebt_u_entry *entry,
    const struct ebt_entry_match *match)
 {
 	struct ebt_ip_info *ipinfo = (struct ebt_ip_info *)match->data;
-	int j;
 
 	if (ipinfo->bitmask & EBT_IP_SOURCE) {
-		printf("--ip-src ");
+		ebt_out_str("--ip-src ");
 		if (ipinfo->invflags & EBT_IP_SOURCE)
-			printf("! ");
-		for (j = 0; j < 4; j++)
-			printf("%d%s",((unsigned char *)&ipinfo->saddr)[j],
-			   (j == 3) ? "" : ".");
-		printf("%s ", ebt_mask_to_dotted(ipinfo->smsk));
+			ebt_out_str("! ");
+		ebt_out_ip_and_mask(ipinfo->saddr, ipinfo->smsk);
+		ebt_out_char(' ');
 	}
 	if (ipinfo->bitmask & EBT_IP_DEST) {
-		printf("--ip-dst ");
+		ebt_out_str("--ip-dst ");
 		if (ipinfo->invflags & EBT_IP_DEST)
-			printf("! ");
-		for (j = 0; j < 4; j++)
-			printf("%d%s", ((unsigned char *)&ipinfo->daddr)[j],
-			   (j == 3) ? "" : ".");
-		printf("%s ", ebt_mask_to_dotted(ipinfo->dmsk));
+			ebt_out_str("! ");
+		ebt_out_ip_and_mask(ipinfo->daddr, ipinfo->dmsk);
+		ebt_out_char(' ');
 	}
 	if (ipinfo->bitmask & EBT_IP_TOS) {
-		printf("--ip-tos ");
+		ebt_out_str("--ip-tos ");
 		if (ipinfo->invflags & EBT_IP_TOS)
-			printf("! ");
-		printf("0x%02X ", ipinfo->tos);
+			ebt_out_str("! ");
+		ebt_out_printf("0x%02X ", ipinfo->tos);
 	}
 	if (ipinfo->bitmask & EBT_IP_PROTO) {
 		struct protoent *pe;
 
-		printf("--ip-proto ");
+		ebt_out_str("--ip-proto ");
 		if (ipinfo->invflags & EBT_IP_PROTO)
-			printf("! ");
+			ebt_out_str("! ");
 		pe = getprotobynumber(ipinfo->protocol);
-		if (pe == NULL) {
-			printf("%d ", ipinfo->protocol);
-		} else {
-			printf("%s ", pe->p_name);
-		}
+		if (pe == NULL)
+			ebt_out_unsigned(ipinfo->protocol);
+		else
+			ebt_out_str(pe->p_name);
+		ebt_out_char(' ');
 	}
 	if (ipinfo->bitmask & EBT_IP_SPORT) {
-		printf("--ip-sport ");
+		ebt_out_str("--ip-sport ");
 		if (ipinfo->invflags & EBT_IP_SPORT)
-			printf("! ");
+			ebt_out_str("! ");
 		print_port_range(ipinfo->sport);
 	}
 	if (ipinfo->bitmask & EBT_IP_DPORT) {
-		printf("--ip-dport ");
+		ebt_out_str("--ip-dport ");
 		if (ipinfo->invflags & EBT_IP_DPORT)
-			printf("! ");
+			ebt_out_str("! ");
 		print_port_range(ipinfo->dport);
 	}
 }
@@ -325,6 +322,24 @@ static int compare(const struct ebt_entry_match *m1,
 	return 1;
 }
 
+static unsigned int hash(const struct ebt_entry_match *m)
+{
+	struct ebt_ip_info *ipinfo = (struct ebt_ip_info *)m->data;
+	unsigned int h = EBT_HASH_INIT;
+
+	h = ebt_hash_field(h, ipinfo->bitmask);
+	h = ebt_hash_field(h, ipinfo->invflags);
+	if (ipinfo->bitmask & EBT_IP_SOURCE)
+		h = ebt_hash_field(h, ipinfo->saddr);
+	if (ipinfo->bitmask & EBT_IP_DEST)
+		h = ebt_hash_field(h, ipinfo->daddr);
+	if (ipinfo->bitmask & EBT_IP_PROTO)
+		h = ebt_hash_field(h, ipinfo->protocol);
+	if (ipinfo->bitmask & EBT_IP_DPORT)
+		h = ebt_hash_field(h, ipinfo->dport);
+	return h;
+}
+
 static struct ebt_u_match ip_match =
 {
 	.name		= "ip",
@@ -335,6 +350,7 @@ static struct ebt_u_match ip_match =
 	.final_check	= final_check,
 	.print		= print,
 	.compare	= compare,
+	.hash		= hash,
 	.extra_ops	= opts,
 };
 
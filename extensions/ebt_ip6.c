@@ -12,7 +12,6 @@
  */
 
 #include <errno.h>
-#include <inttypes.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -234,18 +233,23 @@ parse_icmpv6(const char *icmpv6type, uint8_t type[], uint8_t code[])
 
 static void print_port_range(uint16_t *ports)
 {
-	if (ports[0] == ports[1])
-		printf("%d ", ports[0]);
-	else
-		printf("%d:%d ", ports[0], ports[1]);
+	ebt_out_unsigned(ports[0]);
+	if (ports[0] != ports[1]) {
+		ebt_out_char(':');
+		ebt_out_unsigned(ports[1]);
+	}
+	ebt_out_char(' ');
 }
 
 static void print_icmp_code(uint8_t *code)
 {
-	if (code[0] == code[1])
-		printf("/%"PRIu8 " ", code[0]);
-	else
-		printf("/%"PRIu8":%"PRIu8 " ", code[0], code[1]);
+	ebt_out_char('/');
+	ebt_out_unsigned(code[0]);
+	if (code[0] != code[1]) {
+		ebt_out_char(':');
+		ebt_out_unsigned(code[1]);
+	}
+	ebt_out_char(' ');
 }
 
 static void print_icmp_type(uint8_t *type, uint8_t *code)
@@ -253,7 +257,9 @@ static void print_icmp_type(uint8_t *type, uint8_t *code)
 	unsigned int i;
 
 	if (type[0] != type[1]) {
-		printf("%"PRIu8 ":%" PRIu8, type[0], type[1]);
+		ebt_out_unsigned(type[0]);
+		ebt_out_char(':');
+		ebt_out_unsigned(type[1]);
 		print_icmp_code(code);
 		return;
 	}
@@ -264,11 +270,12 @@ static void print_icmp_type(uint8_t *type, uint8_t *code)
 
 		if (icmpv6_codes[i].code_min == code[0] &&
 		    icmpv6_codes[i].code_max == code[1]) {
-			printf("%s ", icmpv6_codes[i].name);
+			ebt_out_str(icmpv6_codes[i].name);
+			ebt_out_char(' ');
 			return;
 		}
 	}
-	printf("%"PRIu8, type[0]);
+	ebt_out_unsigned(type[0]);
 	print_icmp_code(code);
 }
 
@@ -441,54 +448,58 @@ static void print(const struct ebt_u_entry *entry,
 	struct ebt_ip6_info *ipinfo = (struct ebt_ip6_info *)match->data;
 
 	if (ipinfo->bitmask & EBT_IP6_SOURCE) {
-		printf("--ip6-src ");
+		ebt_out_str("--ip6-src ");
 		if (ipinfo->invflags & EBT_IP6_SOURCE)
-			printf("! ");
-		printf("%s", ebt_ip6_to_numeric(&ipinfo->saddr));
-		printf("/%s ", ebt_ip6_to_numeric(&ipinfo->smsk));
+			ebt_out_str("! ");
+		ebt_out_ip6(&ipinfo->saddr);
+		ebt_out_char('/');
+		ebt_out_ip6(&ipinfo->smsk);
+		ebt_out_char(' ');
 	}
 	if (ipinfo->bitmask & EBT_IP6_DEST) {
-		printf("--ip6-dst ");
+		ebt_out_str("--ip6-dst ");
 		if (ipinfo->invflags & EBT_IP6_DEST)
-			printf("! ");
-		printf("%s", ebt_ip6_to_numeric(&ipinfo->daddr));
-		printf("/%s ", ebt_ip6_to_numeric(&ipinfo->dmsk));
+			ebt_out_str("! ");
+		ebt_out_ip6(&ipinfo->daddr);
+		ebt_out_char('/');
+		ebt_out_ip6(&ipinfo->dmsk);
+		ebt_out_char(' ');
 	}
 	if (ipinfo->bitmask & EBT_IP6_TCLASS) {
-		printf("--ip6-tclass ");
+		ebt_out_str("--ip6-tclass ");
 		if (ipinfo->invflags & EBT_IP6_TCLASS)
-			printf("! ");
-		printf("0x%02X ", ipinfo->tclass);
+			ebt_out_str("! ");
+		ebt_out_printf("0x%02X ", ipinfo->tclass);
 	}
 	if (ipinfo->bitmask & EBT_IP6_PROTO) {
 		struct protoent *pe;
 
-		printf("--ip6-proto ");
+		ebt_out_str("--ip6-proto ");
 		if (ipinfo->invflags & EBT_IP6_PROTO)
-			printf("! ");
+			ebt_out_str("! ");
 		pe = getprotobynumber(ipinfo->protocol);
-		if (pe == NULL) {
-			printf("%d ", ipinfo->protocol);
-		} else {
-			printf("%s ", pe->p_name);
-		}
+		if (pe == NULL)
+			ebt_out_unsigned(ipinfo->protocol);
+		else
+			ebt_out_str(pe->p_name);
+		ebt_out_char(' ');
 	}
 	if (ipinfo->bitmask & EBT_IP6_SPORT) {
-		printf("--ip6-sport ");
+		ebt_out_str("--ip6-sport ");
 		if (ipinfo->invflags & EBT_IP6_SPORT)
-			printf("! ");
+			ebt_out_str("! ");
 		print_port_range(ipinfo->sport);
 	}
 	if (ipinfo->bitmask & EBT_IP6_DPORT) {
-		printf("--ip6-dport ");
+		ebt_out_str("--ip6-dport ");
 		if (ipinfo->invflags & EBT_IP6_DPORT)
-			printf("! ");
+			ebt_out_str("! ");
 		print_port_range(ipinfo->dport);
 	}
 	if (ipinfo->bitmask & EBT_IP6_ICMP6) {
-		printf("--ip6-icmp-type ");
+		ebt_out_str("--ip6-icmp-type ");
 		if (ipinfo->invflags & EBT_IP6_ICMP6)
-			printf("! ");
+			ebt_out_str("! ");
 		print_icmp_type(ipinfo->icmpv6_type, ipinfo->icmpv6_code);
 	}
 }
@@ -171,7 +171,7 @@ static void print_rate(u_int32_t period)
 		    g_rates[i].mult/period < g_rates[i].mult%period)
 			break;
 
-	printf("%u/%s ", g_rates[i-1].mult / period, g_rates[i-1].name);
+	ebt_out_printf("%u/%s ", g_rates[i-1].mult / period, g_rates[i-1].name);
 }
 
 static void print(const struct ebt_u_entry *entry,
@@ -179,9 +179,9 @@ static void print(const struct ebt_u_entry *entry,
 {
 	struct ebt_limit_info *r = (struct ebt_limit_info *)match->data;
 
-	printf("--limit ");
+	ebt_out_str("--limit ");
 	print_rate(r->avg);
-	printf("--limit-burst %u ", r->burst);
+	ebt_out_printf("--limit-burst %u ", r->burst);
 }
 
 static int compare(const struct ebt_entry_match* m1,
@@ -179,16 +179,16 @@ static void print(const struct ebt_u_entry *entry,
 {
 	struct ebt_log_info *loginfo = (struct ebt_log_info *)watcher->data;
 
-	printf("--log-level %s --log-prefix \"%s\"",
+	ebt_out_printf("--log-level %s --log-prefix \"%s\"",
 		eight_priority[loginfo->loglevel].c_name,
 		loginfo->prefix);
 	if (loginfo->bitmask & EBT_LOG_IP)
-		printf(" --log-ip");
+		ebt_out_str(" --log-ip");
 	if (loginfo->bitmask & EBT_LOG_ARP)
-		printf(" --log-arp");
+		ebt_out_str(" --log-arp");
 	if (loginfo->bitmask & EBT_LOG_IP6)
-		printf(" --log-ip6");
-	printf(" ");
+		ebt_out_str(" --log-ip6");
+	ebt_out_char(' ');
 }
 
 static int compare(const struct ebt_entry_watcher *w1,
@@ -133,18 +133,21 @@ static void print(const struct ebt_u_entry *entry,
 
 	tmp = markinfo->target & ~EBT_VERDICT_BITS;
 	if (tmp == MARK_SET_VALUE)
-		printf("--mark-set");
+		ebt_out_str("--mark-set");
 	else if (tmp == MARK_OR_VALUE)
-		printf("--mark-or");
+		ebt_out_str("--mark-or");
 	else if (tmp == MARK_XOR_VALUE)
-		printf("--mark-xor");
+		ebt_out_str("--mark-xor");
 	else if (tmp == MARK_AND_VALUE)
-		printf("--mark-and");
+		ebt_out_str("--mark-and");
 	else
 		ebt_print_error("oops, unknown mark action, try a later version of ebtables");
-	printf(" 0x%lx", markinfo->mark);
+	ebt_out_char(' ');
+	ebt_out_hex(markinfo->mark, 0);
 	tmp = markinfo->target | ~EBT_VERDICT_BITS;
-	printf(" --mark-target %s", TARGET_NAME(tmp));
+	ebt_out_str(" --mark-target ");
+	ebt_out_str(TARGET_NAME(tmp));
+	ebt_out_char(' ');
 }
 
 static int compare(const struct ebt_entry_target *t1,
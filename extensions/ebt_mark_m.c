@@ -80,15 +80,19 @@ static void print(const struct ebt_u_entry *entry,
 	struct ebt_mark_m_info *markinfo =
 	   (struct ebt_mark_m_info *)match->data;
 
-	printf("--mark ");
+	ebt_out_str("--mark ");
 	if (markinfo->invert)
-		printf("! ");
-	if (markinfo->bitmask == EBT_MARK_OR)
-		printf("/0x%lx ", markinfo->mask);
-	else if(markinfo->mask != 0xffffffff)
-		printf("0x%lx/0x%lx ", markinfo->mark, markinfo->mask);
-	else
-		printf("0x%lx ", markinfo->mark);
+		ebt_out_str("! ");
+	if (markinfo->bitmask == EBT_MARK_OR) {
+		ebt_out_char('/');
+		ebt_out_hex(markinfo->mask, 0);
+	} else if(markinfo->mask != 0xffffffff) {
+		ebt_out_hex(markinfo->mark, 0);
+		ebt_out_char('/');
+		ebt_out_hex(markinfo->mask, 0);
+	} else
+		ebt_out_hex(markinfo->mark, 0);
+	ebt_out_char(' ');
 }
 
 static int compare(const struct ebt_entry_match *m1,
@@ -108,6 +112,13 @@ static int compare(const struct ebt_entry_match *m1,
 	return 1;
 }
 
+static unsigned int hash(const struct ebt_entry_match *m)
+{
+	struct ebt_mark_m_info *markinfo = (struct ebt_mark_m_info *)m->data;
+
+	return ebt_hash_field(EBT_HASH_INIT, markinfo->mark);
+}
+
 static struct ebt_u_match mark_match =
 {
 	.name		= "mark_m",
@@ -118,6 +129,7 @@ static struct ebt_u_match mark_match =
 	.final_check	= final_check,
 	.print		= print,
 	.compare	= compare,
+	.hash		= hash,
 	.extra_ops	= opts,
 };
 
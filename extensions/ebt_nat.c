@@ -81,15 +81,13 @@ static int parse_s(int c, char **argv, int argc,
    struct ebt_entry_target **target)
 {
 	struct ebt_nat_info *natinfo = (struct ebt_nat_info *)(*target)->data;
-	struct ether_addr *addr;
 
 	switch (c) {
 	case NAT_S:
 		ebt_check_option2(flags, OPT_SNAT);
 		to_source_supplied = 1;
-		if (!(addr = ether_aton(optarg)))
+		if (ebt_get_mac(optarg, natinfo->mac))
 			ebt_print_error2("Problem with specified --to-source mac");
-		memcpy(natinfo->mac, addr, ETH_ALEN);
 		break;
 	case NAT_S_TARGET:
 		{ int tmp;
@@ -116,15 +114,13 @@ static int parse_d(int c, char **argv, int argc,
    struct ebt_entry_target **target)
 {
 	struct ebt_nat_info *natinfo = (struct ebt_nat_info *)(*target)->data;
-	struct ether_addr *addr;
 
 	switch (c) {
 	case NAT_D:
 		ebt_check_option2(flags, OPT_DNAT);
 		to_dest_supplied = 1;
-		if (!(addr = ether_aton(optarg)))
+		if (ebt_get_mac(optarg, natinfo->mac))
 			ebt_print_error2("Problem with specified --to-destination mac");
-		memcpy(natinfo->mac, addr, ETH_ALEN);
 		break;
 	case NAT_D_TARGET:
 		ebt_check_option2(flags, OPT_DNAT_TARGET);
@@ -178,11 +174,13 @@ static void print_s(const struct ebt_u_entry *entry,
 {
 	struct ebt_nat_info *natinfo = (struct ebt_nat_info *)target->data;
 
-	printf("--to-src ");
+	ebt_out_str("--to-src ");
 	ebt_print_mac(natinfo->mac);
 	if (!(natinfo->target&NAT_ARP_BIT))
-		printf(" --snat-arp");
-	printf(" --snat-target %s", TARGET_NAME((natinfo->target|~EBT_VERDICT_BITS)));
+		ebt_out_str(" --snat-arp");
+	ebt_out_str(" --snat-target ");
+	ebt_out_str(TARGET_NAME((natinfo->target|~EBT_VERDICT_BITS)));
+	ebt_out_char(' ');
 }
 
 static void print_d(const struct ebt_u_entry *entry,
@@ -190,9 +188,11 @@ static void print_d(const struct ebt_u_entry *entry,
 {
 	struct ebt_nat_info *natinfo = (struct ebt_nat_info *)target->data;
 
-	printf("--to-dst ");
+	ebt_out_str("--to-dst ");
 	ebt_print_mac(natinfo->mac);
-	printf(" --dnat-target %s", TARGET_NAME(natinfo->target));
+	ebt_out_str(" --dnat-target ");
+	ebt_out_str(TARGET_NAME(natinfo->target));
+	ebt_out_char(' ');
 }
 
 static int compare(const struct ebt_entry_target *t1,
@@ -131,13 +131,22 @@ static void nflog_print(const struct ebt_u_entry *entry,
 	struct ebt_nflog_info *info = (struct ebt_nflog_info *)watcher->data;
 
 	if (info->prefix[0] != '\0')
-		printf("--nflog-prefix \"%s\"", info->prefix);
-	if (info->group)
-		printf("--nflog-group %d ", info->group);
-	if (info->len)
-		printf("--nflog-range %d", info->len);
-	if (info->threshold != EBT_NFLOG_DEFAULT_THRESHOLD)
-		printf(" --nflog-threshold %d ", info->threshold);
+		ebt_out_printf("--nflog-prefix \"%s\" ", info->prefix);
+	if (info->group) {
+		ebt_out_str("--nflog-group ");
+		ebt_out_unsigned(info->group);
+		ebt_out_char(' ');
+	}
+	if (info->len) {
+		ebt_out_str("--nflog-range ");
+		ebt_out_unsigned(info->len);
+		ebt_out_char(' ');
+	}
+	if (info->threshold != EBT_NFLOG_DEFAULT_THRESHOLD) {
+		ebt_out_str("--nflog-threshold ");
+		ebt_out_unsigned(info->threshold);
+		ebt_out_char(' ');
+	}
 }
 
 static int nflog_compare(const struct ebt_entry_watcher *w1,
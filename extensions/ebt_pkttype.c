@@ -92,12 +92,15 @@ static void print(const struct ebt_u_entry *entry,
 	struct ebt_pkttype_info *pt = (struct ebt_pkttype_info *)match->data;
 	int i = 0;
 
-	printf("--pkttype-type %s", pt->invert ? "! " : "");
+	ebt_out_str("--pkttype-type ");
+	if (pt->invert)
+		ebt_out_str("! ");
 	while (classes[i++][0]);
 	if (pt->pkt_type < i - 1)
-		printf("%s ", classes[pt->pkt_type]);
+		ebt_out_str(classes[pt->pkt_type]);
 	else
-		printf("%d ", pt->pkt_type);
+		ebt_out_unsigned(pt->pkt_type);
+	ebt_out_char(' ');
 }
 
 static int compare(const struct ebt_entry_match *m1,
@@ -112,6 +115,13 @@ static int compare(const struct ebt_entry_match *m1,
 	return 1;
 }
 
+static unsigned int hash(const struct ebt_entry_match *m)
+{
+	struct ebt_pkttype_info *pt = (struct ebt_pkttype_info *)m->data;
+
+	return ebt_hash_field(EBT_HASH_INIT, pt->pkt_type);
+}
+
 static struct ebt_u_match pkttype_match =
 {
 	.name		= "pkttype",
@@ -122,6 +132,7 @@ static struct ebt_u_match pkttype_match =
 	.final_check	= final_check,
 	.print		= print,
 	.compare	= compare,
+	.hash		= hash,
 	.extra_ops	= opts,
 };
 
@@ -81,7 +81,9 @@ static void print(const struct ebt_u_entry *entry,
 
 	if (redirectinfo->target == EBT_ACCEPT)
 		return;
-	printf(" --redirect-target %s", TARGET_NAME(redirectinfo->target));
+	ebt_out_str("--redirect-target ");
+	ebt_out_str(TARGET_NAME(redirectinfo->target));
+	ebt_out_char(' ');
 }
 
 static int compare(const struct ebt_entry_target *t1,
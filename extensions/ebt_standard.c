@@ -48,17 +48,18 @@ static void print(const struct ebt_u_entry *entry,
 		struct ebt_u_entries *entries;
 
 		entries = entry->replace->chains[verdict + NF_BR_NUMHOOKS];
-		printf("%s", entries->name);
+		ebt_out_str(entries->name);
+		ebt_out_char(' ');
 		return;
 	}
 	if (verdict == EBT_CONTINUE)
-		printf("CONTINUE ");
+		ebt_out_str("CONTINUE ");
 	else if (verdict == EBT_ACCEPT)
-		printf("ACCEPT ");
+		ebt_out_str("ACCEPT ");
 	else if (verdict == EBT_DROP)
-		printf("DROP ");
+		ebt_out_str("DROP ");
 	else if (verdict == EBT_RETURN)
-		printf("RETURN ");
+		ebt_out_str("RETURN ");
 	else
 		ebt_print_bug("Bad standard target");
 }
@@ -70,6 +71,17 @@ static int compare(const struct ebt_entry_target *t1,
 	   ((struct ebt_standard_target *)t2)->verdict;
 }
 
+/* All jumps to a udc hash the same, so the fingerprint of a rule doesn't
+ * change when the udc's are renumbered */
+static unsigned int hash(const struct ebt_entry_target *t)
+{
+	int verdict = ((struct ebt_standard_target *)t)->verdict;
+
+	if (verdict >= 0)
+		verdict = 0;
+	return ebt_hash_field(EBT_HASH_INIT, verdict);
+}
+
 static struct ebt_u_target standard =
 {
 	.name		= "standard",
@@ -81,6 +93,7 @@ static struct ebt_u_target standard =
 	.final_check	= final_check,
 	.print		= print,
 	.compare	= compare,
+	.hash		= hash,
 	.extra_ops	= opts,
 };
 
@@ -149,9 +149,9 @@ out:
 static void print_range(unsigned int l, unsigned int u)
 {
 	if (l == u)
-		printf("%u ", l);
+		ebt_out_unsigned(l);
 	else
-		printf("%u:%u ", l, u);
+		ebt_out_printf("%u:%u", l, u);
 }
 
 static int parse(int c, char **argv, int argc, const struct ebt_u_entry *entry,
@@ -276,22 +276,25 @@ static void print(const struct ebt_u_entry *entry,
 	for (i = 0; i < STP_NUMOPS; i++) {
 		if (!(stpinfo->bitmask & (1 << i)))
 			continue;
-		printf("--%s %s", opts[i].name,
-		       (stpinfo->invflags & (1 << i)) ? "! " : "");
+		ebt_out_str("--");
+		ebt_out_str(opts[i].name);
+		ebt_out_char(' ');
+		if (stpinfo->invflags & (1 << i))
+			ebt_out_str("! ");
 		if (EBT_STP_TYPE == (1 << i)) {
 			if (stpinfo->type == BPDU_TYPE_CONFIG)
-				printf("%s", BPDU_TYPE_CONFIG_STRING);
+				ebt_out_str(BPDU_TYPE_CONFIG_STRING);
 			else if (stpinfo->type == BPDU_TYPE_TCN)
-				printf("%s", BPDU_TYPE_TCN_STRING);
+				ebt_out_str(BPDU_TYPE_TCN_STRING);
 			else
-				printf("%d", stpinfo->type);
+				ebt_out_unsigned(stpinfo->type);
 		} else if (EBT_STP_FLAGS == (1 << i)) {
 			if (c->flags == FLAG_TC)
-				printf("%s", FLAG_TC_STRING);
+				ebt_out_str(FLAG_TC_STRING);
 			else if (c->flags == FLAG_TC_ACK)
-				printf("%s", FLAG_TC_ACK_STRING);
+				ebt_out_str(FLAG_TC_ACK_STRING);
 			else
-				printf("%d", c->flags);
+				ebt_out_unsigned(c->flags);
 		} else if (EBT_STP_ROOTPRIO == (1 << i))
 			print_range(c->root_priol, c->root_priou);
 		else if (EBT_STP_ROOTADDR == (1 << i))
@@ -314,7 +317,7 @@ static void print(const struct ebt_u_entry *entry,
 			print_range(c->hello_timel, c->hello_timeu);
 		else if (EBT_STP_FWDD == (1 << i))
 			print_range(c->forward_delayl, c->forward_delayu);
-		printf(" ");
+		ebt_out_char(' ');
 	}
 }
 
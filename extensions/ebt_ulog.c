@@ -144,13 +144,13 @@ static void print(const struct ebt_u_entry *entry,
 {
 	struct ebt_ulog_info *uloginfo = (struct ebt_ulog_info *)watcher->data;
 
-	printf("--ulog-prefix \"%s\" --ulog-nlgroup %d --ulog-cprange ",
+	ebt_out_printf("--ulog-prefix \"%s\" --ulog-nlgroup %d --ulog-cprange ",
 	       uloginfo->prefix, uloginfo->nlgroup + 1);
 	if (uloginfo->cprange == CP_NO_LIMIT_N)
-		printf(CP_NO_LIMIT_S);
+		ebt_out_str(CP_NO_LIMIT_S);
 	else
-		printf("%d", uloginfo->cprange);
-	printf(" --ulog-qthreshold %d ", uloginfo->qthreshold);
+		ebt_out_unsigned(uloginfo->cprange);
+	ebt_out_printf(" --ulog-qthreshold %d ", uloginfo->qthreshold);
 }
 
 static int compare(const struct ebt_entry_watcher *w1,
@@ -131,18 +131,29 @@ static void print(const struct ebt_u_entry *entry,
 	struct ebt_vlan_info *vlaninfo = (struct ebt_vlan_info *) match->data;
 
 	if (vlaninfo->bitmask & EBT_VLAN_ID) {
-		printf("--vlan-id %s%d ", (vlaninfo->invflags & EBT_VLAN_ID) ? "! " : "", vlaninfo->id);
+		ebt_out_str("--vlan-id ");
+		if (vlaninfo->invflags & EBT_VLAN_ID)
+			ebt_out_str("! ");
+		ebt_out_unsigned(vlaninfo->id);
+		ebt_out_char(' ');
 	}
 	if (vlaninfo->bitmask & EBT_VLAN_PRIO) {
-		printf("--vlan-prio %s%d ", (vlaninfo->invflags & EBT_VLAN_PRIO) ? "! " : "", vlaninfo->prio);
+		ebt_out_str("--vlan-prio ");
+		if (vlaninfo->invflags & EBT_VLAN_PRIO)
+			ebt_out_str("! ");
+		ebt_out_unsigned(vlaninfo->prio);
+		ebt_out_char(' ');
 	}
 	if (vlaninfo->bitmask & EBT_VLAN_ENCAP) {
-		printf("--vlan-encap %s", (vlaninfo->invflags & EBT_VLAN_ENCAP) ? "! " : "");
+		ebt_out_str("--vlan-encap ");
+		if (vlaninfo->invflags & EBT_VLAN_ENCAP)
+			ebt_out_str("! ");
 		ethent = getethertypebynumber(ntohs(vlaninfo->encap));
 		if (ethent != NULL) {
-			printf("%s ", ethent->e_name);
+			ebt_out_str(ethent->e_name);
+			ebt_out_char(' ');
 		} else {
-			printf("%4.4X ", ntohs(vlaninfo->encap));
+			ebt_out_printf("%4.4X ", ntohs(vlaninfo->encap));
 		}
 	}
 }
@@ -169,6 +180,20 @@ static int compare(const struct ebt_entry_match *vlan1,
 	return 1;
 }
 
+static unsigned int hash(const struct ebt_entry_match *vlan)
+{
+	struct ebt_vlan_info *vlaninfo = (struct ebt_vlan_info *) vlan->data;
+	unsigned int h = EBT_HASH_INIT;
+
+	h = ebt_hash_field(h, vlaninfo->bitmask);
+	h = ebt_hash_field(h, vlaninfo->invflags);
+	if (vlaninfo->bitmask & EBT_VLAN_ID)
+		h = ebt_hash_field(h, vlaninfo->id);
+	if (vlaninfo->bitmask & EBT_VLAN_ENCAP)
+		h = ebt_hash_field(h, vlaninfo->encap);
+	return h;
+}
+
 static struct ebt_u_match vlan_match = {
 	.name		= "vlan",
 	.size		= sizeof(struct ebt_vlan_info),
@@ -178,6 +203,7 @@ static struct ebt_u_match vlan_match = {
 	.final_check	= final_check,
 	.print		= print,
 	.compare	= compare,
+	.hash		= hash,
 	.extra_ops	= opts,
 };
 
@@ -47,68 +47,90 @@
 
 #define	MAXALIASES	35
 
-static FILE *etherf = NULL;
-static char line[BUFSIZ + 1];
-static struct ethertypeent et_ent;
-static char *ethertype_aliases[MAXALIASES];
-static int ethertype_stayopen;
+/* The ethertypes file is read once, the entries are kept in the order of
+ * the file. Names (and aliases) and numbers are looked up through two open
+ * addressing hash tables that hold the entry number + 1, 0 is a free slot.
+ * When a name or number occurs more than once, the first entry wins, like
+ * it did when the file was scanned from the top for every lookup. */
+static int loaded;
+static char *pool;
+static struct ethertypeent *entries;
+static int nr_entries, next_entry;
+static char **aliases;
+static int *name_hash, *number_hash;
+static unsigned int hash_mask;
 
-void setethertypeent(int f)
+static unsigned int hash_name(const char *name)
 {
-	if (etherf == NULL)
-		etherf = fopen(_PATH_ETHERTYPES, "r");
-	else
-		rewind(etherf);
-	ethertype_stayopen |= f;
+	unsigned int h = 2166136261u;
+
+	while (*name)
+		h = (h ^ tolower((unsigned char)*name++)) * 16777619u;
+	return h;
 }
 
-void endethertypeent(void)
+static unsigned int hash_number(int type)
 {
-	if (etherf) {
-		fclose(etherf);
-		etherf = NULL;
-	}
-	ethertype_stayopen = 0;
+	return (unsigned int)type * 2654435761u;
 }
 
-struct ethertypeent *getethertypeent(void)
+static void hash_add_name(const char *name, int i)
 {
-	char *e;
-	char *endptr;
-	register char *cp, **q;
+	unsigned int h = hash_name(name);
 
-	if (etherf == NULL
-	    && (etherf = fopen(_PATH_ETHERTYPES, "r")) == NULL) {
-		return (NULL);
+	while (name_hash[h & hash_mask]) {
+		struct ethertypeent *e = &entries[name_hash[h & hash_mask] - 1];
+		char **cp;
+
+		if (!strcasecmp(e->e_name, name))
+			return;
+		for (cp = e->e_aliases; *cp; cp++)
+			if (!strcasecmp(*cp, name))
+				return;
+		h++;
 	}
+	name_hash[h & hash_mask] = i + 1;
+}
 
-again:
-	if ((e = fgets(line, BUFSIZ, etherf)) == NULL) {
-		return (NULL);
+static void hash_add_number(int type, int i)
+{
+	unsigned int h = hash_number(type);
+
+	while (number_hash[h & hash_mask]) {
+		if (entries[number_hash[h & hash_mask] - 1].e_ethertype == type)
+			return;
+		h++;
 	}
+	number_hash[h & hash_mask] = i + 1;
+}
+
+/* Split one line of the file in place, returns 0 for a valid entry */
+static int parse_line(char *e, struct ethertypeent *ent, char ***q)
+{
+	char *endptr;
+	register char *cp;
+
 	if (*e == '#')
-		goto again;
-	cp = strpbrk(e, "#\n");
-	if (cp == NULL)
-		goto again;
-	*cp = '\0';
-	et_ent.e_name = e;
+		return -1;
+	cp = strchr(e, '#');
+	if (cp != NULL)
+		*cp = '\0';
+	ent->e_name = e;
 	cp = strpbrk(e, " \t");
 	if (cp == NULL)
-		goto again;
+		return -1;
 	*cp++ = '\0';
 	while (*cp == ' ' || *cp == '\t')
 		cp++;
 	e = strpbrk(cp, " \t");
 	if (e != NULL)
 		*e++ = '\0';
-// Check point
-	et_ent.e_ethertype = strtol(cp, &endptr, 16);
+	ent->e_ethertype = strtol(cp, &endptr, 16);
 	if (*endptr != '\0'
-	    || (et_ent.e_ethertype < ETH_ZLEN
-		|| et_ent.e_ethertype > 0xFFFF))
-		goto again;	// Skip invalid etherproto type entry
-	q = et_ent.e_aliases = ethertype_aliases;
+	    || (ent->e_ethertype < ETH_ZLEN
+		|| ent->e_ethertype > 0xFFFF))
+		return -1;	// Skip invalid etherproto type entry
+	ent->e_aliases = *q;
 	if (e != NULL) {
 		cp = e;
 		while (cp && *cp) {
@@ -116,46 +138,135 @@ again:
 				cp++;
 				continue;
 			}
-			if (q < &ethertype_aliases[MAXALIASES - 1])
-				*q++ = cp;
+			if (*q < &ent->e_aliases[MAXALIASES - 1])
+				*(*q)++ = cp;
 			cp = strpbrk(cp, " \t");
 			if (cp != NULL)
 				*cp++ = '\0';
 		}
 	}
-	*q = NULL;
-	return (&et_ent);
+	*(*q)++ = NULL;
+	return 0;
+}
+
+/* Read the whole file and build the tables, a missing file gives an empty
+ * database */
+static void load_ethertypes(void)
+{
+	FILE *f;
+	long size;
+	int nr_lines = 1, nr_words = 0, i;
+	char *line, *end, **q;
+
+	loaded = 1;
+	if ((f = fopen(_PATH_ETHERTYPES, "r")) == NULL)
+		return;
+	if (fseek(f, 0, SEEK_END) || (size = ftell(f)) < 0 ||
+	    fseek(f, 0, SEEK_SET) || !(pool = malloc(size + 1)) ||
+	    fread(pool, 1, size, f) != (size_t)size) {
+		fclose(f);
+		free(pool);
+		pool = NULL;
+		return;
+	}
+	fclose(f);
+	pool[size] = '\0';
+	/* Upper bounds for the number of entries and aliases */
+	for (i = 0; i < size; i++) {
+		if (pool[i] == '\n')
+			nr_lines++;
+		else if ((pool[i] == ' ' || pool[i] == '\t') &&
+			 (i == 0 || (pool[i - 1] != ' ' && pool[i - 1] != '\t')))
+			nr_words++;
+	}
+	for (hash_mask = 16; hash_mask < 2 * (nr_lines + nr_words);
+	     hash_mask *= 2);
+	entries = malloc(nr_lines * sizeof(struct ethertypeent));
+	aliases = malloc((nr_lines + nr_words) * sizeof(char *));
+	name_hash = calloc(hash_mask, sizeof(int));
+	number_hash = calloc(hash_mask, sizeof(int));
+	hash_mask--;
+	if (!entries || !aliases || !name_hash || !number_hash) {
+		free(entries);
+		free(aliases);
+		free(name_hash);
+		free(number_hash);
+		free(pool);
+		entries = NULL;
+		pool = NULL;
+		return;
+	}
+	q = aliases;
+	for (line = pool; line < pool + size; line = end + 1) {
+		if ((end = strchr(line, '\n')) != NULL)
+			*end = '\0';
+		else
+			end = pool + size;
+		if (parse_line(line, &entries[nr_entries], &q))
+			continue;
+		nr_entries++;
+	}
+	for (i = 0; i < nr_entries; i++) {
+		hash_add_name(entries[i].e_name, i);
+		for (q = entries[i].e_aliases; *q; q++)
+			hash_add_name(*q, i);
+		hash_add_number(entries[i].e_ethertype, i);
+	}
+}
+
+void setethertypeent(int f)
+{
+	if (!loaded)
+		load_ethertypes();
+	next_entry = 0;
+}
+
+void endethertypeent(void)
+{
+	next_entry = 0;
+}
+
+struct ethertypeent *getethertypeent(void)
+{
+	if (!loaded)
+		load_ethertypes();
+	if (next_entry == nr_entries)
+		return (NULL);
+	return (&entries[next_entry++]);
 }
 
 
 struct ethertypeent *getethertypebyname(const char *name)
 {
-	register struct ethertypeent *e;
-	register char **cp;
+	unsigned int h;
+
+	if (!loaded)
+		load_ethertypes();
+	if (!nr_entries)
+		return (NULL);
+	for (h = hash_name(name); name_hash[h & hash_mask]; h++) {
+		struct ethertypeent *e = &entries[name_hash[h & hash_mask] - 1];
+		char **cp;
 
-	setethertypeent(ethertype_stayopen);
-	while ((e = getethertypeent()) != NULL) {
 		if (strcasecmp(e->e_name, name) == 0)
-			break;
+			return (e);
 		for (cp = e->e_aliases; *cp != 0; cp++)
 			if (strcasecmp(*cp, name) == 0)
-				goto found;
+				return (e);
 	}
-found:
-	if (!ethertype_stayopen)
-		endethertypeent();
-	return (e);
+	return (NULL);
 }
 
 struct ethertypeent *getethertypebynumber(int type)
 {
-	register struct ethertypeent *e;
-
-	setethertypeent(ethertype_stayopen);
-	while ((e = getethertypeent()) != NULL)
-		if (e->e_ethertype == type)
-			break;
-	if (!ethertype_stayopen)
-		endethertypeent();
-	return (e);
+	unsigned int h;
+
+	if (!loaded)
+		load_ethertypes();
+	if (!nr_entries)
+		return (NULL);
+	for (h = hash_number(type); number_hash[h & hash_mask]; h++)
+		if (entries[number_hash[h & hash_mask] - 1].e_ethertype == type)
+			return (&entries[number_hash[h & hash_mask] - 1]);
+	return (NULL);
 }
@@ -55,17 +55,98 @@ struct ebt_u_entries
 	unsigned int counter_offset;
 	/* used for udc */
 	unsigned int hook_mask;
+	/* the hook_mask the rules of the chain last passed the final checks
+	 * with, see ebt_check_rules() */
+	unsigned int checked_hook_mask;
 	char *kernel_start;
 	char name[EBT_CHAIN_MAXNAMELEN];
 	struct ebt_u_entry *entries;
+	/* root of the rule number index, see ebt_rule_nr_to_entry() */
+	struct ebt_u_entry *index;
+	/* rules hashed on their fingerprint, built when first needed by
+	 * ebt_check_rule_exists() (hash_size == 0 means not built) */
+	struct ebt_u_entry **hash;
+	unsigned int hash_size;
+	/* size of the chain in the kernel table, kept up to date when rules
+	 * are added or deleted */
+	unsigned int entries_size;
+	/* where the chain was put in ebt_u_replace.blob, a chain that isn't
+	 * dirty can be copied from there by the next ebt_deliver_table() */
+	unsigned int blob_offset;
+	int dirty;
+	/* the rules that jump to this chain, linked through
+	 * ebt_u_entry.ref_next, see ebt_link_reference() */
+	struct ebt_u_entry *refs;
+	/* the rules of this chain that jump to a udc, linked through
+	 * ebt_u_entry.jump_next, these are the edges ebt_check_for_loops()
+	 * follows */
+	struct ebt_u_entry *jumps;
 };
 
+/* Rules that were deleted since the last ebt_deliver_counters() */
 struct ebt_cntchanges
 {
-	unsigned short type;
-	unsigned short change; /* determines incremental/decremental/change */
-	struct ebt_cntchanges *prev;
-	struct ebt_cntchanges *next;
+	/* they were in front of the rule that now has this number (counted
+	 * over the whole table) */
+	unsigned int pos;
+	/* nr of old counters that belonged to them */
+	unsigned int n;
+};
+
+/* Memory for a table retrieved from the kernel or a file, see
+ * ebt_arena_alloc() */
+struct ebt_arena
+{
+	struct ebt_arena *next;
+	/* both include the header of the block */
+	size_t size;
+	size_t used;
+};
+
+/*
+ * Layout of an atomic file (--atomic-file), all in host byte order:
+ * struct ebt_file_header, num_chains times struct ebt_file_chain,
+ * the entries as given to the kernel and nentries struct ebt_counter.
+ * The offsets let a tool go straight to one chain or to the counters.
+ * Files written by older versions (a struct ebt_replace followed by the
+ * entries and the counters) are still accepted by ebt_get_table().
+ */
+#define EBT_FILE_MAGIC "EBTABLES"
+#define EBT_FILE_VERSION 1
+struct ebt_file_header
+{
+	char magic[8];
+	uint32_t version;
+	/* sizeof(struct ebt_file_header) */
+	uint32_t header_size;
+	char name[EBT_TABLE_MAXNAMELEN];
+	uint32_t valid_hooks;
+	uint32_t nentries;
+	uint32_t num_chains;
+	uint32_t entries_size;
+	/* from the start of the file */
+	uint64_t chains_offset;
+	uint64_t entries_offset;
+	uint64_t counters_offset;
+	/* ebt_crc32() of the header (with both crc fields 0), the chain
+	 * table and the entries */
+	uint32_t crc;
+	/* ebt_crc32() of the counters, changes with every counter update */
+	uint32_t counters_crc;
+};
+
+struct ebt_file_chain
+{
+	char name[EBT_CHAIN_MAXNAMELEN];
+	/* hook number, -1 for a udc */
+	int32_t hook;
+	int32_t policy;
+	/* of the struct ebt_entries of the chain, relative to the entries */
+	uint32_t offset;
+	/* includes the struct ebt_entries */
+	uint32_t size;
+	uint32_t nentries;
+	uint32_t counter_offset;
 };
 
 #define EBT_ORI_MAX_CHAINS 10
@@ -95,8 +176,33 @@ struct ebt_u_replace
 	int selected_chain;
 	/* used for the atomic option */
 	char *filename;
-	/* tells what happened to the old rules (counter changes) */
+	/* where old rules were deleted, ordered on pos, the other counter
+	 * changes are kept in the rules themselves */
 	struct ebt_cntchanges *cc;
+	unsigned int num_cc, max_cc;
+	/* only the counters of the rules [cnt_lo, cnt_hi) (counted over the
+	 * whole table) have to be rebuilt by ebt_deliver_counters(), the ones
+	 * behind cnt_hi moved cnt_shift places. cnt_lo > cnt_hi: no changes */
+	unsigned int cnt_lo, cnt_hi;
+	int cnt_shift;
+	/* the entries last given to the kernel and the buffer the next
+	 * ones are built in, they are swapped by ebt_deliver_table() */
+	char *blob, *blob_spare;
+	unsigned int blob_size, blob_spare_size;
+	/* the table translated by ebt_prepare_table(), for the next
+	 * ebt_deliver_table() */
+	struct ebt_replace *prepared;
+	/* freed in one go by ebt_cleanup_replace() */
+	struct ebt_arena *arena;
+	/* the rules in kernel format, when only a view of the table was
+	 * retrieved (see ebt_get_kernel_table()) */
+	char *view;
+	/* the mapping of the atomic file view points into, if any */
+	char *map;
+	size_t map_size;
+	/* the hook_mask of the chains is up to date, cleared when a jump
+	 * to a udc is added or removed, see ebt_check_for_loops() */
+	int loops_checked;
 };
 
 struct ebt_u_table
@@ -111,12 +217,15 @@ struct ebt_u_match_list
 {
 	struct ebt_u_match_list *next;
 	struct ebt_entry_match *m;
+	/* the extension m belongs to, so it doesn't have to be looked up */
+	struct ebt_u_match *match;
 };
 
 struct ebt_u_watcher_list
 {
 	struct ebt_u_watcher_list *next;
 	struct ebt_entry_watcher *w;
+	struct ebt_u_watcher *watcher;
 };
 
 struct ebt_u_entry
@@ -139,10 +248,81 @@ struct ebt_u_entry
 	struct ebt_u_entry *next;
 	struct ebt_counter cnt;
 	struct ebt_counter cnt_surplus; /* for increasing/decreasing a counter and for option 'C' */
-	struct ebt_cntchanges *cc;
+	/* tells what happened to the rule (CNT_NORM, CNT_ADD or CNT_CHANGE) */
+	unsigned short cnt_type;
+	unsigned short cnt_change; /* determines incremental/decremental/change */
 	/* the standard target needs this to know the name of a udc when
 	 * printing out rules. */
 	struct ebt_u_replace *replace;
+	/* position in the rule number index of the chain (a treap ordered
+	 * by rule number), only valid when the rule is in a chain */
+	struct ebt_u_entry *idx_parent;
+	struct ebt_u_entry *idx_left;
+	struct ebt_u_entry *idx_right;
+	unsigned int idx_size;
+	unsigned int idx_prio;
+	/* see ebt_u_entries.hash */
+	unsigned int fingerprint;
+	struct ebt_u_entry *hash_next;
+	/* the target is the standard target, only valid when the rule is
+	 * in a chain */
+	int standard;
+	/* for a jump to a udc: the next rule jumping to the same chain and
+	 * the pointer that points to this rule, see ebt_u_entries.refs */
+	struct ebt_u_entry *ref_next;
+	struct ebt_u_entry **ref_pprev;
+	/* the same for the list of jumps in the chain of this rule, see
+	 * ebt_u_entries.jumps */
+	struct ebt_u_entry *jump_next;
+	struct ebt_u_entry **jump_pprev;
+	/* the extension of t, only valid when the rule is in a chain (before
+	 * that, t points to the struct ebt_u_target) */
+	struct ebt_u_target *target;
+};
+
+/* Read-only access to the rules of a table retrieved with
+ * ebt_get_kernel_table(replace, 2), see ebt_view_next_rule() */
+struct ebt_u_view
+{
+	struct ebt_u_replace *replace;
+	struct ebt_u_entries *entries;
+	/* the next rule, in kernel format */
+	char *pos;
+	int rule_nr;
+	struct ebt_u_entry entry;
+	/* the target of entry, when it is a jump to a udc */
+	struct ebt_standard_target jump;
+	struct ebt_u_match_list *matches;
+	struct ebt_u_watcher_list *watchers;
+	int max_matches, max_watchers;
+};
+
+/* The steps that turn one table into another, see ebt_diff_tables().
+ * Rule numbers start from 1 and are the ones at the time the step is done,
+ * the steps are done one after the other. */
+#define EBT_DIFF_NEW_CHAIN	1 /* add udc chain with policy */
+#define EBT_DIFF_POLICY		2 /* change the policy of chain */
+#define EBT_DIFF_DELETE		3 /* delete n rules from rule_nr on */
+#define EBT_DIFF_INSERT		4 /* insert e in front of rule_nr (0: append) */
+#define EBT_DIFF_DEL_CHAIN	5 /* delete the udc chain, it's empty */
+struct ebt_u_diff_op
+{
+	int type;
+	/* the name of the chain, in one of both tables */
+	const char *chain;
+	int policy;
+	int rule_nr;
+	int n;
+	/* a rule of the table that is compared against */
+	struct ebt_u_entry *e;
+};
+
+struct ebt_u_diff
+{
+	/* the table that is compared against */
+	struct ebt_u_replace *to;
+	struct ebt_u_diff_op *ops;
+	unsigned int num_ops, max_ops;
 };
 
 struct ebt_u_match
@@ -162,6 +342,14 @@ struct ebt_u_match
 	   const struct ebt_entry_match *match);
 	int (*compare)(const struct ebt_entry_match *m1,
 	   const struct ebt_entry_match *m2);
+	/* optional, hashes the data that compare() looks at */
+	unsigned int (*hash)(const struct ebt_entry_match *m);
+	/* optional, for --change-match: returns a copy of m (the match of a
+	 * rule in a chain) with the changes given in change (filled in by
+	 * parse()) applied to it. The copy is allocated with malloc(), NULL
+	 * is returned on error */
+	struct ebt_entry_match *(*change)(const struct ebt_entry_match *m,
+	   const struct ebt_entry_match *change);
 	const struct option *extra_ops;
 	/*
 	 * can be used e.g. to check for multiple occurance of the same option
@@ -176,6 +364,10 @@ struct ebt_u_match
 	 */
 	unsigned int used;
 	struct ebt_u_match *next;
+	/* set by ebt_register_match(): the number of the extension, in
+	 * order of registration, and the next one with the same name hash */
+	unsigned int id;
+	struct ebt_u_match *name_next;
 };
 
 struct ebt_u_watcher
@@ -194,12 +386,18 @@ struct ebt_u_watcher
 	   const struct ebt_entry_watcher *watcher);
 	int (*compare)(const struct ebt_entry_watcher *w1,
 	   const struct ebt_entry_watcher *w2);
+	/* optional, hashes the data that compare() looks at */
+	unsigned int (*hash)(const struct ebt_entry_watcher *w);
 	const struct option *extra_ops;
 	unsigned int flags;
 	unsigned int option_offset;
 	struct ebt_entry_watcher *w;
 	unsigned int used;
 	struct ebt_u_watcher *next;
+	/* set by ebt_register_watcher(): the number of the extension, in
+	 * order of registration, and the next one with the same name hash */
+	unsigned int id;
+	struct ebt_u_watcher *name_next;
 };
 
 struct ebt_u_target
@@ -218,12 +416,18 @@ struct ebt_u_target
 	   const struct ebt_entry_target *target);
 	int (*compare)(const struct ebt_entry_target *t1,
 	   const struct ebt_entry_target *t2);
+	/* optional, hashes the data that compare() looks at */
+	unsigned int (*hash)(const struct ebt_entry_target *t);
 	const struct option *extra_ops;
 	unsigned int option_offset;
 	unsigned int flags;
 	struct ebt_entry_target *t;
 	unsigned int used;
 	struct ebt_u_target *next;
+	/* set by ebt_register_target(): the number of the extension, in
+	 * order of registration, and the next one with the same name hash */
+	unsigned int id;
+	struct ebt_u_target *name_next;
 };
 
 /* libebtc.c */
@@ -250,12 +454,25 @@ void ebt_initialize_entry(struct ebt_u_entry *e);
 void ebt_cleanup_replace(struct ebt_u_replace *replace);
 void ebt_reinit_extensions();
 void ebt_double_chains(struct ebt_u_replace *replace);
-void ebt_free_u_entry(struct ebt_u_entry *e);
+void ebt_free_u_entry(struct ebt_u_replace *replace, struct ebt_u_entry *e);
+void *ebt_arena_alloc(struct ebt_u_replace *replace, size_t size);
+void ebt_arena_free(struct ebt_u_replace *replace, void *p);
 struct ebt_u_entries *ebt_name_to_chain(const struct ebt_u_replace *replace,
 				    const char* arg);
 struct ebt_u_entries *ebt_name_to_chain(const struct ebt_u_replace *replace,
 				    const char* arg);
 int ebt_get_chainnr(const struct ebt_u_replace *replace, const char* arg);
+struct ebt_u_entry *ebt_rule_nr_to_entry(const struct ebt_u_entries *entries,
+					 int rule_nr);
+int ebt_entry_to_rule_nr(const struct ebt_u_entry *e);
+void ebt_index_insert(struct ebt_u_entries *entries, struct ebt_u_entry *e,
+		      int rule_nr);
+void ebt_index_remove(struct ebt_u_entries *entries, struct ebt_u_entry *e);
+void ebt_free_rule_hash(struct ebt_u_entries *entries);
+void ebt_link_reference(struct ebt_u_replace *replace,
+			struct ebt_u_entries *entries, struct ebt_u_entry *e);
+void ebt_unlink_reference(struct ebt_u_replace *replace,
+			  struct ebt_u_entry *e);
 /**/
 void ebt_change_policy(struct ebt_u_replace *replace, int policy);
 void ebt_flush_chains(struct ebt_u_replace *replace);
@@ -269,9 +486,16 @@ void ebt_zero_counters(struct ebt_u_replace *replace);
 void ebt_change_counters(struct ebt_u_replace *replace,
 		     struct ebt_u_entry *new_entry, int begin, int end,
 		     struct ebt_counter *cnt, int mask);
+void ebt_change_match(struct ebt_u_replace *replace,
+		      struct ebt_u_entry *new_entry, int rule_nr);
 void ebt_new_chain(struct ebt_u_replace *replace, const char *name, int policy);
 void ebt_delete_chain(struct ebt_u_replace *replace);
 void ebt_rename_chain(struct ebt_u_replace *replace, const char *name);
+int ebt_diff_tables(struct ebt_u_replace *from, struct ebt_u_replace *to,
+		    struct ebt_u_diff *diff);
+void ebt_free_diff(struct ebt_u_diff *diff);
+int ebt_patch_table(struct ebt_u_replace *replace,
+		    const struct ebt_u_diff *diff);
 /**/
 void ebt_do_final_checks(struct ebt_u_replace *replace, struct ebt_u_entry *e,
 			 struct ebt_u_entries *entries);
@@ -279,11 +503,13 @@ int ebt_check_for_references(struct ebt_u_replace *replace, int print_err);
 int ebt_check_for_references2(struct ebt_u_replace *replace, int chain_nr,
 			      int print_err);
 void ebt_check_for_loops(struct ebt_u_replace *replace);
+void ebt_check_rules(struct ebt_u_replace *replace);
 void ebt_add_match(struct ebt_u_entry *new_entry, struct ebt_u_match *m);
 void ebt_add_watcher(struct ebt_u_entry *new_entry, struct ebt_u_watcher *w);
 void ebt_iterate_matches(void (*f)(struct ebt_u_match *));
 void ebt_iterate_watchers(void (*f)(struct ebt_u_watcher *));
 void ebt_iterate_targets(void (*f)(struct ebt_u_target *));
+unsigned int ebt_hash(unsigned int h, const void *data, int len);
 void __ebt_print_bug(char *file, int line, char *format, ...);
 void __ebt_print_error(char *format, ...);
 
@@ -292,6 +518,14 @@ void __ebt_print_error(char *format, ...);
 int ebt_get_table(struct ebt_u_replace *repl, int init);
 void ebt_deliver_counters(struct ebt_u_replace *repl);
 void ebt_deliver_table(struct ebt_u_replace *repl);
+void ebt_prepare_table(struct ebt_u_replace *repl);
+unsigned int ebt_entry_size(const struct ebt_u_entry *e);
+void ebt_view_chain(struct ebt_u_replace *repl, struct ebt_u_entries *entries,
+		    struct ebt_u_view *view);
+struct ebt_u_entry *ebt_view_next_rule(struct ebt_u_view *view);
+void ebt_view_free(struct ebt_u_view *view);
+void ebt_free_view(struct ebt_u_replace *repl);
+uint32_t ebt_crc32(uint32_t crc, const void *data, size_t len);
 
 /* useful_functions.c */
 
@@ -299,8 +533,26 @@ extern int ebt_invert;
 void ebt_check_option(unsigned int *flags, unsigned int mask);
 #define ebt_check_inverse(arg) _ebt_check_inverse(arg, argc, argv)
 int _ebt_check_inverse(const char option[], int argc, char **argv);
+void ebt_out_flush(void);
+void ebt_out_write(const char *s, int len);
+void ebt_out_str(const char *s);
+void ebt_out_char(char c);
+int ebt_out_unput(char c);
+void ebt_out_unsigned(unsigned long long n);
+void ebt_out_hex(unsigned long long n, int digits);
+void ebt_out_ip(uint32_t ip);
+void ebt_out_ip_and_mask(uint32_t ip, uint32_t mask);
+void ebt_out_ip6(const struct in6_addr *addr);
+void ebt_out_printf(const char *format, ...)
+   __attribute__ ((format (printf, 1, 2)));
 void ebt_print_mac(const unsigned char *mac);
 void ebt_print_mac_and_mask(const unsigned char *mac, const unsigned char *mask);
+int ebt_scan_mac(const char **s, const char *end, unsigned char *mac);
+int ebt_scan_ip(const char **s, const char *end, uint32_t *ip);
+int ebt_scan_ip_mask(const char **s, const char *end, uint32_t *mask);
+int ebt_scan_ip6(const char **s, const char *end, struct in6_addr *ip6);
+int ebt_scan_ip6_mask(const char **s, const char *end, struct in6_addr *mask);
+int ebt_get_mac(const char *from, unsigned char *to);
 int ebt_get_mac_and_mask(const char *from, unsigned char *to, unsigned char *mask);
 void ebt_parse_ip_address(char *address, uint32_t *addr, uint32_t *msk);
 char *ebt_mask_to_dotted(uint32_t mask);
@@ -311,6 +563,7 @@ char *ebt_ip6_to_numeric(const struct in6_addr *addrp);
 
 int do_command(int argc, char *argv[], int exec_style,
                struct ebt_u_replace *replace_);
+void ebt_print_rule(struct ebt_u_replace *repl, struct ebt_u_entry *e);
 
 struct ethertypeent *parseethertypebynumber(int type);
 
@@ -319,6 +572,8 @@ struct ethertypeent *parseethertypebynumber(int type);
 if (repl->selected_chain != -1)				\
 	_ch = repl->chains[repl->selected_chain];	\
 _ch;})
+#define EBT_HASH_INIT 2166136261U
+#define ebt_hash_field(h, field) ebt_hash(h, &(field), sizeof(field))
 #define ebt_print_bug(format, args...) \
    __ebt_print_bug(__FILE__, __LINE__, format, ##args)
 #define ebt_print_error(format,args...) __ebt_print_error(format, ##args);
@@ -342,7 +597,6 @@ __ret;})
 
 /* used for keeping the rule counters right during rule adds or deletes */
 #define CNT_NORM 	0
-#define CNT_DEL 	1
 #define CNT_ADD 	2
 #define CNT_CHANGE 	3
 
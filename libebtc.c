@@ -37,7 +37,8 @@
 #include <errno.h>
 
 static void decrease_chain_jumps(struct ebt_u_replace *replace);
-static int iterate_entries(struct ebt_u_replace *replace, int type);
+static int check_references(struct ebt_u_replace *replace, int chain_nr,
+			    int print_err);
 
 /* The standard names */
 const char *ebt_hooknames[NF_BR_NUMHOOKS] =
@@ -65,31 +66,45 @@ struct ebt_u_match *ebt_matches;
 struct ebt_u_watcher *ebt_watchers;
 struct ebt_u_target *ebt_targets;
 
+/* The extensions are also hashed on their name, the lookups are done for
+ * every rule that is retrieved from the kernel or printed */
+#define EXT_HASH_SIZE 64
+static struct ebt_u_match *match_hash[EXT_HASH_SIZE];
+static struct ebt_u_watcher *watcher_hash[EXT_HASH_SIZE];
+static struct ebt_u_target *target_hash[EXT_HASH_SIZE];
+static unsigned int nr_matches, nr_watchers, nr_targets;
+
+static unsigned int ext_hash(const char *name)
+{
+	return ebt_hash(EBT_HASH_INIT, name, strlen(name)) &
+	       (EXT_HASH_SIZE - 1);
+}
+
 /* Find the right structure belonging to a name */
 struct ebt_u_target *ebt_find_target(const char *name)
 {
-	struct ebt_u_target *t = ebt_targets;
+	struct ebt_u_target *t = target_hash[ext_hash(name)];
 
 	while (t && strcmp(t->name, name))
-		t = t->next;
+		t = t->name_next;
 	return t;
 }
 
 struct ebt_u_match *ebt_find_match(const char *name)
 {
-	struct ebt_u_match *m = ebt_matches;
+	struct ebt_u_match *m = match_hash[ext_hash(name)];
 
 	while (m && strcmp(m->name, name))
-		m = m->next;
+		m = m->name_next;
 	return m;
 }
 
 struct ebt_u_watcher *ebt_find_watcher(const char *name)
 {
-	struct ebt_u_watcher *w = ebt_watchers;
+	struct ebt_u_watcher *w = watcher_hash[ext_hash(name)];
 
 	while (w && strcmp(w->name, name))
-		w = w->next;
+		w = w->name_next;
 	return w;
 }
 
@@ -192,7 +207,9 @@ void __attribute__ ((destructor)) onexit()
 /* Get the table from the kernel or from a binary file
  * init: 1 = ask the kernel for the initial contents of a table, i.e. the
  *           way it looks when the table is insmod'ed
- *       0 = get the current data in the table */
+ *       0 = get the current data in the table
+ *       2 = only translate the chains, the rules can be read with
+ *           ebt_view_next_rule() */
 int ebt_get_kernel_table(struct ebt_u_replace *replace, int init)
 {
 	int ret;
@@ -250,8 +267,8 @@ void ebt_cleanup_replace(struct ebt_u_replace *replace)
 {
 	int i;
 	struct ebt_u_entries *entries;
-	struct ebt_cntchanges *cc1, *cc2;
 	struct ebt_u_entry *u_e1, *u_e2;
+	struct ebt_arena *arena;
 
 	replace->name[0] = '\0';
 	replace->valid_hooks = 0;
@@ -260,6 +277,7 @@ void ebt_cleanup_replace(struct ebt_u_replace *replace)
 	replace->flags = 0;
 	replace->command = 0;
 	replace->selected_chain = -1;
+	replace->loops_checked = 0;
 	free(replace->filename);
 	replace->filename = NULL;
 	free(replace->counters);
@@ -270,22 +288,31 @@ void ebt_cleanup_replace(struct ebt_u_replace *replace)
 			continue;
 		u_e1 = entries->entries->next;
 		while (u_e1 != entries->entries) {
-			ebt_free_u_entry(u_e1);
+			ebt_free_u_entry(replace, u_e1);
 			u_e2 = u_e1->next;
-			free(u_e1);
+			ebt_arena_free(replace, u_e1);
 			u_e1 = u_e2;
 		}
-		free(entries->entries);
-		free(entries);
+		ebt_free_rule_hash(entries);
+		ebt_arena_free(replace, entries->entries);
+		ebt_arena_free(replace, entries);
 		replace->chains[i] = NULL;
 	}
-	cc1 = replace->cc->next;
-	while (cc1 != replace->cc) {
-		cc2 = cc1->next;
-		free(cc1);
-		cc1 = cc2;
+	free(replace->cc);
+	replace->cc = NULL;
+	replace->num_cc = replace->max_cc = 0;
+	while (replace->arena) {
+		arena = replace->arena->next;
+		free(replace->arena);
+		replace->arena = arena;
 	}
-	replace->cc->next = replace->cc->prev = replace->cc;
+	ebt_free_view(replace);
+	free(replace->blob);
+	free(replace->blob_spare);
+	replace->blob = replace->blob_spare = NULL;
+	replace->blob_size = replace->blob_spare_size = 0;
+	free(replace->prepared);
+	replace->prepared = NULL;
 }
 
 /* Should be called, e.g., between 2 rule adds */
@@ -297,50 +324,94 @@ void ebt_reinit_extensions()
 	int size;
 
 	/* The init functions should determine by themselves whether they are
-	 * called for the first time or not (when necessary). */
+	 * called for the first time or not (when necessary).
+	 * do_command() marks an extension used before handing it an option,
+	 * so the data of the other extensions is still untouched. */
 	for (m = ebt_matches; m; m = m->next) {
-		if (m->used) {
-			size = EBT_ALIGN(m->size) + sizeof(struct ebt_entry_match);
-			m->m = (struct ebt_entry_match *)malloc(size);
-			if (!m->m)
-				ebt_print_memory();
-			strcpy(m->m->u.name, m->name);
-			m->m->match_size = EBT_ALIGN(m->size);
-			m->used = 0;
-		}
-		m->flags = 0; /* An error can occur before used is set, while flags is changed. */
+		if (!m->used)
+			continue;
+		size = EBT_ALIGN(m->size) + sizeof(struct ebt_entry_match);
+		m->m = (struct ebt_entry_match *)malloc(size);
+		if (!m->m)
+			ebt_print_memory();
+		strcpy(m->m->u.name, m->name);
+		m->m->match_size = EBT_ALIGN(m->size);
+		m->used = 0;
+		m->flags = 0;
 		m->init(m->m);
 	}
 	for (w = ebt_watchers; w; w = w->next) {
-		if (w->used) {
-			size = EBT_ALIGN(w->size) + sizeof(struct ebt_entry_watcher);
-			w->w = (struct ebt_entry_watcher *)malloc(size);
-			if (!w->w)
-				ebt_print_memory();
-			strcpy(w->w->u.name, w->name);
-			w->w->watcher_size = EBT_ALIGN(w->size);
-			w->used = 0;
-		}
+		if (!w->used)
+			continue;
+		size = EBT_ALIGN(w->size) + sizeof(struct ebt_entry_watcher);
+		w->w = (struct ebt_entry_watcher *)malloc(size);
+		if (!w->w)
+			ebt_print_memory();
+		strcpy(w->w->u.name, w->name);
+		w->w->watcher_size = EBT_ALIGN(w->size);
+		w->used = 0;
 		w->flags = 0;
 		w->init(w->w);
 	}
 	for (t = ebt_targets; t; t = t->next) {
-		if (t->used) {
-			size = EBT_ALIGN(t->size) + sizeof(struct ebt_entry_target);
-			t->t = (struct ebt_entry_target *)malloc(size);
-			if (!t->t)
-				ebt_print_memory();
-			strcpy(t->t->u.name, t->name);
-			t->t->target_size = EBT_ALIGN(t->size);
-			t->used = 0;
-		}
+		if (!t->used)
+			continue;
+		size = EBT_ALIGN(t->size) + sizeof(struct ebt_entry_target);
+		t->t = (struct ebt_entry_target *)malloc(size);
+		if (!t->t)
+			ebt_print_memory();
+		strcpy(t->t->u.name, t->name);
+		t->t->target_size = EBT_ALIGN(t->size);
+		t->used = 0;
 		t->flags = 0;
 		t->init(t->t);
 	}
 }
 
+#define ARENA_MIN_SIZE (64 * 1024)
+/* Allocate memory that lives until ebt_cleanup_replace(). Loading a table
+ * needs several allocations per rule, taking them from a few big blocks
+ * makes loading and freeing a big table a lot cheaper */
+void *ebt_arena_alloc(struct ebt_u_replace *replace, size_t size)
+{
+	struct ebt_arena *a = replace->arena;
+	size_t block;
+	void *p;
+
+	size = EBT_ALIGN(size);
+	if (!a || a->used + size > a->size) {
+		/* Each block is twice the size of the previous one,
+		 * so ebt_arena_free() has few blocks to look at */
+		block = a ? 2 * a->size : ARENA_MIN_SIZE;
+		while (block < EBT_ALIGN(sizeof(struct ebt_arena)) + size)
+			block *= 2;
+		a = (struct ebt_arena *)malloc(block);
+		if (!a)
+			ebt_print_memory();
+		a->size = block;
+		a->used = EBT_ALIGN(sizeof(struct ebt_arena));
+		a->next = replace->arena;
+		replace->arena = a;
+	}
+	p = (char *)a + a->used;
+	a->used += size;
+	return p;
+}
+
+/* Free memory that was either malloc'ed or taken from the arena, the latter
+ * is only given back by ebt_cleanup_replace() */
+void ebt_arena_free(struct ebt_u_replace *replace, void *p)
+{
+	struct ebt_arena *a;
+
+	for (a = replace->arena; a; a = a->next)
+		if ((char *)p >= (char *)a && (char *)p < (char *)a + a->size)
+			return;
+	free(p);
+}
+
 /* This doesn't free e, because the calling function might need e->next */
-void ebt_free_u_entry(struct ebt_u_entry *e)
+void ebt_free_u_entry(struct ebt_u_replace *replace, struct ebt_u_entry *e)
 {
 	struct ebt_u_match_list *m_l, *m_l2;
 	struct ebt_u_watcher_list *w_l, *w_l2;
@@ -348,18 +419,18 @@ void ebt_free_u_entry(struct ebt_u_entry *e)
 	m_l = e->m_list;
 	while (m_l) {
 		m_l2 = m_l->next;
-		free(m_l->m);
-		free(m_l);
+		ebt_arena_free(replace, m_l->m);
+		ebt_arena_free(replace, m_l);
 		m_l = m_l2;
 	}
 	w_l = e->w_list;
 	while (w_l) {
 		w_l2 = w_l->next;
-		free(w_l->w);
-		free(w_l);
+		ebt_arena_free(replace, w_l->w);
+		ebt_arena_free(replace, w_l);
 		w_l = w_l2;
 	}
-	free(e->t);
+	ebt_arena_free(replace, e->t);
 }
 
 static char *get_modprobe(void)
@@ -471,28 +542,91 @@ void ebt_change_policy(struct ebt_u_replace *replace, int policy)
 	entries->policy = policy;
 }
 
-void ebt_delete_cc(struct ebt_cntchanges *cc)
+/* The rules [begin, end) (counted over the whole table) got new counters,
+ * shift rules were inserted (> 0) or deleted (< 0) at begin, the deleted
+ * rules had n_old old counters */
+static void counters_dirty(struct ebt_u_replace *replace, unsigned int begin,
+			   unsigned int end, int shift, unsigned int n_old)
 {
-	if (cc->type == CNT_ADD) {
-		cc->prev->next = cc->next;
-		cc->next->prev = cc->prev;
-		free(cc);
-	} else
-		cc->type = CNT_DEL;
+	struct ebt_cntchanges *cc;
+	unsigned int i, j;
+
+	if (replace->cnt_hi > begin) {
+		if (shift < 0 && replace->cnt_hi < begin - shift)
+			replace->cnt_hi = begin;
+		else
+			replace->cnt_hi += shift;
+	}
+	replace->cnt_shift += shift;
+	if (replace->cnt_lo > begin)
+		replace->cnt_lo = begin;
+	if (replace->cnt_hi < end)
+		replace->cnt_hi = end;
+	if (!shift)
+		return;
+
+	/* Keep the deleted rules in front of the same rule */
+	cc = replace->cc;
+	for (i = replace->num_cc; i > 0 && cc[i - 1].pos > begin; i--) {
+		if (shift < 0 && cc[i - 1].pos < begin - shift)
+			cc[i - 1].pos = begin;
+		else
+			cc[i - 1].pos += shift;
+	}
+	if (shift > 0)
+		return;
+	/* The ones in front of and in between the rules that are deleted
+	 * now end up in front of the same rule */
+	for (j = i; i > 0 && cc[i - 1].pos == begin; i--)
+		n_old += cc[i - 1].n;
+	for (; j < replace->num_cc && cc[j].pos <= begin; j++)
+		n_old += cc[j].n;
+	if (!n_old)
+		return;
+	if (i == j) {
+		if (replace->num_cc == replace->max_cc) {
+			replace->max_cc = replace->max_cc ? 2 * replace->max_cc : 8;
+			cc = (struct ebt_cntchanges *)realloc(replace->cc,
+			   replace->max_cc * sizeof(struct ebt_cntchanges));
+			if (!cc)
+				ebt_print_memory();
+			replace->cc = cc;
+		}
+		memmove(cc + j + 1, cc + j, (replace->num_cc - j) *
+		   sizeof(struct ebt_cntchanges));
+		replace->num_cc++;
+		j++;
+	}
+	cc[i].pos = begin;
+	cc[i].n = n_old;
+	memmove(cc + i + 1, cc + j, (replace->num_cc - j) *
+	   sizeof(struct ebt_cntchanges));
+	replace->num_cc -= j - i - 1;
 }
 
-void ebt_empty_chain(struct ebt_u_entries *entries)
+void ebt_empty_chain(struct ebt_u_replace *replace,
+		     struct ebt_u_entries *entries)
 {
 	struct ebt_u_entry *u_e = entries->entries->next, *tmp;
+	unsigned int n_old = 0;
+
 	while (u_e != entries->entries) {
-		ebt_delete_cc(u_e->cc);
-		ebt_free_u_entry(u_e);
+		if (u_e->cnt_type != CNT_ADD)
+			n_old++;
+		ebt_unlink_reference(replace, u_e);
+		ebt_free_u_entry(replace, u_e);
 		tmp = u_e->next;
-		free(u_e);
+		ebt_arena_free(replace, u_e);
 		u_e = tmp;
 	}
+	counters_dirty(replace, entries->counter_offset,
+		       entries->counter_offset, -entries->nentries, n_old);
 	entries->entries->next = entries->entries->prev = entries->entries;
+	entries->index = NULL;
 	entries->nentries = 0;
+	ebt_free_rule_hash(entries);
+	entries->entries_size = sizeof(struct ebt_entries);
+	entries->dirty = 1;
 }
 
 /* Flush one chain or the complete table
@@ -513,7 +647,7 @@ void ebt_flush_chains(struct ebt_u_replace *replace)
 			if (!(entries = replace->chains[i]))
 				continue;
 			entries->counter_offset = 0;
-			ebt_empty_chain(entries);
+			ebt_empty_chain(replace, entries);
 		}
 		return;
 	}
@@ -531,10 +665,226 @@ void ebt_flush_chains(struct ebt_u_replace *replace)
 	}
 
 	entries = ebt_to_chain(replace);
-	ebt_empty_chain(entries);
+	ebt_empty_chain(replace, entries);
 }
 
 #define OPT_COUNT	0x1000 /* This value is also defined in ebtables.c */
+/* Returns 1 if the rule u_e in the chain equals new_entry, 0 otherwise.
+ * new_entry has pointers to ebt_u_{match,watcher,target} */
+static int rule_equals(struct ebt_u_replace *replace, struct ebt_u_entry *u_e,
+		       struct ebt_u_entry *new_entry)
+{
+	struct ebt_u_match_list *m_l, *m_l2;
+	struct ebt_u_match *m;
+	struct ebt_u_watcher_list *w_l, *w_l2;
+	struct ebt_u_watcher *w;
+	struct ebt_u_target *t = (struct ebt_u_target *)new_entry->t;
+	int j, k;
+
+	if (u_e->ethproto != new_entry->ethproto)
+		return 0;
+	if (strcmp(u_e->in, new_entry->in))
+		return 0;
+	if (strcmp(u_e->out, new_entry->out))
+		return 0;
+	if (strcmp(u_e->logical_in, new_entry->logical_in))
+		return 0;
+	if (strcmp(u_e->logical_out, new_entry->logical_out))
+		return 0;
+	if (new_entry->bitmask & EBT_SOURCEMAC &&
+	    memcmp(u_e->sourcemac, new_entry->sourcemac, ETH_ALEN))
+		return 0;
+	if (new_entry->bitmask & EBT_DESTMAC &&
+	    memcmp(u_e->destmac, new_entry->destmac, ETH_ALEN))
+		return 0;
+	if (new_entry->bitmask != u_e->bitmask ||
+	    new_entry->invflags != u_e->invflags)
+		return 0;
+	if (replace->flags & OPT_COUNT && (new_entry->cnt.pcnt !=
+	    u_e->cnt.pcnt || new_entry->cnt.bcnt != u_e->cnt.bcnt))
+		return 0;
+	/* Compare all matches */
+	m_l = new_entry->m_list;
+	j = 0;
+	while (m_l) {
+		m = (struct ebt_u_match *)(m_l->m);
+		m_l2 = u_e->m_list;
+		while (m_l2 && m_l2->match != m)
+			m_l2 = m_l2->next;
+		if (!m_l2 || !m->compare(m->m, m_l2->m))
+			return 0;
+		j++;
+		m_l = m_l->next;
+	}
+	/* Now be sure they have the same nr of matches */
+	k = 0;
+	m_l = u_e->m_list;
+	while (m_l) {
+		k++;
+		m_l = m_l->next;
+	}
+	if (j != k)
+		return 0;
+
+	/* Compare all watchers */
+	w_l = new_entry->w_list;
+	j = 0;
+	while (w_l) {
+		w = (struct ebt_u_watcher *)(w_l->w);
+		w_l2 = u_e->w_list;
+		while (w_l2 && w_l2->watcher != w)
+			w_l2 = w_l2->next;
+		if (!w_l2 || !w->compare(w->w, w_l2->w))
+			return 0;
+		j++;
+		w_l = w_l->next;
+	}
+	k = 0;
+	w_l = u_e->w_list;
+	while (w_l) {
+		k++;
+		w_l = w_l->next;
+	}
+	if (j != k)
+		return 0;
+	if (u_e->target != t)
+		return 0;
+	if (!t->compare(t->t, u_e->t))
+		return 0;
+	return 1;
+}
+
+/* FNV-1a, also used by the hash() functions of the extensions */
+unsigned int ebt_hash(unsigned int h, const void *data, int len)
+{
+	const unsigned char *p = data;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/* The extensions are known by their number, see ebt_register_match() */
+static unsigned int hash_extension(unsigned int id, unsigned int ext_hash)
+{
+	unsigned int h = ebt_hash_field(EBT_HASH_INIT, id);
+
+	return ebt_hash_field(h, ext_hash);
+}
+
+/* The fingerprint of a rule covers everything rule_equals() compares, except
+ * the counters. The data of an extension is only taken into account when the
+ * extension has a hash() function. Matches and watchers are added up, since
+ * their order doesn't matter for rule_equals().
+ * user == 1: e->t points to the ebt_u_target */
+static unsigned int rule_fingerprint(const struct ebt_u_entry *e, int user)
+{
+	struct ebt_u_match_list *m_l;
+	struct ebt_u_watcher_list *w_l;
+	struct ebt_entry_match *m;
+	struct ebt_entry_watcher *w;
+	struct ebt_entry_target *t;
+	struct ebt_u_target *u_t;
+	unsigned int h = EBT_HASH_INIT, sum = 0;
+
+	h = ebt_hash_field(h, e->ethproto);
+	h = ebt_hash(h, e->in, strlen(e->in) + 1);
+	h = ebt_hash(h, e->out, strlen(e->out) + 1);
+	h = ebt_hash(h, e->logical_in, strlen(e->logical_in) + 1);
+	h = ebt_hash(h, e->logical_out, strlen(e->logical_out) + 1);
+	h = ebt_hash_field(h, e->bitmask);
+	h = ebt_hash_field(h, e->invflags);
+	if (e->bitmask & EBT_SOURCEMAC)
+		h = ebt_hash(h, e->sourcemac, ETH_ALEN);
+	if (e->bitmask & EBT_DESTMAC)
+		h = ebt_hash(h, e->destmac, ETH_ALEN);
+
+	for (m_l = e->m_list; m_l; m_l = m_l->next) {
+		m = user ? m_l->match->m : m_l->m;
+		sum += hash_extension(m_l->match->id,
+		   m_l->match->hash ? m_l->match->hash(m) : 0);
+	}
+	h = ebt_hash_field(h, sum);
+	sum = 0;
+	for (w_l = e->w_list; w_l; w_l = w_l->next) {
+		w = user ? w_l->watcher->w : w_l->w;
+		sum += hash_extension(w_l->watcher->id,
+		   w_l->watcher->hash ? w_l->watcher->hash(w) : 0);
+	}
+	h = ebt_hash_field(h, sum);
+	if (user) {
+		u_t = (struct ebt_u_target *)e->t;
+		t = u_t->t;
+	} else {
+		t = e->t;
+		u_t = e->target;
+	}
+	sum = hash_extension(u_t->id, u_t->hash ? u_t->hash(t) : 0);
+	return ebt_hash_field(h, sum);
+}
+
+static void rule_hash_link(struct ebt_u_entries *entries, struct ebt_u_entry *e)
+{
+	struct ebt_u_entry **bucket;
+
+	bucket = &entries->hash[e->fingerprint & (entries->hash_size - 1)];
+	e->hash_next = *bucket;
+	*bucket = e;
+}
+
+static void rule_hash_build(struct ebt_u_entries *entries)
+{
+	struct ebt_u_entry *e;
+	unsigned int size = 64;
+
+	while (size < entries->nentries)
+		size *= 2;
+	free(entries->hash);
+	entries->hash = (struct ebt_u_entry **)calloc(size, sizeof(void *));
+	if (!entries->hash)
+		ebt_print_memory();
+	entries->hash_size = size;
+	for (e = entries->entries->next; e != entries->entries; e = e->next) {
+		e->fingerprint = rule_fingerprint(e, 0);
+		rule_hash_link(entries, e);
+	}
+}
+
+/* Keep the hash up to date for a rule that was just added to the chain */
+static void rule_hash_add(struct ebt_u_entries *entries, struct ebt_u_entry *e)
+{
+	if (!entries->hash_size)
+		return;
+	if (entries->nentries > entries->hash_size) {
+		rule_hash_build(entries);
+		return;
+	}
+	e->fingerprint = rule_fingerprint(e, 0);
+	rule_hash_link(entries, e);
+}
+
+static void rule_hash_del(struct ebt_u_entries *entries, struct ebt_u_entry *e)
+{
+	struct ebt_u_entry **p;
+
+	if (!entries->hash_size)
+		return;
+	p = &entries->hash[e->fingerprint & (entries->hash_size - 1)];
+	while (*p != e)
+		p = &(*p)->hash_next;
+	*p = e->hash_next;
+}
+
+/* Throw the hash away, it is rebuilt when needed */
+void ebt_free_rule_hash(struct ebt_u_entries *entries)
+{
+	free(entries->hash);
+	entries->hash = NULL;
+	entries->hash_size = 0;
+}
+
 /* Returns the rule number on success (starting from 0), -1 on failure
  *
  * This function expects the ebt_{match,watcher,target} members of new_entry
@@ -543,92 +893,64 @@ int ebt_check_rule_exists(struct ebt_u_replace *replace,
 			  struct ebt_u_entry *new_entry)
 {
 	struct ebt_u_entry *u_e;
-	struct ebt_u_match_list *m_l, *m_l2;
-	struct ebt_u_match *m;
-	struct ebt_u_watcher_list *w_l, *w_l2;
-	struct ebt_u_watcher *w;
-	struct ebt_u_target *t = (struct ebt_u_target *)new_entry->t;
 	struct ebt_u_entries *entries = ebt_to_chain(replace);
-	int i, j, k;
+	unsigned int fingerprint;
+	int i, rule_nr = -1;
 
-	u_e = entries->entries->next;
+	if (entries->nentries == 0)
+		return -1;
+	if (!entries->hash_size)
+		rule_hash_build(entries);
+	fingerprint = rule_fingerprint(new_entry, 1);
+	u_e = entries->hash[fingerprint & (entries->hash_size - 1)];
 	/* Check for an existing rule (if there are duplicate rules,
 	 * take the first occurance) */
-	for (i = 0; i < entries->nentries; i++, u_e = u_e->next) {
-		if (u_e->ethproto != new_entry->ethproto)
-			continue;
-		if (strcmp(u_e->in, new_entry->in))
-			continue;
-		if (strcmp(u_e->out, new_entry->out))
-			continue;
-		if (strcmp(u_e->logical_in, new_entry->logical_in))
-			continue;
-		if (strcmp(u_e->logical_out, new_entry->logical_out))
-			continue;
-		if (new_entry->bitmask & EBT_SOURCEMAC &&
-		    memcmp(u_e->sourcemac, new_entry->sourcemac, ETH_ALEN))
-			continue;
-		if (new_entry->bitmask & EBT_DESTMAC &&
-		    memcmp(u_e->destmac, new_entry->destmac, ETH_ALEN))
-			continue;
-		if (new_entry->bitmask != u_e->bitmask ||
-		    new_entry->invflags != u_e->invflags)
-			continue;
-		if (replace->flags & OPT_COUNT && (new_entry->cnt.pcnt !=
-		    u_e->cnt.pcnt || new_entry->cnt.bcnt != u_e->cnt.bcnt))
-			continue;
-		/* Compare all matches */
-		m_l = new_entry->m_list;
-		j = 0;
-		while (m_l) {
-			m = (struct ebt_u_match *)(m_l->m);
-			m_l2 = u_e->m_list;
-			while (m_l2 && strcmp(m_l2->m->u.name, m->m->u.name))
-				m_l2 = m_l2->next;
-			if (!m_l2 || !m->compare(m->m, m_l2->m))
-				goto letscontinue;
-			j++;
-			m_l = m_l->next;
-		}
-		/* Now be sure they have the same nr of matches */
-		k = 0;
-		m_l = u_e->m_list;
-		while (m_l) {
-			k++;
-			m_l = m_l->next;
-		}
-		if (j != k)
+	for (; u_e; u_e = u_e->hash_next) {
+		if (u_e->fingerprint != fingerprint ||
+		    !rule_equals(replace, u_e, new_entry))
 			continue;
+		i = ebt_entry_to_rule_nr(u_e);
+		if (rule_nr == -1 || i < rule_nr)
+			rule_nr = i;
+	}
+	return rule_nr;
+}
 
-		/* Compare all watchers */
-		w_l = new_entry->w_list;
-		j = 0;
-		while (w_l) {
-			w = (struct ebt_u_watcher *)(w_l->w);
-			w_l2 = u_e->w_list;
-			while (w_l2 && strcmp(w_l2->w->u.name, w->w->u.name))
-				w_l2 = w_l2->next;
-			if (!w_l2 || !w->compare(w->w, w_l2->w))
-				goto letscontinue;
-			j++;
-			w_l = w_l->next;
-		}
-		k = 0;
-		w_l = u_e->w_list;
-		while (w_l) {
-			k++;
-			w_l = w_l->next;
-		}
-		if (j != k)
-			continue;
-		if (strcmp(t->t->u.name, u_e->t->u.name))
-			continue;
-		if (!t->compare(t->t, u_e->t))
+/* Put the rule e, whose ebt_{match,watcher,target} pointers point to
+ * ebt_{match,watcher,target}, in front of rule rule_nr (starting from 0)
+ * of chain chain_nr */
+static void insert_rule(struct ebt_u_replace *replace, int chain_nr,
+			struct ebt_u_entry *e, int rule_nr)
+{
+	int i;
+	struct ebt_u_entry *u_e;
+	struct ebt_u_entries *entries = replace->chains[chain_nr];
+
+	/* Go to the right position in the chain */
+	u_e = ebt_rule_nr_to_entry(entries, rule_nr);
+	counters_dirty(replace, entries->counter_offset + rule_nr,
+		       entries->counter_offset + rule_nr + 1, 1, 0);
+	/* We're adding one rule */
+	replace->nentries++;
+	entries->nentries++;
+	/* Insert the rule */
+	e->next = u_e;
+	e->prev = u_e->prev;
+	u_e->prev->next = e;
+	u_e->prev = e;
+	ebt_index_insert(entries, e, rule_nr);
+	e->cnt_type = CNT_ADD;
+	e->cnt_change = 0;
+	ebt_link_reference(replace, entries, e);
+	rule_hash_add(entries, e);
+	entries->entries_size += ebt_entry_size(e);
+	entries->dirty = 1;
+	/* Update the counter_offset of chains behind this one */
+	for (i = chain_nr + 1; i < replace->num_chains; i++) {
+		if (!(entries = replace->chains[i]))
 			continue;
-		return i;
-letscontinue:;
+		entries->counter_offset++;
 	}
-	return -1;
 }
 
 /* Add a rule, rule_nr is the rule to update
@@ -646,12 +968,9 @@ letscontinue:;
  * don't reuse the new_entry after a successful call to ebt_add_rule() */
 void ebt_add_rule(struct ebt_u_replace *replace, struct ebt_u_entry *new_entry, int rule_nr)
 {
-	int i;
-	struct ebt_u_entry *u_e;
 	struct ebt_u_match_list *m_l;
 	struct ebt_u_watcher_list *w_l;
 	struct ebt_u_entries *entries = ebt_to_chain(replace);
-	struct ebt_cntchanges *cc, *new_cc;
 
 	if (rule_nr <= 0)
 		rule_nr += entries->nentries;
@@ -661,64 +980,21 @@ void ebt_add_rule(struct ebt_u_replace *replace, struct ebt_u_entry *new_entry,
 		ebt_print_error("The specified rule number is incorrect");
 		return;
 	}
-	/* Go to the right position in the chain */
-	if (rule_nr == entries->nentries)
-		u_e = entries->entries;
-	else {
-		u_e = entries->entries->next;
-		for (i = 0; i < rule_nr; i++)
-			u_e = u_e->next;
-	}
-	/* We're adding one rule */
-	replace->nentries++;
-	entries->nentries++;
-	/* Insert the rule */
-	new_entry->next = u_e;
-	new_entry->prev = u_e->prev;
-	u_e->prev->next = new_entry;
-	u_e->prev = new_entry;
-	new_cc = (struct ebt_cntchanges *)malloc(sizeof(struct ebt_cntchanges));
-	if (!new_cc)
-		ebt_print_memory();
-	new_cc->type = CNT_ADD;
-	new_cc->change = 0;
-	if (new_entry->next == entries->entries) {
-		for (i = replace->selected_chain+1; i < replace->num_chains; i++)
-			if (!replace->chains[i] || replace->chains[i]->nentries == 0)
-				continue;
-			else
-				break;
-		if (i == replace->num_chains)
-			cc = replace->cc;
-		else
-			cc = replace->chains[i]->entries->next->cc;
-	} else
-		cc = new_entry->next->cc;
-	new_cc->next = cc;
-	new_cc->prev = cc->prev;
-	cc->prev->next = new_cc;
-	cc->prev = new_cc;
-	new_entry->cc = new_cc;
 
 	/* Put the ebt_{match, watcher, target} pointers in place */
 	m_l = new_entry->m_list;
 	while (m_l) {
-		m_l->m = ((struct ebt_u_match *)m_l->m)->m;
+		m_l->m = m_l->match->m;
 		m_l = m_l->next;
 	}
 	w_l = new_entry->w_list;
 	while (w_l) {
-		w_l->w = ((struct ebt_u_watcher *)w_l->w)->w;
+		w_l->w = w_l->watcher->w;
 		w_l = w_l->next;
 	}
-	new_entry->t = ((struct ebt_u_target *)new_entry->t)->t;
-	/* Update the counter_offset of chains behind this one */
-	for (i = replace->selected_chain+1; i < replace->num_chains; i++) {
-		entries = replace->chains[i];
-		if (!(entries = replace->chains[i]))
-			continue;
-		entries->counter_offset++;
-	}
+	new_entry->target = (struct ebt_u_target *)new_entry->t;
+	new_entry->t = new_entry->target->t;
+	insert_rule(replace, replace->selected_chain, new_entry, rule_nr);
 }
 
 /* If *begin==*end==0 then find the rule corresponding to new_entry,
@@ -766,6 +1042,7 @@ void ebt_delete_rule(struct ebt_u_replace *replace,
 		     struct ebt_u_entry *new_entry, int begin, int end)
 {
 	int i,  nr_deletes;
+	unsigned int n_old = 0;
 	struct ebt_u_entry *u_e, *u_e2, *u_e3;
 	struct ebt_u_entries *entries = ebt_to_chain(replace);
 
@@ -776,21 +1053,27 @@ void ebt_delete_rule(struct ebt_u_replace *replace,
 	replace->nentries -= nr_deletes;
 	entries->nentries -= nr_deletes;
 	/* Go to the right position in the chain */
-	u_e = entries->entries->next;
-	for (i = 0; i < begin; i++)
-		u_e = u_e->next;
+	u_e = ebt_rule_nr_to_entry(entries, begin);
 	u_e3 = u_e->prev;
 	/* Remove the rules */
 	for (i = 0; i < nr_deletes; i++) {
 		u_e2 = u_e;
-		ebt_delete_cc(u_e2->cc);
+		ebt_index_remove(entries, u_e2);
+		rule_hash_del(entries, u_e2);
+		ebt_unlink_reference(replace, u_e2);
+		entries->entries_size -= ebt_entry_size(u_e2);
+		if (u_e2->cnt_type != CNT_ADD)
+			n_old++;
 		u_e = u_e->next;
 		/* Free everything */
-		ebt_free_u_entry(u_e2);
-		free(u_e2);
+		ebt_free_u_entry(replace, u_e2);
+		ebt_arena_free(replace, u_e2);
 	}
 	u_e3->next = u_e;
 	u_e->prev = u_e3;
+	entries->dirty = 1;
+	counters_dirty(replace, entries->counter_offset + begin,
+		       entries->counter_offset + begin, -nr_deletes, n_old);
 	/* Update the counter_offset of chains behind this one */
 	for (i = replace->selected_chain+1; i < replace->num_chains; i++) {
 		if (!(entries = replace->chains[i]))
@@ -819,17 +1102,17 @@ void ebt_change_counters(struct ebt_u_replace *replace,
 
 	if (check_and_change_rule_number(replace, new_entry, &begin, &end))
 		return;
-	u_e = entries->entries->next;
-	for (i = 0; i < begin; i++)
-		u_e = u_e->next;
+	counters_dirty(replace, entries->counter_offset + begin,
+		       entries->counter_offset + end + 1, 0, 0);
+	u_e = ebt_rule_nr_to_entry(entries, begin);
 	for (i = end-begin+1; i > 0; i--) {
 		if (mask % 3 == 0) {
 			u_e->cnt.pcnt = (*cnt).pcnt;
 			u_e->cnt_surplus.pcnt = 0;
 		} else {
 #ifdef EBT_DEBUG
-			if (u_e->cc->type != CNT_NORM)
-				ebt_print_bug("cc->type != CNT_NORM");
+			if (u_e->cnt_type != CNT_NORM)
+				ebt_print_bug("cnt_type != CNT_NORM");
 #endif
 			u_e->cnt_surplus.pcnt = (*cnt).pcnt;
 		}
@@ -839,18 +1122,70 @@ void ebt_change_counters(struct ebt_u_replace *replace,
 			u_e->cnt_surplus.bcnt = 0;
 		} else {
 #ifdef EBT_DEBUG
-			if (u_e->cc->type != CNT_NORM)
-				ebt_print_bug("cc->type != CNT_NORM");
+			if (u_e->cnt_type != CNT_NORM)
+				ebt_print_bug("cnt_type != CNT_NORM");
 #endif
 			u_e->cnt_surplus.bcnt = (*cnt).bcnt;
 		}
-		if (u_e->cc->type != CNT_ADD)
-			u_e->cc->type = CNT_CHANGE;
-		u_e->cc->change = mask;
+		if (u_e->cnt_type != CNT_ADD)
+			u_e->cnt_type = CNT_CHANGE;
+		u_e->cnt_change = mask;
 		u_e = u_e->next;
 	}
 }
 
+/* Change the matches of rule rule_nr of the selected chain in place, with
+ * the options of the matches of new_entry (--change-match). The rule keeps
+ * its place and counters. The first rule has rule nr 1, the last rule has
+ * rule nr -1, etc. The match lists of new_entry contain pointers to
+ * ebt_u_match. */
+void ebt_change_match(struct ebt_u_replace *replace,
+		      struct ebt_u_entry *new_entry, int rule_nr)
+{
+	struct ebt_u_entries *entries = ebt_to_chain(replace);
+	struct ebt_u_match_list *m_l, *m_l2;
+	struct ebt_entry_match *m;
+	struct ebt_u_entry *u_e;
+	int end = rule_nr;
+
+	if (check_and_change_rule_number(replace, new_entry, &rule_nr, &end))
+		return;
+	if (!new_entry->m_list) {
+		ebt_print_error("No match options specified");
+		return;
+	}
+	u_e = ebt_rule_nr_to_entry(entries, rule_nr);
+	for (m_l = new_entry->m_list; m_l; m_l = m_l->next) {
+		if (!m_l->match->change) {
+			ebt_print_error("Match %s can't be changed",
+					m_l->match->name);
+			return;
+		}
+		for (m_l2 = u_e->m_list; m_l2; m_l2 = m_l2->next)
+			if (m_l2->match == m_l->match)
+				break;
+		if (!m_l2) {
+			ebt_print_error("Rule %d has no %s match", rule_nr + 1,
+					m_l->match->name);
+			return;
+		}
+	}
+	rule_hash_del(entries, u_e);
+	for (m_l = new_entry->m_list; m_l; m_l = m_l->next) {
+		for (m_l2 = u_e->m_list; m_l2->match != m_l->match;
+		     m_l2 = m_l2->next);
+		m = m_l->match->change(m_l2->m, m_l->match->m);
+		if (!m)
+			break;
+		entries->entries_size += m->match_size;
+		entries->entries_size -= m_l2->m->match_size;
+		ebt_arena_free(replace, m_l2->m);
+		m_l2->m = m;
+		entries->dirty = 1;
+	}
+	rule_hash_add(entries, u_e);
+}
+
 /* If selected_chain == -1 then zero all counters,
  * otherwise, zero the counters of selected_chain */
 void ebt_zero_counters(struct ebt_u_replace *replace)
@@ -860,15 +1195,16 @@ void ebt_zero_counters(struct ebt_u_replace *replace)
 	int i;
 
 	if (!entries) {
+		counters_dirty(replace, 0, replace->nentries, 0, 0);
 		for (i = 0; i < replace->num_chains; i++) {
 			if (!(entries = replace->chains[i]))
 				continue;
 			next = entries->entries->next;
 			while (next != entries->entries) {
-				if (next->cc->type == CNT_NORM)
-					next->cc->type = CNT_CHANGE;
+				if (next->cnt_type == CNT_NORM)
+					next->cnt_type = CNT_CHANGE;
 				next->cnt.bcnt = next->cnt.pcnt = 0;
-				next->cc->change = 0;
+				next->cnt_change = 0;
 				next = next->next;
 			}
 		}
@@ -876,10 +1212,12 @@ void ebt_zero_counters(struct ebt_u_replace *replace)
 		if (entries->nentries == 0)
 			return;
 
+		counters_dirty(replace, entries->counter_offset,
+			       entries->counter_offset + entries->nentries, 0, 0);
 		next = entries->entries->next;
 		while (next != entries->entries) {
-			if (next->cc->type == CNT_NORM)
-				next->cc->type = CNT_CHANGE;
+			if (next->cnt_type == CNT_NORM)
+				next->cnt_type = CNT_CHANGE;
 			next->cnt.bcnt = next->cnt.pcnt = 0;
 			next = next->next;
 		}
@@ -901,12 +1239,20 @@ void ebt_new_chain(struct ebt_u_replace *replace, const char *name, int policy)
 	new->policy = policy;
 	new->counter_offset = replace->nentries;
 	new->hook_mask = 0;
+	new->checked_hook_mask = 0;
 	strcpy(new->name, name);
 	new->entries = (struct ebt_u_entry *)malloc(sizeof(struct ebt_u_entry));
 	if (!new->entries)
 		ebt_print_memory();
 	new->entries->next = new->entries->prev = new->entries;
+	new->index = NULL;
+	new->hash = NULL;
+	new->hash_size = 0;
+	new->entries_size = sizeof(struct ebt_entries);
+	new->dirty = 1;
 	new->kernel_start = NULL;
+	new->refs = NULL;
+	new->jumps = NULL;
 }
 
 /* returns -1 if the chain is referenced, 0 on success */
@@ -917,13 +1263,15 @@ static int ebt_delete_a_chain(struct ebt_u_replace *replace, int chain, int prin
 	 * also decrement jumps to a chain behind the
 	 * one we're deleting */
 	replace->selected_chain = chain;
-	if (ebt_check_for_references(replace, print_err))
+	if (ebt_check_for_references(replace, print_err)) {
+		replace->selected_chain = tmp;
 		return -1;
+	}
 	decrease_chain_jumps(replace);
 	ebt_flush_chains(replace);
 	replace->selected_chain = tmp;
-	free(replace->chains[chain]->entries);
-	free(replace->chains[chain]);
+	ebt_arena_free(replace, replace->chains[chain]->entries);
+	ebt_arena_free(replace, replace->chains[chain]);
 	memmove(replace->chains+chain, replace->chains+chain+1, (replace->num_chains-chain-1)*sizeof(void *));
 	replace->num_chains--;
 	return 0;
@@ -955,6 +1303,396 @@ void ebt_rename_chain(struct ebt_u_replace *replace, const char *name)
 	strcpy(entries->name, name);
 }
 
+/* Returns 1 if rule a of table ra does the same as rule b of table rb.
+ * Unlike rule_equals(), both rules are in a chain, the counters are not
+ * looked at and jumps to a udc are compared on the name of the udc. */
+static int same_rule(const struct ebt_u_replace *ra, const struct ebt_u_entry *a,
+		     const struct ebt_u_replace *rb, const struct ebt_u_entry *b)
+{
+	struct ebt_u_match_list *m_l, *m_l2;
+	struct ebt_u_watcher_list *w_l, *w_l2;
+	int j = 0, k = 0, va, vb;
+
+	if (a->ethproto != b->ethproto || a->bitmask != b->bitmask ||
+	    a->invflags != b->invflags)
+		return 0;
+	if (strcmp(a->in, b->in) || strcmp(a->out, b->out) ||
+	    strcmp(a->logical_in, b->logical_in) ||
+	    strcmp(a->logical_out, b->logical_out))
+		return 0;
+	if (a->bitmask & EBT_SOURCEMAC &&
+	    (memcmp(a->sourcemac, b->sourcemac, ETH_ALEN) ||
+	     memcmp(a->sourcemsk, b->sourcemsk, ETH_ALEN)))
+		return 0;
+	if (a->bitmask & EBT_DESTMAC &&
+	    (memcmp(a->destmac, b->destmac, ETH_ALEN) ||
+	     memcmp(a->destmsk, b->destmsk, ETH_ALEN)))
+		return 0;
+	for (m_l = b->m_list; m_l; m_l = m_l->next, j++) {
+		for (m_l2 = a->m_list; m_l2 && m_l2->match != m_l->match;
+		     m_l2 = m_l2->next);
+		if (!m_l2 || !m_l->match->compare(m_l2->m, m_l->m))
+			return 0;
+	}
+	for (m_l = a->m_list; m_l; m_l = m_l->next)
+		k++;
+	if (j != k)
+		return 0;
+	j = k = 0;
+	for (w_l = b->w_list; w_l; w_l = w_l->next, j++) {
+		for (w_l2 = a->w_list; w_l2 && w_l2->watcher != w_l->watcher;
+		     w_l2 = w_l2->next);
+		if (!w_l2 || !w_l->watcher->compare(w_l2->w, w_l->w))
+			return 0;
+	}
+	for (w_l = a->w_list; w_l; w_l = w_l->next)
+		k++;
+	if (j != k)
+		return 0;
+	if (a->target != b->target)
+		return 0;
+	if (!a->standard)
+		return a->target->compare(a->t, b->t);
+	va = ((struct ebt_standard_target *)a->t)->verdict;
+	vb = ((struct ebt_standard_target *)b->t)->verdict;
+	if (va < 0 || vb < 0)
+		return va == vb;
+	return !strcmp(ra->chains[va + NF_BR_NUMHOOKS]->name,
+		       rb->chains[vb + NF_BR_NUMHOOKS]->name);
+}
+
+static struct ebt_u_diff_op *diff_add(struct ebt_u_diff *diff, int type,
+				      const char *chain)
+{
+	struct ebt_u_diff_op *op;
+
+	if (diff->num_ops == diff->max_ops) {
+		diff->max_ops = diff->max_ops ? 2 * diff->max_ops : 64;
+		op = (struct ebt_u_diff_op *)realloc(diff->ops,
+		   diff->max_ops * sizeof(struct ebt_u_diff_op));
+		if (!op)
+			ebt_print_memory();
+		diff->ops = op;
+	}
+	op = diff->ops + diff->num_ops++;
+	memset(op, 0, sizeof(*op));
+	op->type = type;
+	op->chain = chain;
+	return op;
+}
+
+static void diff_delete(struct ebt_u_diff *diff, const char *chain,
+			int rule_nr, int n)
+{
+	struct ebt_u_diff_op *op = diff_add(diff, EBT_DIFF_DELETE, chain);
+
+	op->rule_nr = rule_nr;
+	op->n = n;
+}
+
+static void diff_insert(struct ebt_u_diff *diff, const char *chain,
+			int rule_nr, struct ebt_u_entry *e)
+{
+	struct ebt_u_diff_op *op = diff_add(diff, EBT_DIFF_INSERT, chain);
+
+	op->rule_nr = rule_nr;
+	op->e = e;
+}
+
+/* Adds the steps that turn the rules of chain a of from into the rules of
+ * chain b of diff->to, either can be NULL. The rules at the start and at the
+ * end that didn't change are skipped. The others are paired with an equal
+ * rule through a hash on their fingerprint (a rule that appears more than
+ * once is paired in order of appearance), the longest series of pairs that
+ * is in the same order in both chains is kept. That is the smallest number
+ * of deletes and inserts, unless the same rule appears several times in
+ * the part that changed. */
+static void diff_chain(struct ebt_u_diff *diff, struct ebt_u_replace *from,
+		       struct ebt_u_entries *a, struct ebt_u_entries *b)
+{
+	struct ebt_u_replace *to = diff->to;
+	struct ebt_u_entry **ar, **br, *e;
+	const char *chain = a ? a->name : b->name;
+	unsigned int *fp, f, size;
+	int n = a ? a->nentries : 0, m = b ? b->nentries : 0;
+	int i, j, k, p, s, na, mb, len, lo, hi, pos;
+	int *head, *next, *match, *tail, *prev;
+	char *keep;
+
+	if (!m) {
+		if (n)
+			diff_delete(diff, chain, 1, n);
+		return;
+	}
+	if (!n) {
+		for (e = b->entries->next; e != b->entries; e = e->next)
+			diff_insert(diff, chain, 0, e);
+		return;
+	}
+	ar = (struct ebt_u_entry **)malloc((n + m) * sizeof(void *));
+	if (!ar)
+		ebt_print_memory();
+	br = ar + n;
+	for (i = 0, e = a->entries->next; i < n; i++, e = e->next)
+		ar[i] = e;
+	for (j = 0, e = b->entries->next; j < m; j++, e = e->next)
+		br[j] = e;
+	for (p = 0; p < n && p < m && same_rule(from, ar[p], to, br[p]); p++);
+	for (s = 0; s < n - p && s < m - p &&
+	     same_rule(from, ar[n - 1 - s], to, br[m - 1 - s]); s++);
+	na = n - p - s;
+	mb = m - p - s;
+	ar += p;
+	br += p;
+	if (!mb) {
+		if (na)
+			diff_delete(diff, chain, p + 1, na);
+		goto free_ar;
+	}
+	if (!na) {
+		for (j = 0; j < mb; j++)
+			diff_insert(diff, chain, s ? p + j + 1 : 0, br[j]);
+		goto free_ar;
+	}
+
+	for (size = 64; size < 2 * na; size *= 2);
+	head = (int *)malloc((size + na + 3 * mb) * sizeof(int));
+	fp = (unsigned int *)malloc(na * sizeof(unsigned int));
+	keep = (char *)calloc(mb, 1);
+	if (!head || !fp || !keep)
+		ebt_print_memory();
+	next = head + size;
+	match = next + na;
+	tail = match + mb;
+	prev = tail + mb;
+	memset(head, -1, size * sizeof(int));
+	/* The bucket lists are in chain order */
+	for (i = na - 1; i >= 0; i--) {
+		fp[i] = rule_fingerprint(ar[i], 0);
+		next[i] = head[fp[i] & (size - 1)];
+		head[fp[i] & (size - 1)] = i;
+	}
+	for (j = 0; j < mb; j++) {
+		int *pi;
+
+		f = rule_fingerprint(br[j], 0);
+		match[j] = -1;
+		for (pi = &head[f & (size - 1)]; *pi != -1; pi = &next[*pi]) {
+			if (fp[*pi] != f ||
+			    !same_rule(from, ar[*pi], to, br[j]))
+				continue;
+			match[j] = *pi;
+			*pi = next[*pi];
+			break;
+		}
+	}
+	/* Longest increasing subsequence of match[], tail[k] is the pair
+	 * that ends the best series of length k + 1 found so far */
+	len = 0;
+	for (j = 0; j < mb; j++) {
+		if (match[j] == -1)
+			continue;
+		lo = 0;
+		hi = len;
+		while (lo < hi) {
+			k = (lo + hi) / 2;
+			if (match[tail[k]] < match[j])
+				lo = k + 1;
+			else
+				hi = k;
+		}
+		prev[j] = lo ? tail[lo - 1] : -1;
+		tail[lo] = j;
+		if (lo == len)
+			len++;
+	}
+	for (j = len ? tail[len - 1] : -1; j != -1; j = prev[j])
+		keep[j] = 1;
+
+	/* Between two kept rules, first delete the old rules, then insert
+	 * the new ones. Rules inserted at the end are appended. */
+	pos = p + 1;
+	i = j = 0;
+	while (1) {
+		for (k = j; k < mb && !keep[k]; k++);
+		lo = k < mb ? match[k] : na;
+		if (lo > i)
+			diff_delete(diff, chain, pos, lo - i);
+		for (; j < k; j++)
+			diff_insert(diff, chain, k == mb && !s ? 0 : pos++,
+				    br[j]);
+		if (k == mb)
+			break;
+		i = lo + 1;
+		j = k + 1;
+		pos++;
+	}
+	free(head);
+	free(fp);
+	free(keep);
+free_ar:
+	free(ar - p);
+}
+
+/* Computes the steps that turn table from into table to (both retrieved
+ * with ebt_get_kernel_table(replace, 0 or 1), for the same table), see
+ * struct ebt_u_diff. The udc's that are in both tables stay where they are
+ * in from, new ones are added at the end. Free the result with
+ * ebt_free_diff(). Returns -1 on error. */
+int ebt_diff_tables(struct ebt_u_replace *from, struct ebt_u_replace *to,
+		    struct ebt_u_diff *diff)
+{
+	struct ebt_u_entries *a, *b;
+	int i;
+
+	memset(diff, 0, sizeof(*diff));
+	diff->to = to;
+	if (strcmp(from->name, to->name) || from->valid_hooks != to->valid_hooks) {
+		ebt_print_error("Can't compare table '%s' with table '%s'",
+				from->name, to->name);
+		return -1;
+	}
+	for (i = NF_BR_NUMHOOKS; i < to->num_chains; i++)
+		if ((b = to->chains[i]) && !ebt_name_to_chain(from, b->name))
+			diff_add(diff, EBT_DIFF_NEW_CHAIN, b->name)->policy =
+			   b->policy;
+	for (i = 0; i < from->num_chains; i++)
+		if ((a = from->chains[i]) &&
+		    (b = ebt_name_to_chain(to, a->name)) &&
+		    a->policy != b->policy)
+			diff_add(diff, EBT_DIFF_POLICY, a->name)->policy =
+			   b->policy;
+	for (i = 0; i < from->num_chains; i++)
+		if ((a = from->chains[i]))
+			diff_chain(diff, from, a, ebt_name_to_chain(to, a->name));
+	for (i = NF_BR_NUMHOOKS; i < to->num_chains; i++)
+		if ((b = to->chains[i]) && !ebt_name_to_chain(from, b->name))
+			diff_chain(diff, from, NULL, b);
+	/* Their rules are gone, so nothing refers to them anymore */
+	for (i = from->num_chains - 1; i >= NF_BR_NUMHOOKS; i--)
+		if ((a = from->chains[i]) && !ebt_name_to_chain(to, a->name))
+			diff_add(diff, EBT_DIFF_DEL_CHAIN, a->name);
+	return 0;
+}
+
+void ebt_free_diff(struct ebt_u_diff *diff)
+{
+	free(diff->ops);
+	diff->ops = NULL;
+	diff->num_ops = diff->max_ops = 0;
+}
+
+/* Copy rule e of table from, with its counters, to put it in a chain of
+ * replace */
+static struct ebt_u_entry *copy_rule(struct ebt_u_replace *replace,
+				     const struct ebt_u_replace *from,
+				     const struct ebt_u_entry *e)
+{
+	struct ebt_u_entry *new;
+	struct ebt_u_match_list *m_l, **m_l2;
+	struct ebt_u_watcher_list *w_l, **w_l2;
+	struct ebt_standard_target *st;
+	int size;
+
+	new = (struct ebt_u_entry *)malloc(sizeof(struct ebt_u_entry));
+	if (!new)
+		ebt_print_memory();
+	memcpy(new, e, sizeof(struct ebt_u_entry));
+	m_l2 = &new->m_list;
+	for (m_l = e->m_list; m_l; m_l = m_l->next) {
+		*m_l2 = (struct ebt_u_match_list *)
+		   malloc(sizeof(struct ebt_u_match_list));
+		size = sizeof(struct ebt_entry_match) + m_l->m->match_size;
+		if (!*m_l2 || !((*m_l2)->m = (struct ebt_entry_match *)malloc(size)))
+			ebt_print_memory();
+		memcpy((*m_l2)->m, m_l->m, size);
+		(*m_l2)->match = m_l->match;
+		m_l2 = &(*m_l2)->next;
+	}
+	*m_l2 = NULL;
+	w_l2 = &new->w_list;
+	for (w_l = e->w_list; w_l; w_l = w_l->next) {
+		*w_l2 = (struct ebt_u_watcher_list *)
+		   malloc(sizeof(struct ebt_u_watcher_list));
+		size = sizeof(struct ebt_entry_watcher) + w_l->w->watcher_size;
+		if (!*w_l2 || !((*w_l2)->w = (struct ebt_entry_watcher *)malloc(size)))
+			ebt_print_memory();
+		memcpy((*w_l2)->w, w_l->w, size);
+		(*w_l2)->watcher = w_l->watcher;
+		w_l2 = &(*w_l2)->next;
+	}
+	*w_l2 = NULL;
+	size = sizeof(struct ebt_entry_target) + e->t->target_size;
+	if (!(new->t = (struct ebt_entry_target *)malloc(size)))
+		ebt_print_memory();
+	memcpy(new->t, e->t, size);
+	st = (struct ebt_standard_target *)new->t;
+	if (e->standard && st->verdict >= 0)
+		st->verdict = ebt_get_chainnr(replace, from->chains[st->verdict +
+		   NF_BR_NUMHOOKS]->name) - NF_BR_NUMHOOKS;
+	new->cnt_surplus.pcnt = new->cnt_surplus.bcnt = 0;
+	return new;
+}
+
+/* Apply the steps of diff to the table it was computed for, the from
+ * argument of ebt_diff_tables(). Like after ebtables -D and -I, the rules
+ * that stay keep their counters when the table is delivered, the inserted
+ * rules get the counters of their copy in diff->to. The rules of diff->to
+ * should have passed ebt_check_rules(). Returns -1 on error. */
+int ebt_patch_table(struct ebt_u_replace *replace,
+		    const struct ebt_u_diff *diff)
+{
+	struct ebt_u_diff_op *op;
+	const char *chain = NULL;
+	int selected_chain = replace->selected_chain, chain_nr = -1, rule_nr;
+	unsigned int i;
+
+	for (i = 0; i < diff->num_ops; i++) {
+		op = diff->ops + i;
+		if (op->type == EBT_DIFF_NEW_CHAIN) {
+			if (ebt_get_chainnr(replace, op->chain) != -1) {
+				ebt_print_error("Chain %s already exists",
+						op->chain);
+				break;
+			}
+			ebt_new_chain(replace, op->chain, op->policy);
+			continue;
+		}
+		/* The steps of a chain come together */
+		if (op->chain != chain) {
+			chain = op->chain;
+			if ((chain_nr = ebt_get_chainnr(replace, chain)) == -1) {
+				ebt_print_error("Chain '%s' doesn't exist",
+						chain);
+				break;
+			}
+		}
+		replace->selected_chain = chain_nr;
+		if (op->type == EBT_DIFF_POLICY)
+			replace->chains[chain_nr]->policy = op->policy;
+		else if (op->type == EBT_DIFF_DELETE)
+			ebt_delete_rule(replace, NULL, op->rule_nr,
+					op->rule_nr + op->n - 1);
+		else if (op->type == EBT_DIFF_INSERT) {
+			rule_nr = op->rule_nr ? op->rule_nr - 1 :
+				  replace->chains[chain_nr]->nentries;
+			if (rule_nr > replace->chains[chain_nr]->nentries) {
+				ebt_print_error("The specified rule number is incorrect");
+				break;
+			}
+			insert_rule(replace, chain_nr,
+				    copy_rule(replace, diff->to, op->e), rule_nr);
+		} else if (op->type == EBT_DIFF_DEL_CHAIN) {
+			ebt_delete_chain(replace);
+			chain = NULL;
+		}
+		if (ebt_errormsg[0] != '\0')
+			break;
+	}
+	replace->selected_chain = selected_chain;
+	return i < diff->num_ops ? -1 : 0;
+}
+
 
            /*
 *************************
@@ -978,6 +1716,183 @@ void ebt_double_chains(struct ebt_u_replace *replace)
 	replace->chains = new;
 }
 
+/* Besides the doubly linked list, the rules of a chain are kept in a treap
+ * that is ordered by rule number (an in-order walk of the treap gives the
+ * rules in chain order). The idx_size member holds the number of rules in
+ * the subtree, so the n'th rule can be found, inserted or removed in
+ * O(log n) instead of walking the list from the start of the chain. */
+#define IDX_SIZE(e) ((e) ? (e)->idx_size : 0)
+
+static unsigned int index_random(void)
+{
+	static unsigned int seed = 0x2545F491;
+
+	/* xorshift, only used to keep the treap balanced */
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+static void index_update(struct ebt_u_entry *e)
+{
+	e->idx_size = 1 + IDX_SIZE(e->idx_left) + IDX_SIZE(e->idx_right);
+	if (e->idx_left)
+		e->idx_left->idx_parent = e;
+	if (e->idx_right)
+		e->idx_right->idx_parent = e;
+}
+
+/* Split the treap t in l (the first n rules) and r (the other rules) */
+static void index_split(struct ebt_u_entry *t, int n, struct ebt_u_entry **l,
+			struct ebt_u_entry **r)
+{
+	if (!t) {
+		*l = *r = NULL;
+		return;
+	}
+	if (IDX_SIZE(t->idx_left) < n) {
+		index_split(t->idx_right, n - IDX_SIZE(t->idx_left) - 1,
+			    &t->idx_right, r);
+		*l = t;
+	} else {
+		index_split(t->idx_left, n, l, &t->idx_left);
+		*r = t;
+	}
+	index_update(t);
+}
+
+/* Join two treaps, all rules of a come before the rules of b */
+static struct ebt_u_entry *index_merge(struct ebt_u_entry *a,
+				       struct ebt_u_entry *b)
+{
+	if (!a)
+		return b;
+	if (!b)
+		return a;
+	if (a->idx_prio > b->idx_prio) {
+		a->idx_right = index_merge(a->idx_right, b);
+		index_update(a);
+		return a;
+	}
+	b->idx_left = index_merge(a, b->idx_left);
+	index_update(b);
+	return b;
+}
+
+/* Returns the rule with number rule_nr (starting from 0), or the chain's
+ * list head when rule_nr equals the number of rules in the chain */
+struct ebt_u_entry *ebt_rule_nr_to_entry(const struct ebt_u_entries *entries,
+					 int rule_nr)
+{
+	struct ebt_u_entry *e = entries->index;
+	int left;
+
+	while (e) {
+		left = IDX_SIZE(e->idx_left);
+		if (rule_nr == left)
+			return e;
+		if (rule_nr < left)
+			e = e->idx_left;
+		else {
+			rule_nr -= left + 1;
+			e = e->idx_right;
+		}
+	}
+	return entries->entries;
+}
+
+/* Returns the rule number (starting from 0) of a rule in a chain */
+int ebt_entry_to_rule_nr(const struct ebt_u_entry *e)
+{
+	int rule_nr = IDX_SIZE(e->idx_left);
+
+	for (; e->idx_parent; e = e->idx_parent)
+		if (e->idx_parent->idx_right == e)
+			rule_nr += IDX_SIZE(e->idx_parent->idx_left) + 1;
+	return rule_nr;
+}
+
+/* Put the rule in the index so that it gets rule number rule_nr. This
+ * doesn't touch the linked list, the caller takes care of that. */
+void ebt_index_insert(struct ebt_u_entries *entries, struct ebt_u_entry *e,
+		      int rule_nr)
+{
+	struct ebt_u_entry *l, *r;
+
+	e->idx_left = e->idx_right = NULL;
+	e->idx_size = 1;
+	e->idx_prio = index_random();
+	index_split(entries->index, rule_nr, &l, &r);
+	entries->index = index_merge(index_merge(l, e), r);
+	entries->index->idx_parent = NULL;
+}
+
+void ebt_index_remove(struct ebt_u_entries *entries, struct ebt_u_entry *e)
+{
+	struct ebt_u_entry *parent = e->idx_parent, *sub;
+
+	sub = index_merge(e->idx_left, e->idx_right);
+	if (sub)
+		sub->idx_parent = parent;
+	if (!parent)
+		entries->index = sub;
+	else if (parent->idx_left == e)
+		parent->idx_left = sub;
+	else
+		parent->idx_right = sub;
+	for (; parent; parent = parent->idx_parent)
+		parent->idx_size--;
+}
+
+/* The rules jumping to a udc are kept in a list in the udc, so finding out
+ * if a chain is referenced and renumbering the jumps when a chain is deleted
+ * don't need to look at every rule of the table. They are also kept in a
+ * list in their own chain (entries), for ebt_check_for_loops(). This also
+ * fills in e->standard, call it when the rule is put in a chain. */
+void ebt_link_reference(struct ebt_u_replace *replace,
+			struct ebt_u_entries *entries, struct ebt_u_entry *e)
+{
+	struct ebt_u_entries *udc;
+	int verdict;
+
+	e->standard = !strcmp(e->t->u.name, EBT_STANDARD_TARGET);
+	e->ref_pprev = NULL;
+	if (!e->standard)
+		return;
+	verdict = ((struct ebt_standard_target *)e->t)->verdict;
+	if (verdict < 0)
+		return;
+	udc = replace->chains[verdict + NF_BR_NUMHOOKS];
+	e->ref_next = udc->refs;
+	if (udc->refs)
+		udc->refs->ref_pprev = &e->ref_next;
+	udc->refs = e;
+	e->ref_pprev = &udc->refs;
+	e->jump_next = entries->jumps;
+	if (entries->jumps)
+		entries->jumps->jump_pprev = &e->jump_next;
+	entries->jumps = e;
+	e->jump_pprev = &entries->jumps;
+	replace->loops_checked = 0;
+}
+
+/* Call this before the rule is removed from its chain */
+void ebt_unlink_reference(struct ebt_u_replace *replace,
+			  struct ebt_u_entry *e)
+{
+	if (!e->ref_pprev)
+		return;
+	*e->ref_pprev = e->ref_next;
+	if (e->ref_next)
+		e->ref_next->ref_pprev = e->ref_pprev;
+	e->ref_pprev = NULL;
+	*e->jump_pprev = e->jump_next;
+	if (e->jump_next)
+		e->jump_next->jump_pprev = e->jump_pprev;
+	replace->loops_checked = 0;
+}
+
 /* Executes the final_check() function for all extensions used by the rule
  * ebt_check_for_loops should have been executed earlier, to make sure the
  * hook_mask is correct. The time argument to final_check() is set to 1,
@@ -987,30 +1902,24 @@ void ebt_do_final_checks(struct ebt_u_replace *replace, struct ebt_u_entry *e,
 {
 	struct ebt_u_match_list *m_l;
 	struct ebt_u_watcher_list *w_l;
-	struct ebt_u_target *t;
-	struct ebt_u_match *m;
-	struct ebt_u_watcher *w;
 
 	m_l = e->m_list;
 	w_l = e->w_list;
 	while (m_l) {
-		m = ebt_find_match(m_l->m->u.name);
-		m->final_check(e, m_l->m, replace->name,
+		m_l->match->final_check(e, m_l->m, replace->name,
 		   entries->hook_mask, 1);
 		if (ebt_errormsg[0] != '\0')
 			return;
 		m_l = m_l->next;
 	}
 	while (w_l) {
-		w = ebt_find_watcher(w_l->w->u.name);
-		w->final_check(e, w_l->w, replace->name,
+		w_l->watcher->final_check(e, w_l->w, replace->name,
 		   entries->hook_mask, 1);
 		if (ebt_errormsg[0] != '\0')
 			return;
 		w_l = w_l->next;
 	}
-	t = ebt_find_target(e->t->u.name);
-	t->final_check(e, e->t, replace->name,
+	e->target->final_check(e, e->t, replace->name,
 	   entries->hook_mask, 1);
 }
 
@@ -1018,10 +1927,7 @@ void ebt_do_final_checks(struct ebt_u_replace *replace, struct ebt_u_entry *e,
  * print_err: 0 (resp. 1) = don't (resp. do) print error when referenced */
 int ebt_check_for_references(struct ebt_u_replace *replace, int print_err)
 {
-	if (print_err)
-		return iterate_entries(replace, 1);
-	else
-		return iterate_entries(replace, 2);
+	return check_references(replace, replace->selected_chain, print_err);
 }
 
 /* chain_nr: nr of the udc (>= NF_BR_NUMHOOKS)
@@ -1030,36 +1936,40 @@ int ebt_check_for_references(struct ebt_u_replace *replace, int print_err)
 int ebt_check_for_references2(struct ebt_u_replace *replace, int chain_nr,
                               int print_err)
 {
-	int tmp = replace->selected_chain, ret;
-
-	replace->selected_chain = chain_nr;
-	if (print_err)
-		ret = iterate_entries(replace, 1);
-	else
-		ret = iterate_entries(replace, 2);
-	replace->selected_chain = tmp;
-	return ret;
+	return check_references(replace, chain_nr, print_err);
 }
 
 struct ebt_u_stack
 {
 	int chain_nr;
-	int n;
+	/* the next jump of the chain to follow */
 	struct ebt_u_entry *e;
-	struct ebt_u_entries *entries;
 };
 
+#define CHAIN_UNSEEN 0
+#define CHAIN_ON_STACK 1
+#define CHAIN_DONE 2
+
 /* Checks for loops
  * As a by-product, the hook_mask member of each chain is filled in
  * correctly. The check functions of the extensions need this hook_mask
- * to know from which standard chains they can be called. */
+ * to know from which standard chains they can be called.
+ * Only the jumps to udc's are looked at (see ebt_u_entries.jumps): one
+ * depth-first walk from the base chains finds the loops, the order in which
+ * it finishes the chains, reversed, is the order in which the hook_mask can
+ * be handed down the jumps. Nothing is done when no jump was added or
+ * removed since the last time. */
 void ebt_check_for_loops(struct ebt_u_replace *replace)
 {
-	int chain_nr , i, j , k, sp = 0, verdict;
-	struct ebt_u_entries *entries, *entries2;
-	struct ebt_u_stack *stack = NULL;
+	int i, sp = 0, nr_done = 0, chain_nr, udc;
+	struct ebt_u_entries *entries;
+	struct ebt_u_stack *stack;
 	struct ebt_u_entry *e;
+	unsigned char *state;
+	int *done;
 
+	if (replace->loops_checked)
+		return;
 	/* Initialize hook_mask to 0 */
 	for (i = 0; i < replace->num_chains; i++) {
 		if (!(entries = replace->chains[i]))
@@ -1071,66 +1981,98 @@ void ebt_check_for_loops(struct ebt_u_replace *replace)
 		else
 			entries->hook_mask = 0;
 	}
-	if (replace->num_chains == NF_BR_NUMHOOKS)
+	if (replace->num_chains == NF_BR_NUMHOOKS) {
+		replace->loops_checked = 1;
 		return;
-	stack = (struct ebt_u_stack *)malloc((replace->num_chains - NF_BR_NUMHOOKS) * sizeof(struct ebt_u_stack));
-	if (!stack)
+	}
+	/* A base chain is never jumped to, so the stack holds at most one */
+	stack = (struct ebt_u_stack *)malloc((replace->num_chains - NF_BR_NUMHOOKS + 1) * sizeof(struct ebt_u_stack));
+	done = (int *)malloc(replace->num_chains * sizeof(int));
+	state = (unsigned char *)calloc(replace->num_chains, 1);
+	if (!stack || !done || !state)
 		ebt_print_memory();
 
-	/* Check for loops, starting from every base chain */
 	for (i = 0; i < NF_BR_NUMHOOKS; i++) {
-		if (!(entries = replace->chains[i]))
+		if (!replace->chains[i])
 			continue;
-		chain_nr = i;
-
-		e = entries->entries->next;
-		for (j = 0; j < entries->nentries; j++) {
-			if (strcmp(e->t->u.name, EBT_STANDARD_TARGET))
-				goto letscontinue;
-			verdict = ((struct ebt_standard_target *)(e->t))->verdict;
-			if (verdict < 0)
-				goto letscontinue;
-			/* Now see if we've been here before */
-			for (k = 0; k < sp; k++)
-				if (stack[k].chain_nr == verdict + NF_BR_NUMHOOKS) {
-					ebt_print_error("Loop from chain '%s' to chain '%s'",
-					   replace->chains[chain_nr]->name,
-					   replace->chains[stack[k].chain_nr]->name);
-					goto free_stack;
-				}
-			entries2 = replace->chains[verdict + NF_BR_NUMHOOKS];
-			/* check if we've dealt with this chain already */
-			if (entries2->hook_mask & (1<<i))
-				goto letscontinue;
-			entries2->hook_mask |= entries->hook_mask;
-			/* Jump to the chain, make sure we know how to get back */
-			stack[sp].chain_nr = chain_nr;
-			stack[sp].n = j;
-			stack[sp].entries = entries;
-			stack[sp].e = e;
+		state[i] = CHAIN_ON_STACK;
+		stack[0].chain_nr = i;
+		stack[0].e = replace->chains[i]->jumps;
+		sp = 1;
+		while (sp) {
+			chain_nr = stack[sp - 1].chain_nr;
+			if (!(e = stack[sp - 1].e)) {
+				/* All jumps of the chain are dealt with */
+				state[chain_nr] = CHAIN_DONE;
+				done[nr_done++] = chain_nr;
+				sp--;
+				continue;
+			}
+			stack[sp - 1].e = e->jump_next;
+			udc = ((struct ebt_standard_target *)e->t)->verdict +
+			      NF_BR_NUMHOOKS;
+			if (state[udc] == CHAIN_ON_STACK) {
+				ebt_print_error("Loop from chain '%s' to chain '%s'",
+				   replace->chains[chain_nr]->name,
+				   replace->chains[udc]->name);
+				goto free_stack;
+			}
+			if (state[udc] == CHAIN_DONE)
+				continue;
+			state[udc] = CHAIN_ON_STACK;
+			stack[sp].chain_nr = udc;
+			stack[sp].e = replace->chains[udc]->jumps;
 			sp++;
-			j = -1;
-			e = entries2->entries->next;
-			chain_nr = verdict + NF_BR_NUMHOOKS;
-			entries = entries2;
-			continue;
-letscontinue:
-			e = e->next;
 		}
-		/* We are at the end of a standard chain */
-		if (sp == 0)
-			continue;
-		/* Go back to the chain one level higher */
-		sp--;
-		j = stack[sp].n;
-		chain_nr = stack[sp].chain_nr;
-		e = stack[sp].e;
-		entries = stack[sp].entries;
-		goto letscontinue;
 	}
+
+	/* A chain is done after all chains it jumps to, so going backwards
+	 * every chain has its final hook_mask before it is handed down */
+	while (nr_done--) {
+		entries = replace->chains[done[nr_done]];
+		for (e = entries->jumps; e; e = e->jump_next) {
+			udc = ((struct ebt_standard_target *)e->t)->verdict +
+			      NF_BR_NUMHOOKS;
+			replace->chains[udc]->hook_mask |= entries->hook_mask;
+		}
+	}
+	replace->loops_checked = 1;
 free_stack:
 	free(stack);
-	return;
+	free(done);
+	free(state);
+}
+
+/* Executes the final checks for the rules of the chains whose hook_mask
+ * changed since their rules were last checked, after checking for loops.
+ * The rules of the other chains were checked with the hook_mask they have
+ * now, when they were added or when the table was retrieved. In daemon
+ * mode, do_command() leaves this to ebt_deliver_table(), so a whole batch
+ * of commands costs one pass over the changed chains. */
+void ebt_check_rules(struct ebt_u_replace *replace)
+{
+	struct ebt_u_entries *entries;
+	struct ebt_u_entry *e;
+	int i;
+
+	ebt_check_for_loops(replace);
+	if (ebt_errormsg[0] != '\0')
+		return;
+	for (i = 0; i < replace->num_chains; i++) {
+		if (!(entries = replace->chains[i]) ||
+		    entries->hook_mask == entries->checked_hook_mask)
+			continue;
+		for (e = entries->entries->next; e != entries->entries;
+		     e = e->next) {
+			/* Userspace extensions use host endian */
+			e->ethproto = ntohs(e->ethproto);
+			ebt_do_final_checks(replace, e, entries);
+			e->ethproto = htons(e->ethproto);
+			if (ebt_errormsg[0] != '\0')
+				return;
+		}
+		entries->checked_hook_mask = entries->hook_mask;
+	}
 }
 
 /* The user will use the match, so put it in new_entry. The ebt_u_match
@@ -1150,6 +2092,7 @@ void ebt_add_match(struct ebt_u_entry *new_entry, struct ebt_u_match *m)
 	*m_list = new;
 	new->next = NULL;
 	new->m = (struct ebt_entry_match *)m;
+	new->match = m;
 }
 
 void ebt_add_watcher(struct ebt_u_entry *new_entry, struct ebt_u_watcher *w)
@@ -1165,6 +2108,7 @@ void ebt_add_watcher(struct ebt_u_entry *new_entry, struct ebt_u_watcher *w)
 	*w_list = new;
 	new->next = NULL;
 	new->w = (struct ebt_entry_watcher *)w;
+	new->watcher = w;
 }
 
 
@@ -1177,59 +2121,53 @@ void ebt_add_watcher(struct ebt_u_entry *new_entry, struct ebt_u_watcher *w)
          */
 
 
-/* type = 0 => update chain jumps
- * type = 1 => check for reference, print error when referenced
- * type = 2 => check for reference, don't print error when referenced
- *
- * Returns 1 when type == 1 and the chain is referenced
- * returns 0 otherwise */
-static int iterate_entries(struct ebt_u_replace *replace, int type)
+/* Returns 1 when the udc chain_nr (>= NF_BR_NUMHOOKS) is referenced, 0
+ * otherwise. When print_err is set, the first referencing rule is named in
+ * the error message. */
+static int check_references(struct ebt_u_replace *replace, int chain_nr,
+			    int print_err)
 {
-	int i, j, chain_nr = replace->selected_chain - NF_BR_NUMHOOKS;
-	struct ebt_u_entries *entries;
-	struct ebt_u_entry *e;
-
-	if (chain_nr < 0)
-		ebt_print_bug("iterate_entries: udc = %d < 0", chain_nr);
-	for (i = 0; i < replace->num_chains; i++) {
-		if (!(entries = replace->chains[i]))
-			continue;
-		e = entries->entries->next;
-		for (j = 0; j < entries->nentries; j++) {
-			int chain_jmp;
-
-			if (strcmp(e->t->u.name, EBT_STANDARD_TARGET)) {
-				e = e->next;
-				continue;
-			}
-			chain_jmp = ((struct ebt_standard_target *)e->t)->
-				    verdict;
-			switch (type) {
-			case 1:
-			case 2:
-			if (chain_jmp == chain_nr) {
-				if (type == 2)
-					return 1;
-				ebt_print_error("Can't delete the chain '%s', it's referenced in chain '%s', rule %d",
-				                replace->chains[chain_nr + NF_BR_NUMHOOKS]->name, entries->name, j);
-				return 1;
-			}
-			break;
-			case 0:
-			/* Adjust the chain jumps when necessary */
-			if (chain_jmp > chain_nr)
-				((struct ebt_standard_target *)e->t)->verdict--;
-			break;
-			} /* End switch */
-			e = e->next;
+	struct ebt_u_entry *e, *root;
+	int i, nr, first_chain = -1, first_nr = 0;
+
+	if (chain_nr < NF_BR_NUMHOOKS)
+		ebt_print_bug("check_references: udc = %d < 0",
+		   chain_nr - NF_BR_NUMHOOKS);
+	if (!replace->chains[chain_nr]->refs)
+		return 0;
+	if (!print_err)
+		return 1;
+	/* Only the error message needs to know where the rules are */
+	for (e = replace->chains[chain_nr]->refs; e; e = e->ref_next) {
+		for (root = e; root->idx_parent; root = root->idx_parent);
+		for (i = 0; i < replace->num_chains; i++)
+			if (replace->chains[i] &&
+			    replace->chains[i]->index == root)
+				break;
+		nr = ebt_entry_to_rule_nr(e);
+		if (first_chain == -1 || i < first_chain ||
+		    (i == first_chain && nr < first_nr)) {
+			first_chain = i;
+			first_nr = nr;
 		}
 	}
-	return 0;
+	ebt_print_error("Can't delete the chain '%s', it's referenced in chain '%s', rule %d",
+	                replace->chains[chain_nr]->name,
+	                replace->chains[first_chain]->name, first_nr);
+	return 1;
 }
 
+/* The udc selected_chain is deleted, the jumps to udc's behind it
+ * must be decremented. The fingerprints of the rules stay valid, the
+ * hash of the standard target doesn't depend on the udc it jumps to. */
 static void decrease_chain_jumps(struct ebt_u_replace *replace)
 {
-	iterate_entries(replace, 0);
+	struct ebt_u_entry *e;
+	int i;
+
+	for (i = replace->selected_chain + 1; i < replace->num_chains; i++)
+		for (e = replace->chains[i]->refs; e; e = e->ref_next)
+			((struct ebt_standard_target *)e->t)->verdict--;
 }
 
 /* Used in initialization code of modules */
@@ -1248,6 +2186,10 @@ void ebt_register_match(struct ebt_u_match *m)
 	for (i = &ebt_matches; *i; i = &((*i)->next));
 	m->next = NULL;
 	*i = m;
+	m->id = nr_matches++;
+	i = &match_hash[ext_hash(m->name)];
+	m->name_next = *i;
+	*i = m;
 }
 
 void ebt_register_watcher(struct ebt_u_watcher *w)
@@ -1265,6 +2207,10 @@ void ebt_register_watcher(struct ebt_u_watcher *w)
 	for (i = &ebt_watchers; *i; i = &((*i)->next));
 	w->next = NULL;
 	*i = w;
+	w->id = nr_watchers++;
+	i = &watcher_hash[ext_hash(w->name)];
+	w->name_next = *i;
+	*i = w;
 }
 
 void ebt_register_target(struct ebt_u_target *t)
@@ -1282,6 +2228,10 @@ void ebt_register_target(struct ebt_u_target *t)
 	for (i = &ebt_targets; *i; i = &((*i)->next));
 	t->next = NULL;
 	*i = t;
+	t->id = nr_targets++;
+	i = &target_hash[ext_hash(t->name)];
+	t->name_next = *i;
+	*i = t;
 }
 
 void ebt_register_table(struct ebt_u_table *t)
@@ -1319,6 +2269,7 @@ void __ebt_print_bug(char *file, int line, char *format, ...)
 {
 	va_list l;
 
+	ebt_out_flush();
 	va_start(l, format);
 	fprintf(stderr, PROGNAME" v"PROGVERSION":%s:%d:--BUG--: \n", file, line);
 	vfprintf(stderr, format, l);
@@ -1343,6 +2294,8 @@ void __ebt_print_error(char *format, ...)
 		vsnprintf(ebt_errormsg, ERRORMSG_MAXLEN, format, l);
 		va_end(l);
 	} else {
+		/* Don't lose what was listed before the error */
+		ebt_out_flush();
 		vfprintf(stderr, format, l);
 		fprintf(stderr, ".\n");
 		va_end(l);
@@ -33,6 +33,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <stdarg.h>
 
 const unsigned char mac_type_unicast[ETH_ALEN] =   {0,0,0,0,0,0};
 const unsigned char msk_type_unicast[ETH_ALEN] =   {1,0,0,0,0,0};
@@ -43,20 +44,209 @@ const unsigned char msk_type_broadcast[ETH_ALEN] = {255,255,255,255,255,255};
 const unsigned char mac_type_bridge_group[ETH_ALEN] = {0x01,0x80,0xc2,0,0,0};
 const unsigned char msk_type_bridge_group[ETH_ALEN] = {255,255,255,255,255,255};
 
+/* Output buffer for the listing code and the print() functions of the
+ * extensions. Everything written with ebt_out_*(), ebt_print_mac() and
+ * ebt_print_mac_and_mask() is collected here and handed to stdout in
+ * big chunks, instead of going through printf() for every field. Don't
+ * mix this with printf() before calling ebt_out_flush(). */
+#define OUT_BUFSIZE 65536
+static char out_buf[OUT_BUFSIZE];
+static int out_len;
+static const char hexdigits[] = "0123456789abcdef";
+
+static void out_drain(void)
+{
+	if (out_len) {
+		fwrite(out_buf, 1, out_len, stdout);
+		out_len = 0;
+	}
+}
+
+/* Write out the buffered data, to be called when the output is complete */
+void ebt_out_flush(void)
+{
+	out_drain();
+	fflush(stdout);
+}
+
+void ebt_out_write(const char *s, int len)
+{
+	if (len > OUT_BUFSIZE - out_len) {
+		out_drain();
+		if (len >= OUT_BUFSIZE) {
+			fwrite(s, 1, len, stdout);
+			return;
+		}
+	}
+	memcpy(out_buf + out_len, s, len);
+	out_len += len;
+}
+
+void ebt_out_str(const char *s)
+{
+	ebt_out_write(s, strlen(s));
+}
+
+void ebt_out_char(char c)
+{
+	if (out_len == OUT_BUFSIZE)
+		out_drain();
+	out_buf[out_len++] = c;
+}
+
+/* Remove the last character from the buffer if it equals c,
+ * returns 1 if it did */
+int ebt_out_unput(char c)
+{
+	if (out_len == 0 || out_buf[out_len - 1] != c)
+		return 0;
+	out_len--;
+	return 1;
+}
+
+/* Decimal number */
+void ebt_out_unsigned(unsigned long long n)
+{
+	char buf[20];
+	int i = sizeof(buf);
+
+	do {
+		buf[--i] = '0' + n % 10;
+		n /= 10;
+	} while (n);
+	ebt_out_write(buf + i, sizeof(buf) - i);
+}
+
+/* Hexadecimal number with a "0x" prefix, padded with zeros to at
+ * least digits digits */
+void ebt_out_hex(unsigned long long n, int digits)
+{
+	char buf[2 + 16];
+	int i = sizeof(buf);
+
+	do {
+		buf[--i] = hexdigits[n & 0xf];
+		n >>= 4;
+		digits--;
+	} while (n || (digits > 0 && i > 2));
+	buf[--i] = 'x';
+	buf[--i] = '0';
+	ebt_out_write(buf + i, sizeof(buf) - i);
+}
+
+/* Dotted quad, ip is in network order */
+void ebt_out_ip(uint32_t ip)
+{
+	const unsigned char *p = (const unsigned char *)&ip;
+	char buf[16];
+	int i, len = 0;
+
+	for (i = 0; i < 4; i++) {
+		if (p[i] >= 100)
+			buf[len++] = '0' + p[i] / 100;
+		if (p[i] >= 10)
+			buf[len++] = '0' + p[i] / 10 % 10;
+		buf[len++] = '0' + p[i] % 10;
+		buf[len++] = '.';
+	}
+	ebt_out_write(buf, len - 1);
+}
+
+/* The address followed by the mask, in the format of ebt_mask_to_dotted() */
+void ebt_out_ip_and_mask(uint32_t ip, uint32_t mask)
+{
+	ebt_out_ip(ip);
+	ebt_out_str(ebt_mask_to_dotted(mask));
+}
+
+/* Same output as inet_ntop(AF_INET6, ...) */
+void ebt_out_ip6(const struct in6_addr *addr)
+{
+	const unsigned char *p = addr->s6_addr;
+	char buf[INET6_ADDRSTRLEN];
+	int words[8], i, len = 0, base = -1, best = 0, cur = -1;
+
+	for (i = 0; i < 8; i++) {
+		words[i] = p[2 * i] << 8 | p[2 * i + 1];
+		if (words[i] == 0) {
+			if (cur == -1)
+				cur = i;
+			if (i - cur + 1 > best) {
+				base = cur;
+				best = i - cur + 1;
+			}
+		} else
+			cur = -1;
+	}
+	/* A single zero word isn't shortened */
+	if (best < 2)
+		base = -1;
+	for (i = 0; i < 8; i++) {
+		int shift;
+
+		if (base != -1 && i >= base && i < base + best) {
+			if (i == base)
+				buf[len++] = ':';
+			continue;
+		}
+		if (i)
+			buf[len++] = ':';
+		/* IPv4 compatible or mapped address */
+		if (i == 6 && base == 0 &&
+		    (best == 6 || (best == 5 && words[5] == 0xffff))) {
+			ebt_out_write(buf, len);
+			ebt_out_ip(addr->s6_addr32[3]);
+			return;
+		}
+		for (shift = 12; shift > 0 && !(words[i] >> shift); shift -= 4);
+		for (; shift >= 0; shift -= 4)
+			buf[len++] = hexdigits[(words[i] >> shift) & 0xf];
+	}
+	if (base != -1 && base + best == 8)
+		buf[len++] = ':';
+	ebt_out_write(buf, len);
+}
+
+/* For the few things that aren't worth a dedicated function */
+void ebt_out_printf(const char *format, ...)
+{
+	va_list l;
+	int len;
+
+	va_start(l, format);
+	len = vsnprintf(out_buf + out_len, OUT_BUFSIZE - out_len, format, l);
+	va_end(l);
+	if (len < OUT_BUFSIZE - out_len) {
+		out_len += len;
+		return;
+	}
+	out_drain();
+	va_start(l, format);
+	if (len < OUT_BUFSIZE)
+		out_len = vsnprintf(out_buf, OUT_BUFSIZE, format, l);
+	else
+		vfprintf(stdout, format, l);
+	va_end(l);
+}
+
 /* 0: default, print only 2 digits if necessary
  * 2: always print 2 digits, a printed mac address
  * then always has the same length */
 int ebt_printstyle_mac;
 
+/* Same output as ether_ntoa() */
 void ebt_print_mac(const unsigned char *mac)
 {
-	if (ebt_printstyle_mac == 2) {
-		int j;
-		for (j = 0; j < ETH_ALEN; j++)
-			printf("%02x%s", mac[j],
-				(j==ETH_ALEN-1) ? "" : ":");
-	} else
-		printf("%s", ether_ntoa((struct ether_addr *) mac));
+	char buf[3 * ETH_ALEN];
+	int j, len = 0;
+
+	for (j = 0; j < ETH_ALEN; j++) {
+		if (mac[j] > 0xf || ebt_printstyle_mac == 2)
+			buf[len++] = hexdigits[mac[j] >> 4];
+		buf[len++] = hexdigits[mac[j] & 0xf];
+		buf[len++] = ':';
+	}
+	ebt_out_write(buf, len - 1);
 }
 
 void ebt_print_mac_and_mask(const unsigned char *mac, const unsigned char *mask)
@@ -65,20 +255,20 @@ void ebt_print_mac_and_mask(const unsigned char *mac, const unsigned char *mask)
 
 	if (!memcmp(mac, mac_type_unicast, 6) &&
 	    !memcmp(mask, msk_type_unicast, 6))
-		printf("Unicast");
+		ebt_out_str("Unicast");
 	else if (!memcmp(mac, mac_type_multicast, 6) &&
 	         !memcmp(mask, msk_type_multicast, 6))
-		printf("Multicast");
+		ebt_out_str("Multicast");
 	else if (!memcmp(mac, mac_type_broadcast, 6) &&
 	         !memcmp(mask, msk_type_broadcast, 6))
-		printf("Broadcast");
+		ebt_out_str("Broadcast");
 	else if (!memcmp(mac, mac_type_bridge_group, 6) &&
 	         !memcmp(mask, msk_type_bridge_group, 6))
-		printf("BGA");
+		ebt_out_str("BGA");
 	else {
 		ebt_print_mac(mac);
 		if (memcmp(mask, hlpmsk, 6)) {
-			printf("/");
+			ebt_out_char('/');
 			ebt_print_mac(mask);
 		}
 	}
@@ -94,44 +284,92 @@ struct ethertypeent *parseethertypebynumber(int type)
 	return getethertypebynumber(type);
 }
 
+/*
+ * Address scanners, used by ebtables and the extensions. They parse the
+ * address at *s without looking at end or beyond and leave *s behind it,
+ * the caller decides what may follow. On error -1 is returned and *s
+ * points at the first character that doesn't fit, so error messages can
+ * show where the problem is.
+ */
+
+/* The value of a hexadecimal digit + 1, 0 for other characters */
+static const unsigned char hex_value[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16
+};
+#define HEX_VALUE(c) (hex_value[(unsigned char)(c)] - 1)
+#define IS_DIGIT(c) ((unsigned char)((c) - '0') < 10)
+
+/* Six bytes of one or two hexadecimal digits, separated by ':' */
+int ebt_scan_mac(const char **s, const char *end, unsigned char *mac)
+{
+	const char *p = *s;
+	int i, val, d;
+
+	for (i = 0; i < ETH_ALEN; i++) {
+		if (i) {
+			if (p == end || *p != ':')
+				goto error;
+			p++;
+		}
+		if (p == end || (val = HEX_VALUE(*p)) < 0)
+			goto error;
+		p++;
+		if (p != end && (d = HEX_VALUE(*p)) >= 0) {
+			val = val * 16 + d;
+			p++;
+		}
+		mac[i] = val;
+	}
+	*s = p;
+	return 0;
+error:
+	*s = p;
+	return -1;
+}
+
 /* Put the mac address into 6 (ETH_ALEN) bytes returns 0 on success. */
+int ebt_get_mac(const char *from, unsigned char *to)
+{
+	const char *p = from;
+
+	return ebt_scan_mac(&p, from + strlen(from), to) || *p ? -1 : 0;
+}
+
+static const struct {
+	const char *name;
+	const unsigned char *mac, *msk;
+} mac_types[] = {
+	{ "Unicast", mac_type_unicast, msk_type_unicast },
+	{ "Multicast", mac_type_multicast, msk_type_multicast },
+	{ "Broadcast", mac_type_broadcast, msk_type_broadcast },
+	{ "BGA", mac_type_bridge_group, msk_type_bridge_group },
+};
+
+/* Put the mac address and its mask (default ff:ff:ff:ff:ff:ff) into 6
+ * (ETH_ALEN) bytes each, returns 0 on success. */
 int ebt_get_mac_and_mask(const char *from, unsigned char *to,
   unsigned char *mask)
 {
-	char *p;
+	const char *p = from, *end = from + strlen(from);
 	int i;
-	struct ether_addr *addr;
 
-	if (strcasecmp(from, "Unicast") == 0) {
-		memcpy(to, mac_type_unicast, ETH_ALEN);
-		memcpy(mask, msk_type_unicast, ETH_ALEN);
-		return 0;
-	}
-	if (strcasecmp(from, "Multicast") == 0) {
-		memcpy(to, mac_type_multicast, ETH_ALEN);
-		memcpy(mask, msk_type_multicast, ETH_ALEN);
-		return 0;
-	}
-	if (strcasecmp(from, "Broadcast") == 0) {
-		memcpy(to, mac_type_broadcast, ETH_ALEN);
-		memcpy(mask, msk_type_broadcast, ETH_ALEN);
-		return 0;
-	}
-	if (strcasecmp(from, "BGA") == 0) {
-		memcpy(to, mac_type_bridge_group, ETH_ALEN);
-		memcpy(mask, msk_type_bridge_group, ETH_ALEN);
-		return 0;
+	if (ebt_scan_mac(&p, end, to)) {
+		/* None of the names is a valid address */
+		for (i = 0; i < sizeof(mac_types) / sizeof(mac_types[0]); i++)
+			if (!strcasecmp(from, mac_types[i].name)) {
+				memcpy(to, mac_types[i].mac, ETH_ALEN);
+				memcpy(mask, mac_types[i].msk, ETH_ALEN);
+				return 0;
+			}
+		return -1;
 	}
-	if ( (p = strrchr(from, '/')) != NULL) {
-		*p = '\0';
-		if (!(addr = ether_aton(p + 1)))
-			return -1;
-		memcpy(mask, addr, ETH_ALEN);
-	} else
+	if (p == end)
 		memset(mask, 0xff, ETH_ALEN);
-	if (!(addr = ether_aton(from)))
+	else if (*p++ != '/' || ebt_scan_mac(&p, end, mask) || p != end)
 		return -1;
-	memcpy(to, addr, ETH_ALEN);
 	for (i = 0; i < ETH_ALEN; i++)
 		to[i] &= mask[i];
 	return 0;
@@ -172,78 +410,91 @@ void ebt_check_option(unsigned int *flags, unsigned int mask)
 	*flags |= mask;
 }
 
-/* Put the ip string into 4 bytes. */
-static int undot_ip(char *ip, unsigned char *ip2)
+/* Four decimal numbers up to 255, separated by '.' */
+int ebt_scan_ip(const char **s, const char *end, uint32_t *ip)
 {
-	char *p, *q, *end;
-	long int onebyte;
+	const char *p = *s;
+	unsigned char bytes[4];
+	unsigned int val, digits;
 	int i;
-	char buf[20];
 
-	strncpy(buf, ip, sizeof(buf) - 1);
-
-	p = buf;
-	for (i = 0; i < 3; i++) {
-		if ((q = strchr(p, '.')) == NULL)
-			return -1;
-		*q = '\0';
-		onebyte = strtol(p, &end, 10);
-		if (*end != '\0' || onebyte > 255 || onebyte < 0)   
-			return -1;
-		ip2[i] = (unsigned char)onebyte;
-		p = q + 1;
+	for (i = 0; i < 4; i++) {
+		if (i) {
+			if (p == end || *p != '.')
+				goto error;
+			p++;
+		}
+		for (val = digits = 0; digits < 3 && p != end && IS_DIGIT(*p);
+		     digits++, p++)
+			val = val * 10 + *p - '0';
+		if (!digits)
+			goto error;
+		if (val > 255) {
+			p -= digits;
+			goto error;
+		}
+		bytes[i] = val;
 	}
+	memcpy(ip, bytes, 4);
+	*s = p;
+	return 0;
+error:
+	*s = p;
+	return -1;
+}
 
-	onebyte = strtol(p, &end, 10);
-	if (*end != '\0' || onebyte > 255 || onebyte < 0)
+/* A dotted mask or the number of leading 1 bits */
+int ebt_scan_ip_mask(const char **s, const char *end, uint32_t *mask)
+{
+	const char *p = *s;
+	unsigned int bits, digits;
+
+	for (bits = digits = 0; digits < 3 && p != end && IS_DIGIT(*p);
+	     digits++, p++)
+		bits = bits * 10 + *p - '0';
+	if (p != end && *p == '.')
+		return ebt_scan_ip(s, end, mask);
+	if (!digits || bits > 32) {
+		*s = p - digits;
 		return -1;
-	ip2[3] = (unsigned char)onebyte;
-
+	}
+	/* /0 has always been taken as /32 */
+	*mask = bits ? htonl(0xFFFFFFFF << (32 - bits)) : 0xFFFFFFFF;
+	*s = p;
 	return 0;
 }
 
-/* Put the mask into 4 bytes. */
-static int ip_mask(char *mask, unsigned char *mask2)
+/* pos is where the scanner stopped in arg */
+static void address_error(const char *what, const char *arg, const char *pos)
 {
-	char *end;
-	long int bits;
-	uint32_t mask22;
-
-	if (undot_ip(mask, mask2)) {
-		/* not the /a.b.c.e format, maybe the /x format */
-		bits = strtol(mask, &end, 10);
-		if (*end != '\0' || bits > 32 || bits < 0)
-			return -1;
-		if (bits != 0) {
-			mask22 = htonl(0xFFFFFFFF << (32 - bits));
-			memcpy(mask2, &mask22, 4);
-		} else {
-			mask22 = 0xFFFFFFFF;
-			memcpy(mask2, &mask22, 4);
-		}
+	if (pos == arg || !*arg) {
+		ebt_print_error("Problem with the %s '%s'", what, arg);
+	} else if (*pos) {
+		ebt_print_error("Problem with the %s '%s' at '%s'", what, arg,
+				pos);
+	} else {
+		ebt_print_error("Problem with the %s '%s', it ends too soon",
+				what, arg);
 	}
-	return 0;
 }
 
-/* Set the ip mask and ip address. Callers should check ebt_errormsg[0].
- * The string pointed to by address can be altered. */
+/* Set the ip mask and ip address. Callers should check ebt_errormsg[0]. */
 void ebt_parse_ip_address(char *address, uint32_t *addr, uint32_t *msk)
 {
-	char *p;
+	const char *p = address, *end = address + strlen(address), *mask;
 
-	/* first the mask */
-	if ((p = strrchr(address, '/')) != NULL) {
-		*p = '\0';
-		if (ip_mask(p + 1, (unsigned char *)msk)) {
-			ebt_print_error("Problem with the IP mask '%s'", p + 1);
+	if (ebt_scan_ip(&p, end, addr) || (p != end && *p != '/')) {
+		address_error("IP address", address, p);
+		return;
+	}
+	if (p == end)
+		*msk = 0xFFFFFFFF;
+	else {
+		mask = ++p;
+		if (ebt_scan_ip_mask(&p, end, msk) || p != end) {
+			address_error("IP mask", mask, p);
 			return;
 		}
-	} else
-		*msk = 0xFFFFFFFF;
-
-	if (undot_ip(address, (unsigned char *)addr)) {
-		ebt_print_error("Problem with the IP address '%s'", address);
-		return;
 	}
 	*addr = *addr & *msk;
 }
@@ -283,12 +534,6 @@ char *ebt_mask_to_dotted(uint32_t mask)
 }
 
 /* Most of the following code is derived from iptables */
-static void
-in6addrcpy(struct in6_addr *dst, struct in6_addr *src)
-{
-	memcpy(dst, src, sizeof(struct in6_addr));
-}
-
 int string_to_number_ll(const char *s, unsigned long long min,
             unsigned long long max, unsigned long long *ret)
 {
@@ -332,70 +577,121 @@ int string_to_number(const char *s, unsigned int min, unsigned int max,
 	return result;
 }
 
-static struct in6_addr *numeric_to_addr(const char *num)
+/* Up to eight groups of up to four hexadecimal digits separated by ':',
+ * "::" once for a run of zero groups, optionally with an IPv4 address in
+ * the last 32 bits */
+int ebt_scan_ip6(const char **s, const char *end, struct in6_addr *ip6)
 {
-	static struct in6_addr ap;
-	int err;
-
-	if ((err=inet_pton(AF_INET6, num, &ap)) == 1)
-		return &ap;
-	return (struct in6_addr *)NULL;
+	const char *p = *s, *group;
+	unsigned char bytes[16];
+	unsigned int val, digits;
+	int n = 0, gap = -1, d;
+	uint32_t ip4;
+
+	if (p != end && *p == ':') {
+		if (++p == end || *p != ':')
+			goto error;
+		p++;
+		gap = 0;
+		if (p == end || HEX_VALUE(*p) < 0)
+			goto done;
+	}
+	while (1) {
+		group = p;
+		for (val = digits = 0; digits < 4 && p != end &&
+		     (d = HEX_VALUE(*p)) >= 0; digits++, p++)
+			val = val * 16 + d;
+		if (!digits)
+			goto error;
+		if (p != end && *p == '.') {
+			p = group;
+			if (n > 12 || ebt_scan_ip(&p, end, &ip4))
+				goto error;
+			memcpy(bytes + n, &ip4, 4);
+			n += 4;
+			break;
+		}
+		bytes[n++] = val >> 8;
+		bytes[n++] = val;
+		if (n == 16 || p == end || *p != ':')
+			break;
+		if (p + 1 != end && p[1] == ':') {
+			if (gap != -1) {
+				p++;
+				goto error;
+			}
+			p += 2;
+			gap = n;
+			if (p == end || HEX_VALUE(*p) < 0)
+				break;
+		} else
+			p++;
+	}
+done:
+	/* "::" stands for at least one group */
+	if (gap == -1 ? n != 16 : n == 16)
+		goto error;
+	if (gap == -1)
+		gap = n;
+	memset(ip6, 0, sizeof(*ip6));
+	memcpy(ip6->s6_addr, bytes, gap);
+	memcpy(ip6->s6_addr + 16 - (n - gap), bytes + gap, n - gap);
+	*s = p;
+	return 0;
+error:
+	*s = p;
+	return -1;
 }
 
-static struct in6_addr *parse_ip6_mask(char *mask)
+/* An IPv6 address or the number of leading 1 bits */
+int ebt_scan_ip6_mask(const char **s, const char *end, struct in6_addr *mask)
 {
-	static struct in6_addr maskaddr;
-	struct in6_addr *addrp;
-	unsigned int bits;
+	const char *p = *s;
+	unsigned int bits, digits;
+	int i;
 
-	if (mask == NULL) {
-		/* no mask at all defaults to 128 bits */
-		memset(&maskaddr, 0xff, sizeof maskaddr);
-		return &maskaddr;
-	}
-	if ((addrp = numeric_to_addr(mask)) != NULL)
-		return addrp;
-	if (string_to_number(mask, 0, 128, &bits) == -1)
-		ebt_print_error("Invalid IPv6 Mask '%s' specified", mask);
-	if (bits != 0) {
-		char *p = (char *)&maskaddr;
-		memset(p, 0xff, bits / 8);
-		memset(p + (bits / 8) + 1, 0, (128 - bits) / 8);
-		p[bits / 8] = 0xff << (8 - (bits & 7));
-		return &maskaddr;
+	for (bits = digits = 0; digits < 3 && p != end && IS_DIGIT(*p);
+	     digits++, p++)
+		bits = bits * 10 + *p - '0';
+	if (p != end && (*p == ':' || *p == '.' || HEX_VALUE(*p) >= 0))
+		return ebt_scan_ip6(s, end, mask);
+	if (!digits || bits > 128) {
+		*s = p - digits;
+		return -1;
 	}
-
-	memset(&maskaddr, 0, sizeof maskaddr);
-	return &maskaddr;
+	for (i = 0; i < 16; i++, bits -= bits < 8 ? bits : 8)
+		mask->s6_addr[i] = bits >= 8 ? 0xff : 0xff00 >> bits;
+	*s = p;
+	return 0;
 }
 
-/* Set the ipv6 mask and address. Callers should check ebt_errormsg[0].
- * The string pointed to by address can be altered. */
+/* Set the ipv6 mask and address. Callers should check ebt_errormsg[0]. */
 void ebt_parse_ip6_address(char *address, struct in6_addr *addr,
                            struct in6_addr *msk)
 {
-	struct in6_addr *tmp_addr;
-	char buf[256];
-	char *p;
+	const char *p, *slash, *end = address + strlen(address);
 	int i;
-	int err;
-
-	strncpy(buf, address, sizeof(buf) - 1);
-	/* first the mask */
-	buf[sizeof(buf) - 1] = '\0';
-	if ((p = strrchr(buf, '/')) != NULL) {
-		*p = '\0';
-		tmp_addr = parse_ip6_mask(p + 1);
-	} else
-		tmp_addr = parse_ip6_mask(NULL);
-	in6addrcpy(msk, tmp_addr);
+
+	if ((slash = strrchr(address, '/')) != NULL) {
+		p = slash + 1;
+		if (ebt_scan_ip6_mask(&p, end, msk) || p != end) {
+			address_error("IPv6 mask", slash + 1, p);
+			return;
+		}
+	} else {
+		memset(msk, 0xff, sizeof(*msk));
+		slash = end;
+	}
 
 	/* if a null mask is given, the name is ignored, like in "any/0" */
-	if (!memcmp(msk, &in6addr_any, sizeof(in6addr_any)))
-		strcpy(buf, "::");
+	if (!memcmp(msk, &in6addr_any, sizeof(in6addr_any))) {
+		memset(addr, 0, sizeof(*addr));
+		return;
+	}
 
-	if ((err=inet_pton(AF_INET6, buf, addr)) < 1) {
-		ebt_print_error("Invalid IPv6 Address '%s' specified", buf);
+	p = address;
+	if (ebt_scan_ip6(&p, slash, addr) || p != slash) {
+		address_error("IPv6 address", address, p);
 		return;
 	}
 